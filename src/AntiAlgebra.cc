@@ -31,11 +31,6 @@ struct AntiAlgebra : AntiFunctionPass {
 		AU.setPreservesCFG();
 	}
 
-	virtual bool doInitialization(Module &) {
-		TLI = getAnalysisIfAvailable<TargetLibraryInfo>();
-		return false;
-	}
-
 	virtual bool runOnAntiFunction(Function &);
 
 private:
@@ -49,7 +44,8 @@ private:
 } // anonymous namespace
 
 bool AntiAlgebra::runOnAntiFunction(Function &F) {
-	SE = &getAnalysis<ScalarEvolution>();
+	TLI = Host->getAnalysisIfAvailable<TargetLibraryInfo>();
+	SE = &Host->getAnalysis<ScalarEvolution>();
 	bool Changed = false;
 	for (inst_iterator i = inst_begin(F), e = inst_end(F); i != e; ) {
 		Instruction *I = &*i++;
@@ -124,13 +120,18 @@ bool AntiAlgebra::visitICmpInst(ICmpInst *I) {
 	// Transform (lhs op rhs) to ((lhs - rhs) op 0).
 	ICmpInst *NewCmp = new ICmpInst(I, I->getSignedPredicate(), V, Z);
 	NewCmp->setDebugLoc(I->getDebugLoc());
-	int isEqv = 0;
-	if (SMTFork() == 0)
+	int isEqv;
+	{
+		SMTTimer Timer;
 		isEqv = checkEqv(I, NewCmp);
-	SMTJoin(&isEqv);
+		if (Timer.expired()) {
+			isEqv = SMT_TIMEOUT;
+			resetSession();
+		}
+	}
 	BENCHMARK(Diagnostic() << "query: " << qstr(isEqv) << "\n");
 	if (isEqv <= 0) {
-		RecursivelyDeleteTriviallyDeadInstructions(NewCmp, TLI);
+		deleteDeadInstructions(NewCmp, TLI);
 		return false;
 	}
 	Diag.bug(DEBUG_TYPE);
@@ -142,32 +143,38 @@ bool AntiAlgebra::visitICmpInst(ICmpInst *I) {
 	printMinimalAssertions();
 	I->replaceAllUsesWith(NewCmp);
 	RecursivelyDeleteTriviallyDeadInstructions(I, TLI);
+	resetSession();
 	return true;
 }
 
 int AntiAlgebra::checkEqv(ICmpInst *I0, ICmpInst *I1) {
-	SMTSolver SMT(false);
-	ValueGen VG(*DL, SMT);
-	PathGen PG(VG, Backedges, *DT);
+	AntiSession &S = getSession();
+	SMTSolver &SMT = S.SMT;
+	ValueGen &VG = S.VG;
 	int isEqv = 0;
 	SMTExpr E0 = VG.get(I0);
 	SMTExpr E1 = VG.get(I1);
-	SMTExpr Q = SMT.ne(E0, E1);
+	SMTExpr NE = SMT.ne(E0, E1);
 	BasicBlock *BB = I0->getParent();
-	SMTExpr R = PG.get(BB);
-	SMT.assume(R);
-	// E0 != E1 without bug-free assertions; must be reachable as well.
-	if (SMT.query(Q) == SMT_SAT) {
-		SMTExpr Delta = getDeltaForBlock(BB, VG);
-		if (Delta) {
-			// E0 == E1 with bug-free assertions.
-			SMTStatus Status = queryWithDelta(Q, Delta, VG);
-			SMT.decref(Delta);
-			if (Status == SMT_UNSAT)
-				isEqv = 1;
+	SMTExpr R = S.PG.get(BB);
+	SMTExpr Q = SMT.bvand(R, NE);
+	SMTExpr Delta = getDeltaForBlock(BB, VG);
+	// The query with Delta needs only what is related to NE.
+	SMTExpr SR = R;
+	if (Delta)
+		Delta = slice(NE, &SR, VG);
+	if (Delta) {
+		SMTExpr SQ = SMT.bvand(SR, NE);
+		SMTExpr Qs[2] = {Q, SMT.bvand(SQ, Delta)};
+		SMTStatus Status[2];
+		SMT.query(2, Qs, Status);
+		// E0 != E1 without bug-free assertions (and reachable),
+		// but E0 == E1 with bug-free assertions.
+		if (Status[0] == SMT_SAT && Status[1] == SMT_UNSAT) {
+			minimizeDelta(SQ, VG);
+			isEqv = 1;
 		}
 	}
-	SMT.decref(Q);
 	return isEqv;
 }
 
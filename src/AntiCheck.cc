@@ -0,0 +1,79 @@
+// This pass runs the checks of anti-dce, anti-simplify and anti-algebra
+// in turn on each function, as the three passes would, but on a single
+// solver session, so that path conditions, bug-free assertions and values
+// are encoded once rather than by each of them.  The session is reset only
+// when a check changes the IR, as in each of the passes.
+
+#define DEBUG_TYPE "anti-check"
+#include "AntiFunctionPass.h"
+#include <llvm/PassRegistry.h>
+#include <llvm/Analysis/Dominators.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/PostDominators.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+
+using namespace llvm;
+
+namespace {
+
+struct AntiCheck : AntiFunctionPass {
+	static char ID;
+	AntiCheck() : AntiFunctionPass(ID) {
+		DCE = create("anti-dce");
+		Simplify = create("anti-simplify");
+		Algebra = create("anti-algebra");
+	}
+
+	~AntiCheck() {
+		delete DCE;
+		delete Simplify;
+		delete Algebra;
+	}
+
+	virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+		AntiFunctionPass::getAnalysisUsage(AU);
+		AU.addRequired<LoopInfo>();
+		AU.addRequired<ScalarEvolution>();
+		AU.addPreserved<DominatorTree>();
+		AU.addPreserved<PostDominatorTree>();
+	}
+
+	virtual bool runOnAntiFunction(Function &);
+
+private:
+	AntiFunctionPass *DCE, *Simplify, *Algebra;
+
+	static AntiFunctionPass *create(StringRef Arg) {
+		const PassInfo *PI = PassRegistry::getPassRegistry()->getPassInfo(Arg);
+		assert(PI && "Anti pass not registered");
+		return static_cast<AntiFunctionPass *>(PI->createPass());
+	}
+};
+
+} // anonymous namespace
+
+bool AntiCheck::runOnAntiFunction(Function &F) {
+	bool Changed = runChecksOf(*DCE, F);
+	Changed |= runChecksOf(*Simplify, F);
+	// The pass manager would give anti-algebra fresh loops and
+	// scalar evolution after the function has changed, but it cannot
+	// rerun them in the middle of this pass.  Their runOnFunction()
+	// does what it would: it only reads the dominator tree, which
+	// recalculate() has kept up to date, and the target data and
+	// library info, which do not change.
+	if (Changed) {
+		LoopInfo &LI = getAnalysis<LoopInfo>();
+		LI.releaseMemory();
+		LI.runOnFunction(F);
+		ScalarEvolution &SE = getAnalysis<ScalarEvolution>();
+		SE.releaseMemory();
+		SE.runOnFunction(F);
+	}
+	Changed |= runChecksOf(*Algebra, F);
+	return Changed;
+}
+
+char AntiCheck::ID;
+
+static RegisterPass<AntiCheck>
+X("anti-check", "Anti DCE, Simplification and Algebra on one session");
@@ -5,17 +5,23 @@
 
 #define DEBUG_TYPE "anti-dce"
 #include "AntiFunctionPass.h"
+#include <llvm/ADT/SmallPtrSet.h>
 #include <llvm/Analysis/Dominators.h>
 #include <llvm/Analysis/PostDominators.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/Support/CFG.h>
+#include <llvm/Support/CommandLine.h>
 #include <llvm/Support/Debug.h>
 #include <llvm/Transforms/Utils/Local.h>
 
 using namespace llvm;
 
+static cl::opt<bool>
+BatchOpt("anti-dce-batch",
+         cl::desc("Check all blocks before removing the dead ones"));
+
 namespace {
 
 struct AntiDCE: AntiFunctionPass {
@@ -31,10 +37,15 @@ struct AntiDCE: AntiFunctionPass {
 	virtual bool runOnAntiFunction(Function &);
 
 private:
+	bool runBatch(Function &);
 	bool shouldCheck(BasicBlock *BB);
+	int check(BasicBlock *BB);
 	int shouldKeepCode(BasicBlock *BB);
 	void report(BasicBlock *BB);
+	void foldBranches(BasicBlock *BB);
 	void markAsDead(BasicBlock *BB);
+	bool isBehindDead(BasicBlock *BB, ArrayRef<BasicBlock *> Dead,
+	                  const SmallPtrSet<BasicBlock *, 8> &Gone);
 };
 
 } // anonymous namespace
@@ -67,17 +78,14 @@ const char *qstr(int Keep) {
 }
 
 bool AntiDCE::runOnAntiFunction(Function &F) {
+	if (BatchOpt)
+		return runBatch(F);
 	bool Changed = false;
 	for (Function::iterator i = F.begin(), e = F.end(); i != e; ++i) {
 		BasicBlock *BB = i;
 		if (!shouldCheck(BB))
 			continue;
-		int Keep;
-		if (SMTFork() == 0)
-			Keep = shouldKeepCode(BB);
-		SMTJoin(&Keep);
-		BENCHMARK(Diagnostic() << "query: " << qstr(Keep) << "\n");
-		if (Keep)
+		if (check(BB))
 			continue;
 		report(BB);
 		Changed = true;
@@ -88,24 +96,95 @@ bool AntiDCE::runOnAntiFunction(Function &F) {
 	return Changed;
 }
 
+// Check all blocks against the same CFG and solver session, and then
+// remove the dead ones and update the dominator trees once, rather than
+// after each dead block.  A block that can only be reached through dead
+// ones found earlier in the sweep is removed silently, as the default
+// mode would find it unreachable.  This misses blocks that are only
+// proved dead once others have been removed.
+bool AntiDCE::runBatch(Function &F) {
+	SmallVector<BasicBlock *, 8> Dead, Behind;
+	SmallPtrSet<BasicBlock *, 8> Gone;
+	for (Function::iterator i = F.begin(), e = F.end(); i != e; ++i) {
+		BasicBlock *BB = i;
+		if (isBehindDead(BB, Dead, Gone)) {
+			Behind.push_back(BB);
+			Gone.insert(BB);
+			continue;
+		}
+		if (!shouldCheck(BB))
+			continue;
+		if (check(BB))
+			continue;
+		report(BB);
+		Dead.push_back(BB);
+		Gone.insert(BB);
+	}
+	if (Gone.empty())
+		return false;
+	for (BasicBlock *BB : Dead)
+		foldBranches(BB);
+	for (BasicBlock *BB : Dead)
+		markAsDead(BB);
+	for (BasicBlock *BB : Behind)
+		markAsDead(BB);
+	recalculate(F);
+	return true;
+}
+
+// Return true if BB is dominated by a dead block, or if all of its
+// predecessors are gone.
+bool AntiDCE::isBehindDead(BasicBlock *BB, ArrayRef<BasicBlock *> Dead,
+                           const SmallPtrSet<BasicBlock *, 8> &Gone) {
+	if (isa<UnreachableInst>(BB->getTerminator()))
+		return false;
+	for (BasicBlock *D : Dead) {
+		if (DT->dominates(D, BB))
+			return true;
+	}
+	pred_iterator i = pred_begin(BB), e = pred_end(BB);
+	if (i == e)
+		return false;
+	for (; i != e; ++i) {
+		if (!Gone.count(*i))
+			return false;
+	}
+	return true;
+}
+
+// Return 0 if BB is dead.
+int AntiDCE::check(BasicBlock *BB) {
+	int Keep;
+	{
+		SMTTimer Timer;
+		Keep = shouldKeepCode(BB);
+		if (Timer.expired()) {
+			Keep = SMT_TIMEOUT;
+			resetSession();
+		}
+	}
+	BENCHMARK(Diagnostic() << "query: " << qstr(Keep) << "\n");
+	return Keep;
+}
+
 int AntiDCE::shouldKeepCode(BasicBlock *BB) {
-	SMTSolver SMT(false);
-	ValueGen VG(*DL, SMT);
+	AntiSession &S = getSession();
+	SMTSolver &SMT = S.SMT;
 	// Compute path condition.
-	PathGen PG(VG, Backedges, *DT);
-	SMTExpr R = PG.get(BB);
-	// Ignore dead path.
-	if (SMT.query(R) == SMT_UNSAT)
-		return 1;
+	SMTExpr R = S.PG.get(BB);
 	// Collect bug assertions.
-	SMTExpr Delta = getDeltaForBlock(BB, VG);
+	SMTExpr Delta = getDeltaForBlock(BB, S.VG);
 	if (!Delta)
 		return 1;
-	SMTStatus Status = queryWithDelta(R, Delta, VG);
-	SMT.decref(Delta);
-	if (Status == SMT_UNSAT)
-		return 0;
-	return 1;
+	// A live path is the common case; ask both at once.
+	SMTExpr Qs[2] = {R, SMT.bvand(R, Delta)};
+	SMTStatus Status[2];
+	SMT.query(2, Qs, Status);
+	// Ignore dead path.
+	if (Status[0] == SMT_UNSAT || Status[1] != SMT_UNSAT)
+		return 1;
+	minimizeDelta(R, S.VG);
+	return 0;
 }
 
 void AntiDCE::report(BasicBlock *BB) {
@@ -123,9 +202,10 @@ void AntiDCE::report(BasicBlock *BB) {
 		Diag << *CondInst << "\n  -->  "
 		     << (CondVal ? "true" : "false")
 		     << "\n  ************************************************************\n";
-		BI->setCondition(ConstantInt::get(CondInst->getType(), CondVal));
-		RecursivelyDeleteTriviallyDeadInstructions(CondInst);
 	}
+	// Left to the end of the sweep in batch mode.
+	if (!BatchOpt)
+		foldBranches(BB);
 	Diag << "  " << BB->getName() << ":\n";
 	for (Instruction &I: *BB)
 		Diag << I << '\n';
@@ -138,7 +218,24 @@ void AntiDCE::report(BasicBlock *BB) {
 	printMinimalAssertions();
 }
 
+// Branch away from BB in its predecessors.
+void AntiDCE::foldBranches(BasicBlock *BB) {
+	resetSession();
+	for (auto i = pred_begin(BB), e = pred_end(BB); i != e; ++i) {
+		auto BI = dyn_cast<BranchInst>((*i)->getTerminator());
+		if (!BI || !BI->isConditional())
+			continue;
+		auto CondInst = dyn_cast<Instruction>(BI->getCondition());
+		if (!CondInst)
+			continue;
+		bool CondVal = (BI->getSuccessor(1) == BB);
+		BI->setCondition(ConstantInt::get(CondInst->getType(), CondVal));
+		RecursivelyDeleteTriviallyDeadInstructions(CondInst);
+	}
+}
+
 void AntiDCE::markAsDead(BasicBlock *BB) {
+	resetSession();
 	// Remove BB from successors.
 	std::vector<BasicBlock *> Succs(succ_begin(BB), succ_end(BB));
 	for (unsigned i = 0, e = Succs.size(); i != e; ++i)
@@ -1,5 +1,7 @@
 #include "AntiFunctionPass.h"
+#include <llvm/PassManager.h>
 #include <llvm/ADT/SCCIterator.h>
+#include <llvm/ADT/Triple.h>
 #include <llvm/Analysis/CFG.h>
 #include <llvm/Analysis/Dominators.h>
 #include <llvm/Analysis/PostDominators.h>
@@ -8,8 +10,14 @@
 #include <llvm/Support/CFG.h>
 #include <llvm/Support/CommandLine.h>
 #include <llvm/Support/Debug.h>
-#include <sys/mman.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetLibraryInfo.h>
+#include <llvm/Transforms/Utils/Local.h>
 #include <algorithm>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 #include <cxxabi.h>
 #include <stdlib.h>
 
@@ -23,7 +31,15 @@ static cl::opt<bool>
 MinBugOnOpt("min-bugon",
             cl::desc("Compute minimal bugon set"), cl::init(true));
 
-static const size_t BUFFER_SIZE = 4096;
+static cl::opt<bool>
+SliceOpt("slice-queries",
+         cl::desc("Drop path conditions and bugons unrelated to the query"),
+         cl::init(true));
+
+static cl::opt<unsigned>
+ThreadsOpt("anti-threads",
+           cl::desc("Number of threads checking functions (0 for one per CPU)"),
+           cl::init(1));
 
 bool BenchmarkFlag;
 
@@ -35,18 +51,15 @@ namespace {
 
 static BenchmarkInit X;
 
-AntiFunctionPass::AntiFunctionPass(char &ID) : FunctionPass(ID), Buffer(NULL) {
+AntiFunctionPass::AntiFunctionPass(char &ID) : FunctionPass(ID), Host(this), Session(NULL), Worker(false) {
 	PassRegistry &Registry = *PassRegistry::getPassRegistry();
 	initializeDataLayoutPass(Registry);
 	initializeDominatorTreePass(Registry);
 	initializePostDominatorTreePass(Registry);
-	if (MinBugOnOpt)
-		Buffer = mmap(NULL, BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_SHARED, -1, 0);
 }
 
 AntiFunctionPass::~AntiFunctionPass() {
-	if (Buffer)
-		munmap(Buffer, BUFFER_SIZE);
+	resetSession();
 }
 
 void AntiFunctionPass::getAnalysisUsage(AnalysisUsage &AU) const {
@@ -67,20 +80,152 @@ static std::string demangle(Function &F) {
 }
 #endif
 
-static void calculateBackedges(Function &F, SmallVectorImpl<PathGen::Edge> &Backedges, SmallVectorImpl<BasicBlock *> &InLoopBlocks) {
+void BugOnIndex::calculate(Function &F) {
+	clear();
+	unsigned n = 0;
+	for (Function::iterator i = F.begin(), e = F.end(); i != e; ++i) {
+		Numbers[i] = n++;
+		Begin.push_back(BugOns.size());
+		for (BasicBlock::iterator j = i->begin(), je = i->end(); j != je; ++j) {
+			if (isa<BugOnInst>(j))
+				BugOns.push_back(WeakVH(j));
+		}
+	}
+	Begin.push_back(BugOns.size());
+	InLoop.resize(n);
+}
+
+void BugOnIndex::clear() {
+	Numbers.clear();
+	Begin.clear();
+	BugOns.clear();
+	InLoop.clear();
+}
+
+void BugOnIndex::swap(BugOnIndex &Other) {
+	Numbers.swap(Other.Numbers);
+	Begin.swap(Other.Begin);
+	BugOns.swap(Other.BugOns);
+	InLoop.swap(Other.InLoop);
+}
+
+static void calculateBackedges(Function &F, SmallVectorImpl<PathGen::Edge> &Backedges, BugOnIndex &Index) {
+	Index.InLoop.reset();
 	FindFunctionBackedges(F, Backedges);
 	if (Backedges.empty())
 		return;
-	// No need to calculate InLoopBlocks if post-dominators are ignored.
+	// No need to calculate loops if post-dominators are ignored.
 	if (IgnorePostOpt)
 		return;
 	for (scc_iterator<Function *> i = scc_begin(&F), e = scc_end(&F); i != e; ++i) {
-		if (i.hasLoop())
-			InLoopBlocks.append((*i).begin(), (*i).end());
+		if (!i.hasLoop())
+			continue;
+		for (BasicBlock *BB : *i)
+			Index.InLoop.set(Index.getNumber(BB));
+	}
+}
+
+static unsigned threads() {
+	if (ThreadsOpt)
+		return ThreadsOpt;
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Anti passes of the pipeline, in order, if checking in parallel.
+static SmallVector<AntiFunctionPass *, 4> Pipeline;
+
+// Check functions in parallel after the rest of the pipeline.  Each
+// worker runs its own instances of the anti passes, and so has its
+// own solvers; the IR is shared under a lock, which a worker gives
+// up while waiting for the solver.  Changes made by a pass are local
+// to the function it checks, and the output of each function is
+// printed in order, so the result is the same as running in turn.
+class AntiDriver {
+public:
+	AntiDriver(Module &M) : M(M), Next(0), Flushed(0), Changed(false) {}
+
+	bool run(unsigned n) {
+		for (Module::iterator i = M.begin(), e = M.end(); i != e; ++i) {
+			if (!i->isDeclaration() && isCheckedFunction(*i))
+				Funcs.push_back(i);
+		}
+		Outputs.resize(Funcs.size());
+		Done.resize(Funcs.size());
+		n = std::min<size_t>(n, Funcs.size());
+		std::vector<std::thread> Threads;
+		for (unsigned i = 0; i != n; ++i)
+			Threads.push_back(std::thread(&AntiDriver::work, this));
+		for (std::thread &T : Threads)
+			T.join();
+		return Changed;
+	}
+
+private:
+	Module &M;
+	std::mutex IRLock;
+	// The following are guarded by IRLock.
+	std::vector<Function *> Funcs;
+	std::vector<std::string> Outputs;
+	std::vector<bool> Done;
+	unsigned Next, Flushed;
+	bool Changed;
+
+	void work() {
+		SMTSharedLock L(IRLock);
+		FunctionPassManager FPM(&M);
+		FPM.add(new DataLayout(&M));
+		FPM.add(new TargetLibraryInfo(Triple(M.getTargetTriple())));
+		for (AntiFunctionPass *P : Pipeline) {
+			Pass *W = Pass::lookupPassInfo(P->getPassID())->createPass();
+			static_cast<AntiFunctionPass *>(W)->Worker = true;
+			FPM.add(W);
+		}
+		FPM.doInitialization();
+		// Take the next function once done with one, so that
+		// a large function does not hold up the others.
+		while (Next != Funcs.size()) {
+			unsigned i = Next++;
+			raw_string_ostream OS(Outputs[i]);
+			Diagnostic::redirect(&OS);
+			Changed |= FPM.run(*Funcs[i]);
+			Diagnostic::redirect(NULL);
+			OS.flush();
+			Done[i] = true;
+			flush();
+		}
+		FPM.doFinalization();
+	}
+
+	// Print the output of finished functions in order.
+	void flush() {
+		for (; Flushed != Funcs.size() && Done[Flushed]; ++Flushed) {
+			errs() << Outputs[Flushed];
+			std::string().swap(Outputs[Flushed]);
+		}
 	}
+};
+
+bool AntiFunctionPass::doInitialization(Module &) {
+	if (!Worker && threads() > 1)
+		Pipeline.push_back(this);
+	return false;
+}
+
+// The last anti pass runs all of them.
+bool AntiFunctionPass::doFinalization(Module &M) {
+	if (Worker || Pipeline.empty() || Pipeline.back() != this)
+		return false;
+	bool Changed = AntiDriver(M).run(threads());
+	Pipeline.clear();
+	return Changed;
 }
 
 bool AntiFunctionPass::runOnFunction(Function &F) {
+	// Left to the driver.
+	if (!Worker && !Pipeline.empty())
+		return false;
+	if (!isCheckedFunction(F))
+		return false;
 	BugOn = getBugOn(F.getParent());
 	if (!BugOn)
 		return false;
@@ -90,19 +235,76 @@ bool AntiFunctionPass::runOnFunction(Function &F) {
 	DT = &getAnalysis<DominatorTree>();
 	PDT = &getAnalysis<PostDominatorTree>();
 	DL = &getAnalysis<DataLayout>();
-	calculateBackedges(F, Backedges, InLoopBlocks);
+	Index.calculate(F);
+	calculateBackedges(F, Backedges, Index);
 	bool Changed = runOnAntiFunction(F);
+	resetSession();
 	Backedges.clear();
-	InLoopBlocks.clear();
+	Index.clear();
+	return Changed;
+}
+
+bool AntiFunctionPass::runChecksOf(AntiFunctionPass &P, Function &F) {
+	P.Host = this;
+	P.BugOn = BugOn;
+	P.DT = DT;
+	P.PDT = PDT;
+	P.DL = DL;
+	P.Session = Session;
+	Backedges.swap(P.Backedges);
+	Index.swap(P.Index);
+	bool Changed = P.runOnAntiFunction(F);
+	// Take them back, as P may have changed the CFG.
+	Session = P.Session;
+	P.Session = NULL;
+	Backedges.swap(P.Backedges);
+	Index.swap(P.Index);
 	return Changed;
 }
 
 void AntiFunctionPass::recalculate(Function &F) {
+	resetSession();
 	DT->DT->recalculate(F);
 	PDT->DT->recalculate(F);
 	Backedges.clear();
-	InLoopBlocks.clear();
-	calculateBackedges(F, Backedges, InLoopBlocks);
+	calculateBackedges(F, Backedges, Index);
+}
+
+AntiSession &AntiFunctionPass::getSession() {
+	if (!Session)
+		Session = new AntiSession(*DL, Backedges, *DT);
+	return *Session;
+}
+
+void AntiFunctionPass::resetSession() {
+	delete Session;
+	Session = NULL;
+}
+
+// Same as RecursivelyDeleteTriviallyDeadInstructions(), but also drop
+// the encodings of deleted instructions, as their addresses may be
+// reused by new ones.
+void AntiFunctionPass::deleteDeadInstructions(Value *V, const TargetLibraryInfo *TLI) {
+	Instruction *I = dyn_cast<Instruction>(V);
+	if (!I || !I->use_empty() || !isInstructionTriviallyDead(I, TLI))
+		return;
+	SmallVector<Instruction *, 16> DeadInsts;
+	DeadInsts.push_back(I);
+	do {
+		I = DeadInsts.pop_back_val();
+		for (unsigned i = 0, e = I->getNumOperands(); i != e; ++i) {
+			Value *OpV = I->getOperand(i);
+			I->setOperand(i, 0);
+			if (!OpV->use_empty())
+				continue;
+			if (Instruction *OpI = dyn_cast<Instruction>(OpV))
+				if (isInstructionTriviallyDead(OpI, TLI))
+					DeadInsts.push_back(OpI);
+		}
+		if (Session)
+			Session->VG.erase(I);
+		I->eraseFromParent();
+	} while (!DeadInsts.empty());
 }
 
 static SMTExpr computeDelta(ValueGen &VG, SmallVectorImpl<BugOnInst *> &Assertions) {
@@ -113,38 +315,46 @@ static SMTExpr computeDelta(ValueGen &VG, SmallVectorImpl<BugOnInst *> &Assertio
 		// ->queryWithAssertions() may mask some assertions.
 		if (!I)
 			continue;
-		Value *V = I->getCondition();
-		SMTExpr E = VG.get(V);
-		SMTExpr Tmp = SMT.bvor(U, E);
-		SMT.decref(U);
-		U = Tmp;
+		SMTExpr E = VG.getCondition(I);
+		U = SMT.bvor(U, E);
 	}
-	SMTExpr NotU = SMT.bvnot(U);
-	SMT.decref(U);
-	return NotU;
+	return SMT.bvnot(U);
 }
 
 SMTExpr AntiFunctionPass::getDeltaForBlock(BasicBlock *BB, ValueGen &VG) {
+	return getDeltaForBlock(BB, VG, Assertions);
+}
+
+// Mark the blocks that dominate BB in DT, BB included; false if BB is
+// not in the tree, in which case all blocks dominate it.
+template <typename TreeT>
+static bool markDominators(TreeT *DT, BasicBlock *BB, const BugOnIndex &Index, BitVector &Blocks) {
+	DomTreeNode *N = DT->getNode(BB);
+	if (!N)
+		return false;
+	for (; N; N = N->getIDom()) {
+		// The virtual exit of post-dominators has no block.
+		if (BasicBlock *Blk = N->getBlock())
+			Blocks.set(Index.getNumber(Blk));
+	}
+	return true;
+}
+
+SMTExpr AntiFunctionPass::getDeltaForBlock(BasicBlock *BB, ValueGen &VG, SmallVectorImpl<BugOnInst *> &Assertions) {
 	Assertions.clear();
 	// Ignore post-dominators if the option is set or BB is in a loop.
-	bool IgnorePostdom = IgnorePostOpt
-		|| (std::find(InLoopBlocks.begin(), InLoopBlocks.end(), BB) != InLoopBlocks.end());
-	Function *F = BB->getParent();
-	for (Function::iterator i = F->begin(), e = F->end(); i != e; ++i) {
-		BasicBlock *Blk = i;
-		// Collect blocks that (post)dominate BB: if BB is reachable,
-		// these blocks must also be reachable, and we need to check
-		// their bug assertions.
-		if (!DT->dominates(Blk, BB)) {
-			// Skip inspecting postdominators if BB is in a loop.
-			if (IgnorePostdom)
-				continue;
-			if (!PDT->dominates(Blk, BB))
-				continue;
-		}
-		for (BasicBlock::iterator i = Blk->begin(), e = Blk->end(); i != e; ++i) {
-			if (BugOnInst *BOI = dyn_cast<BugOnInst>(i))
-				Assertions.push_back(BOI);
+	bool IgnorePostdom = IgnorePostOpt || Index.InLoop.test(Index.getNumber(BB));
+	// Collect blocks that (post)dominate BB: if BB is reachable,
+	// these blocks must also be reachable, and we need to check
+	// their bug assertions.
+	BitVector Blocks(Index.size());
+	if (!markDominators(DT, BB, Index, Blocks)
+	    || (!IgnorePostdom && !markDominators(PDT, BB, Index, Blocks)))
+		Blocks.set();
+	for (int i = Blocks.find_first(); i != -1; i = Blocks.find_next(i)) {
+		for (Value *V : Index.getBugOns(i)) {
+			if (V)
+				Assertions.push_back(cast<BugOnInst>(V));
 		}
 	}
 	if (Assertions.empty())
@@ -152,56 +362,118 @@ SMTExpr AntiFunctionPass::getDeltaForBlock(BasicBlock *BB, ValueGen &VG) {
 	return computeDelta(VG, Assertions);
 }
 
-SMTStatus AntiFunctionPass::queryWithDelta(SMTExpr E, SMTExpr Delta, ValueGen &VG) {
+SMTExpr AntiFunctionPass::slice(SMTExpr E, SMTExpr *R, ValueGen &VG) {
+	return slice(E, R, VG, Assertions);
+}
+
+SMTExpr AntiFunctionPass::slice(SMTExpr E, SMTExpr *R, ValueGen &VG, SmallVectorImpl<BugOnInst *> &Assertions) {
+	if (Assertions.empty())
+		return NULL;
+	if (!SliceOpt)
+		return computeDelta(VG, Assertions);
 	SMTSolver &SMT = VG.SMT;
-	{
-		SMTExpr Q = SMT.bvand(E, Delta);
-		SMTStatus Status = SMT.query(Q);
-		SMT.decref(Q);
-		if (!Buffer || Status != SMT_UNSAT)
-			return Status;
+	SmallVector<SMTExpr, 16> Parts;
+	if (R)
+		SMT.conjuncts(*R, Parts);
+	unsigned NumGuards = Parts.size();
+	for (BugOnInst *I : Assertions)
+		Parts.push_back(VG.getCondition(I));
+	SMT.slice(E, Parts);
+	if (R) {
+		*R = SMT.bvtrue();
+		for (unsigned i = 0; i != NumGuards; ++i) {
+			if (Parts[i])
+				*R = SMT.bvand(*R, Parts[i]);
+		}
+	}
+	unsigned n = 0;
+	for (unsigned i = 0, e = Assertions.size(); i != e; ++i) {
+		if (Parts[NumGuards + i])
+			Assertions[n++] = Assertions[i];
 	}
+	Assertions.resize(n);
+	if (Assertions.empty())
+		return NULL;
+	return computeDelta(VG, Assertions);
+}
+
+// QuickXplain: add to Core a minimal subset of C that is unsat
+// together with B, given that B & C is unsat.  Added is set if
+// B has just been extended, which may have made it unsat alone.
+static void quickXplain(SMTSolver &SMT, SMTExpr B, bool Added, const SMTExpr *Lits,
+                        ArrayRef<unsigned> C, SmallVectorImpl<unsigned> &Core) {
+	// A timeout counts as sat, which keeps the constraints.
+	if (Added && SMT.query(B) == SMT_UNSAT)
+		return;
+	if (C.size() == 1) {
+		Core.push_back(C[0]);
+		return;
+	}
+	unsigned k = C.size() / 2;
+	ArrayRef<unsigned> C1 = C.slice(0, k), C2 = C.slice(k);
+	SMTExpr B1 = B;
+	for (unsigned i : C1)
+		B1 = SMT.bvand(B1, Lits[i]);
+	unsigned Start = Core.size();
+	quickXplain(SMT, B1, true, Lits, C2, Core);
+	SMTExpr B2 = B;
+	for (unsigned i = Start, e = Core.size(); i != e; ++i)
+		B2 = SMT.bvand(B2, Lits[Core[i]]);
+	quickXplain(SMT, B2, Core.size() != Start, Lits, C1, Core);
+}
+
+void AntiFunctionPass::minimizeDelta(SMTExpr E, ValueGen &VG) {
+	minimizeDelta(E, VG, Assertions);
+}
+
+void AntiFunctionPass::minimizeDelta(SMTExpr E, ValueGen &VG, SmallVectorImpl<BugOnInst *> &Assertions) {
 	unsigned n = Assertions.size();
-	// Compute the minimal bugon set.
-	for (BugOnInst *&I : Assertions) {
-		if (n <= 1)
-			break;
-		BugOnInst *Tmp = I;
-		// Mask out this bugon and see if still unsat.
-		I = NULL;
-		SMTExpr MinDelta = computeDelta(VG, Assertions);
-		SMTExpr Q = SMT.bvand(E, MinDelta);
-		SMT.decref(MinDelta);
-		SMTStatus Status = SMT.query(Q);
-		SMT.decref(Q);
-		// Keep this assertions.
-		if (Status != SMT_UNSAT)
-			I = Tmp;
-		else
-			--n;
-	}
-	// Output the unsat core.
-	BugOnInst **p = (BugOnInst **)Buffer;
-	for (BugOnInst *I : Assertions) {
-		if (!I)
-			continue;
-		*p++ = I;
+	if (!MinBugOnOpt || n <= 1)
+		return;
+	SMTSolver &SMT = VG.SMT;
+	// Each bugon gives a literal saying it does not fire.
+	SmallVector<SMTExpr, 8> Lits;
+	for (BugOnInst *I : Assertions)
+		Lits.push_back(SMT.bvnot(VG.getCondition(I)));
+	// Start from the solver's core, then shrink it.
+	SmallVector<bool, 8> InCore(n);
+	SMT.unsatCore(E, n, Lits.data(), InCore.data());
+	SmallVector<unsigned, 8> Initial, Core;
+	for (unsigned i = 0; i != n; ++i) {
+		if (InCore[i])
+			Initial.push_back(i);
+	}
+	if (Initial.empty())
+		return;
+	quickXplain(SMT, E, false, Lits.data(), Initial, Core);
+	// Mask out the rest.
+	SmallVector<bool, 8> Keep(n);
+	for (unsigned i : Core)
+		Keep[i] = true;
+	for (unsigned i = 0; i != n; ++i) {
+		if (!Keep[i])
+			Assertions[i] = NULL;
 	}
-	*p = NULL;
-	return SMT_UNSAT;
 }
 
 void AntiFunctionPass::printMinimalAssertions() {
-	if (!Buffer)
+	printMinimalAssertions(Assertions);
+}
+
+void AntiFunctionPass::printMinimalAssertions(ArrayRef<BugOnInst *> Assertions) {
+	if (!MinBugOnOpt)
 		return;
 	int Count = 0;
-	for (BugOnInst **p = (BugOnInst **)Buffer; *p; ++p)
-		Count++;
+	for (BugOnInst *I : Assertions) {
+		if (I)
+			Count++;
+	}
 	Diag << "ncore: " << Count << "\n";
 	Diag << "core: \n";
 	LLVMContext &C = BugOn->getContext();
-	for (BugOnInst **p = (BugOnInst **)Buffer; *p; ++p) {
-		BugOnInst *I = *p;
+	for (BugOnInst *I : Assertions) {
+		if (!I)
+			continue;
 		MDNode *MD = I->getDebugLoc().getAsMDNode(C);
 		Diag.location(MD);
 		Diag << "    - " << I->getAnnotation() << "\n";
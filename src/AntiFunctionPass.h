@@ -5,15 +5,65 @@
 #include "PathGen.h"
 #include "ValueGen.h"
 #include <llvm/Pass.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ADT/DenseMap.h>
 #include <llvm/ADT/SmallVector.h>
 #include <llvm/Analysis/Dominators.h>
 #include <llvm/IR/DataLayout.h>
+#include <llvm/Support/ValueHandle.h>
+#include <vector>
 
 #define BENCHMARK(e) if (BenchmarkFlag) { e; }
 
 extern bool BenchmarkFlag;
 
-class SMTSolver;
+namespace llvm {
+	class TargetLibraryInfo;
+} // namespace llvm
+
+// Solver state shared by all queries on a function, so that values
+// and path conditions are encoded once; each query only assumes its
+// own condition.
+struct AntiSession {
+	SMTSolver SMT;
+	ValueGen VG;
+	// A copy, as the session may outlive the pass that made it.
+	llvm::SmallVector<PathGen::Edge, 32> Backedges;
+	PathGen PG;
+
+	AntiSession(llvm::DataLayout &DL, const PathGen::EdgeVec &BE, llvm::DominatorTree &DT)
+		: SMT(false), VG(DL, SMT), Backedges(BE.begin(), BE.end()), PG(VG, Backedges, DT) {}
+};
+
+// The bugons of a function by block, in order, and the blocks in loops,
+// so that getDeltaForBlock() visits the (post)dominators of a block only.
+// Blocks are numbered in function order; the anti passes do not add or
+// move blocks, and an erased bugon reads as NULL, so only the loops need
+// updating when the CFG changes.
+class BugOnIndex {
+public:
+	void calculate(llvm::Function &F);
+	void clear();
+	void swap(BugOnIndex &);
+
+	unsigned size() const { return Numbers.size(); }
+	unsigned getNumber(llvm::BasicBlock *BB) const {
+		assert(Numbers.count(BB) && "Block added after indexing");
+		return Numbers.lookup(BB);
+	}
+	llvm::ArrayRef<llvm::WeakVH> getBugOns(unsigned i) const {
+		return llvm::makeArrayRef(BugOns).slice(Begin[i], Begin[i + 1] - Begin[i]);
+	}
+
+	// Blocks in loops, by number.
+	llvm::BitVector InLoop;
+
+private:
+	llvm::DenseMap<llvm::BasicBlock *, unsigned> Numbers;
+	std::vector<unsigned> Begin;
+	std::vector<llvm::WeakVH> BugOns;
+};
 
 class AntiFunctionPass : public llvm::FunctionPass {
 protected:
@@ -21,25 +71,57 @@ protected:
 	llvm::DominatorTree *DT;
 	llvm::SmallVector<PathGen::Edge, 32> Backedges;
 	Diagnostic Diag;
+	// The pass whose analyses to use: this one, or the one that
+	// runs its checks with runChecksOf().
+	llvm::Pass *Host;
 
 	explicit AntiFunctionPass(char &ID);
 	~AntiFunctionPass();
 	virtual bool runOnAntiFunction(llvm::Function &F) = 0;
 	virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const;
+	virtual bool doInitialization(llvm::Module &);
+	virtual bool doFinalization(llvm::Module &);
 
+	// Run the checks of P on the current function, with the
+	// analyses and the solver session of this pass.
+	bool runChecksOf(AntiFunctionPass &P, llvm::Function &F);
 	// Call if CFG has changed.
 	void recalculate(llvm::Function &F);
+	// Return the solver session of the current function.
+	AntiSession &getSession();
+	// Call if IR has changed or a query has timed out.
+	void resetSession();
+	// Delete trivially dead instructions without resetting the session.
+	void deleteDeadInstructions(llvm::Value *, const llvm::TargetLibraryInfo *TLI = NULL);
 	// Return bug-free assertion.
 	SMTExpr getDeltaForBlock(llvm::BasicBlock *, ValueGen &);
-	SMTStatus queryWithDelta(SMTExpr E, SMTExpr Delta, ValueGen &);
+	// Same, but collect the bugons elsewhere, so that other
+	// threads may call it.
+	SMTExpr getDeltaForBlock(llvm::BasicBlock *, ValueGen &, llvm::SmallVectorImpl<BugOnInst *> &);
+	// Cone of influence of E: drop the conjuncts of *R, if given,
+	// and the bugons of the last block that share no variables with
+	// E, directly or through the others kept, and return the bug-free
+	// assertion of the bugons left, or NULL if none is.  For the
+	// queries meant to be unsat only.
+	SMTExpr slice(SMTExpr E, SMTExpr *R, ValueGen &);
+	SMTExpr slice(SMTExpr E, SMTExpr *R, ValueGen &, llvm::SmallVectorImpl<BugOnInst *> &);
+	// Shrink the bugons of the last block to a minimal set
+	// that keeps E unsat; E & Delta must be unsat.
+	void minimizeDelta(SMTExpr E, ValueGen &);
+	void minimizeDelta(SMTExpr E, ValueGen &, llvm::SmallVectorImpl<BugOnInst *> &);
 	void printMinimalAssertions();
+	void printMinimalAssertions(llvm::ArrayRef<BugOnInst *>);
 
 private:
 	llvm::Function *BugOn;
 	llvm::PostDominatorTree *PDT;
-	llvm::SmallVector<llvm::BasicBlock *, 8> InLoopBlocks;
+	BugOnIndex Index;
+	// Masked entries are NULL after minimizeDelta().
 	llvm::SmallVector<BugOnInst *, 8> Assertions;
-	void *Buffer;
+	AntiSession *Session;
+	// Set on the instances that check functions in parallel.
+	bool Worker;
 
+	friend class AntiDriver;
 	virtual bool runOnFunction(llvm::Function &);
 };
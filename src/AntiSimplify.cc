@@ -4,13 +4,32 @@
 
 #define DEBUG_TYPE "anti-simplify"
 #include "AntiFunctionPass.h"
+#include <llvm/ADT/SmallPtrSet.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/ConstantRange.h>
 #include <llvm/Support/InstIterator.h>
+#include <llvm/Support/ValueHandle.h>
 #include <llvm/Transforms/Utils/Local.h>
+#include <condition_variable>
+#include <memory>
+#include <thread>
+#include <vector>
 
 using namespace llvm;
 
+static cl::opt<unsigned>
+ThreadsOpt("anti-simplify-threads",
+           cl::desc("Number of threads solving the queries of a function ahead"),
+           cl::init(1));
+
+static cl::opt<bool>
+PrefilterOpt("anti-simplify-prefilter",
+             cl::desc("Skip comparisons decided by ranges or known bits"),
+             cl::init(true));
+
 namespace {
 
 struct AntiSimplify: AntiFunctionPass {
@@ -25,7 +44,12 @@ struct AntiSimplify: AntiFunctionPass {
 	virtual bool runOnAntiFunction(Function &);
 
 private:
+	struct Speculation;
+
+	bool runInParallel(Function &);
 	int foldConst(Instruction *);
+	int checkConst(Instruction *, AntiSession &, SmallVectorImpl<BugOnInst *> &, SMTExpr &);
+	void fold(Instruction *, int ConstVal, ArrayRef<BugOnInst *> *Core = NULL);
 };
 
 } // anonymous namespace
@@ -44,71 +68,485 @@ const char *qstr(int ConstVal) {
 	}
 }
 
+static bool isCandidate(Instruction *I) {
+	if (!Diagnostic::hasSingleDebugLocation(I))
+		return false;
+	// For now we are only interested in bool expressions.
+	return isa<ICmpInst>(I);
+}
+
+// Cheap checks before the solver: a comparison that is constant even
+// without bugons cannot be folded because of them.  Values are bounded
+// by intervals or by known bits, following the encoding of ValueGen:
+// arithmetic wraps, and a value it does not model may be anything in
+// its range metadata.
+
+// Beyond this depth a value is taken to be unknown.
+static const unsigned MaxDepth = 6;
+
+static ConstantRange getMetadataRange(Instruction *I, unsigned Width) {
+	ConstantRange Range(Width, true);
+	MDNode *MD = I->getMetadata("intrange");
+	if (!MD)
+		return Range;
+	// ValueGen assumes all the pairs.
+	for (unsigned i = 0, n = MD->getNumOperands(); i + 1 < n; i += 2) {
+		const APInt &Lo = cast<ConstantInt>(MD->getOperand(i))->getValue();
+		const APInt &Hi = cast<ConstantInt>(MD->getOperand(i + 1))->getValue();
+		if (Lo != Hi)
+			Range = Range.intersectWith(ConstantRange(Lo, Hi));
+	}
+	return Range;
+}
+
+static ConstantRange getRange(Value *V, unsigned Depth) {
+	unsigned Width = cast<IntegerType>(V->getType())->getBitWidth();
+	if (ConstantInt *CI = dyn_cast<ConstantInt>(V))
+		return ConstantRange(CI->getValue());
+	Instruction *I = dyn_cast<Instruction>(V);
+	if (!I || Depth == MaxDepth)
+		return ConstantRange(Width, true);
+	++Depth;
+	switch (I->getOpcode()) {
+	default:
+		return getMetadataRange(I, Width);
+	case Instruction::Trunc:
+		return getRange(I->getOperand(0), Depth).truncate(Width);
+	case Instruction::ZExt:
+		return getRange(I->getOperand(0), Depth).zeroExtend(Width);
+	case Instruction::SExt:
+		return getRange(I->getOperand(0), Depth).signExtend(Width);
+	case Instruction::Select:
+		return getRange(I->getOperand(1), Depth).unionWith(getRange(I->getOperand(2), Depth));
+	case Instruction::Add: case Instruction::Sub: case Instruction::Mul:
+	case Instruction::And: case Instruction::Or:
+		break;
+	}
+	ConstantRange L = getRange(I->getOperand(0), Depth);
+	ConstantRange R = getRange(I->getOperand(1), Depth);
+	switch (I->getOpcode()) {
+	default: llvm_unreachable("Unknown opcode!");
+	case Instruction::Add: return L.add(R);
+	case Instruction::Sub: return L.sub(R);
+	case Instruction::Mul: return L.multiply(R);
+	case Instruction::And: return L.binaryAnd(R);
+	case Instruction::Or:  return L.binaryOr(R);
+	}
+}
+
+static void getKnownBits(Value *V, APInt &Zero, APInt &One, unsigned Depth) {
+	unsigned Width = cast<IntegerType>(V->getType())->getBitWidth();
+	Zero = One = APInt(Width, 0);
+	if (ConstantInt *CI = dyn_cast<ConstantInt>(V)) {
+		One = CI->getValue();
+		Zero = ~One;
+		return;
+	}
+	Instruction *I = dyn_cast<Instruction>(V);
+	if (!I || Depth == MaxDepth)
+		return;
+	++Depth;
+	APInt LZ, LO, RZ, RO;
+	switch (I->getOpcode()) {
+	default: {
+		// The leading bits shared by all values in range.
+		ConstantRange Range = getMetadataRange(I, Width);
+		if (Range.isFullSet() || Range.isEmptySet())
+			return;
+		APInt Min = Range.getUnsignedMin();
+		APInt Mask = APInt::getHighBitsSet(Width, (Min ^ Range.getUnsignedMax()).countLeadingZeros());
+		One = Min & Mask;
+		Zero = ~Min & Mask;
+		return;
+	}
+	case Instruction::Trunc:
+		getKnownBits(I->getOperand(0), LZ, LO, Depth);
+		Zero = LZ.trunc(Width);
+		One = LO.trunc(Width);
+		return;
+	case Instruction::ZExt:
+		getKnownBits(I->getOperand(0), LZ, LO, Depth);
+		Zero = LZ.zext(Width) | APInt::getHighBitsSet(Width, Width - LZ.getBitWidth());
+		One = LO.zext(Width);
+		return;
+	case Instruction::SExt:
+		// Known sign bits extend as they are.
+		getKnownBits(I->getOperand(0), LZ, LO, Depth);
+		Zero = LZ.sext(Width);
+		One = LO.sext(Width);
+		return;
+	case Instruction::Select:
+		getKnownBits(I->getOperand(1), LZ, LO, Depth);
+		getKnownBits(I->getOperand(2), RZ, RO, Depth);
+		Zero = LZ & RZ;
+		One = LO & RO;
+		return;
+	case Instruction::Shl: case Instruction::LShr: case Instruction::AShr: {
+		ConstantInt *CI = dyn_cast<ConstantInt>(I->getOperand(1));
+		if (!CI || CI->getValue().uge(Width))
+			return;
+		unsigned Shift = CI->getZExtValue();
+		getKnownBits(I->getOperand(0), LZ, LO, Depth);
+		if (I->getOpcode() == Instruction::Shl) {
+			Zero = LZ.shl(Shift) | APInt::getLowBitsSet(Width, Shift);
+			One = LO.shl(Shift);
+		} else if (I->getOpcode() == Instruction::LShr) {
+			Zero = LZ.lshr(Shift) | APInt::getHighBitsSet(Width, Shift);
+			One = LO.lshr(Shift);
+		} else {
+			Zero = LZ.ashr(Shift);
+			One = LO.ashr(Shift);
+		}
+		return;
+	}
+	case Instruction::And: case Instruction::Or: case Instruction::Xor:
+		break;
+	}
+	getKnownBits(I->getOperand(0), LZ, LO, Depth);
+	getKnownBits(I->getOperand(1), RZ, RO, Depth);
+	switch (I->getOpcode()) {
+	default: llvm_unreachable("Unknown opcode!");
+	case Instruction::And:
+		Zero = LZ | RZ;
+		One = LO & RO;
+		return;
+	case Instruction::Or:
+		Zero = LZ & RZ;
+		One = LO | RO;
+		return;
+	case Instruction::Xor:
+		Zero = (LZ & RZ) | (LO & RO);
+		One = (LZ & RO) | (LO & RZ);
+		return;
+	}
+}
+
+namespace {
+
+// The extremes of the values of one side of a comparison.
+struct Bounds {
+	APInt UMin, UMax, SMin, SMax;
+
+	explicit Bounds(const ConstantRange &R)
+		: UMin(R.getUnsignedMin()), UMax(R.getUnsignedMax()),
+		  SMin(R.getSignedMin()), SMax(R.getSignedMax()) {}
+
+	Bounds(const APInt &Zero, const APInt &One)
+		: UMin(One), UMax(~Zero), SMin(One), SMax(~Zero) {
+		unsigned SignBit = One.getBitWidth() - 1;
+		if (!Zero[SignBit])
+			SMin.setBit(SignBit);
+		if (!One[SignBit])
+			SMax.clearBit(SignBit);
+	}
+};
+
+} // anonymous namespace
+
+static int decide(bool True, bool False) {
+	return True ? 1 : (False ? 0 : -1);
+}
+
+// Return the value of a comparison for all L and R within the bounds,
+// or -1.  Disjoint is set if L and R are known to differ.
+static int decide(CmpInst::Predicate Pred, const Bounds &L, const Bounds &R, bool Disjoint) {
+	switch (Pred) {
+	default:
+		return -1;
+	case CmpInst::ICMP_EQ:
+	case CmpInst::ICMP_NE: {
+		bool Ne = Disjoint || L.UMax.ult(R.UMin) || R.UMax.ult(L.UMin);
+		bool Eq = L.UMin == L.UMax && R.UMin == R.UMax && L.UMin == R.UMin;
+		if (Pred == CmpInst::ICMP_EQ)
+			return decide(Eq, Ne);
+		return decide(Ne, Eq);
+	}
+	case CmpInst::ICMP_ULT: return decide(L.UMax.ult(R.UMin), L.UMin.uge(R.UMax));
+	case CmpInst::ICMP_ULE: return decide(L.UMax.ule(R.UMin), L.UMin.ugt(R.UMax));
+	case CmpInst::ICMP_UGT: return decide(L.UMin.ugt(R.UMax), L.UMax.ule(R.UMin));
+	case CmpInst::ICMP_UGE: return decide(L.UMin.uge(R.UMax), L.UMax.ult(R.UMin));
+	case CmpInst::ICMP_SLT: return decide(L.SMax.slt(R.SMin), L.SMin.sge(R.SMax));
+	case CmpInst::ICMP_SLE: return decide(L.SMax.sle(R.SMin), L.SMin.sgt(R.SMax));
+	case CmpInst::ICMP_SGT: return decide(L.SMin.sgt(R.SMax), L.SMax.sle(R.SMin));
+	case CmpInst::ICMP_SGE: return decide(L.SMin.sge(R.SMax), L.SMax.slt(R.SMin));
+	}
+}
+
+// Return the name of the domain that shows I constant without bugons,
+// or NULL if neither does and the solver is needed.
+static const char *decidedBy(ICmpInst *I) {
+	if (!PrefilterOpt)
+		return NULL;
+	Value *L = I->getOperand(0), *R = I->getOperand(1);
+	if (!L->getType()->isIntegerTy())
+		return NULL;
+	CmpInst::Predicate Pred = I->getPredicate();
+	ConstantRange LRange = getRange(L, 0), RRange = getRange(R, 0);
+	if (!LRange.isEmptySet() && !RRange.isEmptySet()) {
+		bool Disjoint = LRange.intersectWith(RRange).isEmptySet();
+		if (decide(Pred, Bounds(LRange), Bounds(RRange), Disjoint) >= 0)
+			return "range";
+	}
+	APInt LZero, LOne, RZero, ROne;
+	getKnownBits(L, LZero, LOne, 0);
+	getKnownBits(R, RZero, ROne, 0);
+	bool Disjoint = !!((LOne & RZero) | (LZero & ROne));
+	if (decide(Pred, Bounds(LZero, LOne), Bounds(RZero, ROne), Disjoint) >= 0)
+		return "bits";
+	return NULL;
+}
+
 bool AntiSimplify::runOnAntiFunction(Function &F) {
+	if (ThreadsOpt > 1)
+		return runInParallel(F);
 	bool Changed = false;
 	for (inst_iterator i = inst_begin(F), e = inst_end(F); i != e; ) {
 		Instruction *I = &*i++;
-		if (!Diagnostic::hasSingleDebugLocation(I))
+		if (!isCandidate(I))
 			continue;
-		// For now we are only interested in bool expressions.
-		if (!isa<ICmpInst>(I))
+		if (const char *Domain = decidedBy(cast<ICmpInst>(I))) {
+			BENCHMARK(Diagnostic() << "query: " << Domain << "\n");
+			continue;
+		}
+		int ConstVal;
+		{
+			SMTTimer Timer;
+			ConstVal = foldConst(I);
+			if (Timer.expired()) {
+				ConstVal = SMT_TIMEOUT;
+				resetSession();
+			}
+		}
+		BENCHMARK(Diagnostic() << "query: " << qstr(ConstVal) << "\n");
+		if (ConstVal != 0 && ConstVal != 1)
 			continue;
+		fold(I, ConstVal);
+		Changed = true;
+	}
+	return Changed;
+}
+
+// Queries of a function solved ahead by worker threads, each in a
+// session of its own, while this thread goes through the results in
+// order.  A fold changes the queries that read the folded value, so
+// a result is redone here if a fold since has touched any of the
+// values its query read; a worker likewise starts a new session only
+// once a fold has touched what its session encoded.  The IR is shared
+// under a lock, which a thread gives up while waiting for the solver.
+struct AntiSimplify::Speculation {
+	struct Result {
+		WeakVH I;
 		int ConstVal;
-		if (SMTFork() == 0)
+		// Number of folds when the query was built.
+		unsigned Epoch;
+		SmallPtrSet<Value *, 32> Read;
+		// Minimal bugons of a fold, masked as by minimizeDelta().
+		SmallVector<BugOnInst *, 8> Assertions;
+		bool Done;
+	};
+
+	AntiSimplify &P;
+	std::mutex *Lock;
+	std::condition_variable Cond;
+	// The following are guarded by Lock.
+	std::vector<std::unique_ptr<Result>> Results;
+	std::vector<Instruction *> Folds;
+	unsigned Next;
+
+	Speculation(AntiSimplify &P, std::mutex *Lock) : P(P), Lock(Lock), Next(0) {}
+
+	void work() {
+		SMTSharedLock L(*Lock);
+		std::unique_ptr<AntiSession> S;
+		// What the session has encoded, and as of which fold.
+		Result Encoded;
+		while (Next != Results.size()) {
+			Result &R = *Results[Next++];
+			if (Instruction *I = dyn_cast_or_null<Instruction>(R.I)) {
+				if (S && isStale(Encoded))
+					S.reset();
+				if (!S) {
+					S.reset(new AntiSession(*P.DL, P.Backedges, *P.DT));
+					Encoded.Read.clear();
+				}
+				R.Epoch = Encoded.Epoch = Folds.size();
+				SMTExpr Q;
+				SMTTimer Timer;
+				R.ConstVal = P.checkConst(I, *S, R.Assertions, Q);
+				if (R.ConstVal == 0 || R.ConstVal == 1)
+					P.minimizeDelta(Q, S->VG, R.Assertions);
+				// The query has read no more than the session has
+				// encoded.
+				for (ValueGen::iterator i = S->VG.begin(), e = S->VG.end(); i != e; ++i)
+					Encoded.Read.insert(i->first);
+				R.Read = Encoded.Read;
+				if (Timer.expired()) {
+					R.ConstVal = SMT_TIMEOUT;
+					S.reset();
+				}
+			}
+			R.Done = true;
+			Cond.notify_all();
+		}
+	}
+
+	bool isStale(const Result &R) {
+		for (unsigned i = R.Epoch, e = Folds.size(); i != e; ++i) {
+			if (R.Read.count(Folds[i]))
+				return true;
+		}
+		return false;
+	}
+
+	// Called with Lock held.
+	void wait(const Result &R) {
+		std::unique_lock<std::mutex> L(*Lock, std::adopt_lock);
+		while (!R.Done)
+			Cond.wait(L);
+		L.release();
+	}
+};
+
+bool AntiSimplify::runInParallel(Function &F) {
+	// Share the lock on the IR, if already checking functions in
+	// parallel.
+	std::mutex Local;
+	std::mutex *Lock = SMTSharedLock::held();
+	std::unique_ptr<SMTSharedLock> Held;
+	if (!Lock) {
+		Lock = &Local;
+		Held.reset(new SMTSharedLock(Local));
+	}
+	Speculation Spec(*this, Lock);
+	for (inst_iterator i = inst_begin(F), e = inst_end(F); i != e; ++i) {
+		Instruction *I = &*i;
+		if (!isCandidate(I))
+			continue;
+		if (const char *Domain = decidedBy(cast<ICmpInst>(I))) {
+			BENCHMARK(Diagnostic() << "query: " << Domain << "\n");
+			continue;
+		}
+		Speculation::Result *R = new Speculation::Result;
+		R->I = I;
+		R->ConstVal = FOLD_FAIL;
+		R->Epoch = 0;
+		R->Done = false;
+		Spec.Results.push_back(std::unique_ptr<Speculation::Result>(R));
+	}
+	std::vector<std::thread> Threads;
+	unsigned n = std::min<size_t>(ThreadsOpt, Spec.Results.size());
+	for (unsigned i = 0; i != n; ++i)
+		Threads.push_back(std::thread(&Speculation::work, &Spec));
+	bool Changed = false;
+	for (std::unique_ptr<Speculation::Result> &R : Spec.Results) {
+		Spec.wait(*R);
+		// An earlier fold may have deleted it.
+		Instruction *I = dyn_cast_or_null<ICmpInst>(R->I);
+		if (!I)
+			continue;
+		int ConstVal = R->ConstVal;
+		ArrayRef<BugOnInst *> Core(R->Assertions);
+		ArrayRef<BugOnInst *> *Minimal = &Core;
+		// Redo a stale query here.
+		if (Spec.isStale(*R)) {
+			SMTTimer Timer;
 			ConstVal = foldConst(I);
-		SMTJoin(&ConstVal);
+			if (Timer.expired()) {
+				ConstVal = SMT_TIMEOUT;
+				resetSession();
+			}
+			Minimal = NULL;
+		}
 		BENCHMARK(Diagnostic() << "query: " << qstr(ConstVal) << "\n");
 		if (ConstVal != 0 && ConstVal != 1)
 			continue;
-		Diag.bug(DEBUG_TYPE);
-		Diag << "model: |\n" << *I << "\n  -->  "
-		     << (ConstVal ? "true" : "false") << "\n";
-		Diag.backtrace(I);
-		printMinimalAssertions();
-		Type *T = I->getType();
-		Constant *C = ConstantInt::get(T, ConstVal);
-		I->replaceAllUsesWith(C);
-		RecursivelyDeleteTriviallyDeadInstructions(I);
+		Spec.Folds.push_back(I);
+		fold(I, ConstVal, Minimal);
 		Changed = true;
 	}
+	// Let go of the lock for the workers to finish.
+	{
+		std::unique_lock<std::mutex> L(*Lock, std::adopt_lock);
+		L.unlock();
+		for (std::thread &T : Threads)
+			T.join();
+		L.lock();
+		L.release();
+	}
 	return Changed;
 }
 
+// Print the minimal bugons in Core if given, else those of the
+// last foldConst().
+void AntiSimplify::fold(Instruction *I, int ConstVal, ArrayRef<BugOnInst *> *Core) {
+	Diag.bug(DEBUG_TYPE);
+	Diag << "model: |\n" << *I << "\n  -->  "
+	     << (ConstVal ? "true" : "false") << "\n";
+	Diag.backtrace(I);
+	if (Core)
+		printMinimalAssertions(*Core);
+	else
+		printMinimalAssertions();
+	Type *T = I->getType();
+	Constant *C = ConstantInt::get(T, ConstVal);
+	I->replaceAllUsesWith(C);
+	RecursivelyDeleteTriviallyDeadInstructions(I);
+	resetSession();
+}
+
 int AntiSimplify::foldConst(Instruction *I) {
+	AntiSession &S = getSession();
+	SMTExpr Q;
+	int Result = checkConst(I, S, Assertions, Q);
+	if (Result == 0 || Result == 1)
+		minimizeDelta(Q, S.VG);
+	return Result;
+}
+
+// Return 0 or 1 if I must be that with the bugons of its block but
+// not without them, and set Q to the sliced query without them.
+int AntiSimplify::checkConst(Instruction *I, AntiSession &S, SmallVectorImpl<BugOnInst *> &Assertions, SMTExpr &Q) {
 	int Result = FOLD_FAIL;
-	SMTSolver SMT(false);
-	ValueGen VG(*DL, SMT);
+	SMTSolver &SMT = S.SMT;
+	ValueGen &VG = S.VG;
 	BasicBlock *BB = I->getParent();
-	SMTExpr Delta = getDeltaForBlock(BB, VG);
+	SMTExpr Delta = getDeltaForBlock(BB, VG, Assertions);
 	if (!Delta)
 		return Result;
-	// Compute path condition.
-	PathGen PG(VG, Backedges, *DT);
-	{
-		SMTExpr R = PG.get(BB);
-		SMT.assume(R);
-	}
+	// Compute path condition, which is part of every query
+	// rather than asserted into the shared solver.
+	SMTExpr R = S.PG.get(BB);
 	SMTExpr E = VG.get(I);
-	int Status = queryWithDelta(E, Delta, VG);
-	if (Status == SMT_UNSAT) {
+	SMTExpr NE = SMT.bvnot(E);
+	SMTExpr RE = SMT.bvand(R, E);
+	SMTExpr RNE = SMT.bvand(R, NE);
+	// The queries with Delta need only what is related to I.
+	SMTExpr SR = R;
+	Delta = slice(E, &SR, VG, Assertions);
+	if (!Delta)
+		return Result;
+	SMTExpr SRE = SMT.bvand(SR, E);
+	SMTExpr SRNE = SMT.bvand(SR, NE);
+	// I can usually be both true and false with Delta, so
+	// both directions are needed; ask them at once.
+	SMTExpr Qs[2] = {SMT.bvand(SRE, Delta), SMT.bvand(SRNE, Delta)};
+	SMTStatus Status[2];
+	SMT.query(2, Qs, Status);
+	if (Status[0] == SMT_UNSAT) {
 		// I must be false with Delta.
 		// Can I be true without Delta?
-		if (SMT.query(E) == SMT_SAT)
+		if (SMT.query(RE) == SMT_SAT) {
+			Q = SRE;
 			Result = 0;
-	} else {
-		// I can be false with Delta.
-		// Let's try if it can be true.
-		SMTExpr NE = SMT.bvnot(E);
-		Status = queryWithDelta(NE, Delta, VG);
-		if (Status == SMT_UNSAT) {
-			// I must be true with Delta.
-			// Can I be false with Delta?
-			if (SMT.query(NE) == SMT_SAT)
-				Result = 1;
 		}
-		SMT.decref(NE);
+	} else if (Status[1] == SMT_UNSAT) {
+		// I must be true with Delta.
+		// Can I be false without Delta?
+		if (SMT.query(RNE) == SMT_SAT) {
+			Q = SRNE;
+			Result = 1;
+		}
 	}
-	SMT.decref(Delta);
 	return Result;
 }
 
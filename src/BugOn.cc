@@ -1,11 +1,17 @@
 #include "BugOn.h"
 #include "Diagnostic.h"
 #include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/ADT/StringSwitch.h>
 #include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/DataLayout.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Support/CommandLine.h>
 #include <llvm/Support/DebugLoc.h>
+#include <llvm/Support/ErrorHandling.h>
 #include <llvm/Support/InstIterator.h>
+#include <fstream>
+#include <mutex>
 
 using namespace llvm;
 
@@ -15,6 +21,33 @@ static cl::opt<bool>
 ShowTrueOpt("show-bugon-true",
             cl::desc("Show always true bug conditions"));
 
+static cl::opt<bool>
+LazyOpt("bugon-lazy",
+        cl::desc("Leave bug conditions to ValueGen instead of computing them in IR"));
+
+static cl::opt<std::string>
+CheckFunctionsOpt("check-functions",
+                  cl::desc("Check only the functions named in a file, one per line"),
+                  cl::value_desc("file"));
+
+static StringSet<> CheckedFunctions;
+
+bool isCheckedFunction(const Function &F) {
+	if (CheckFunctionsOpt.empty())
+		return true;
+	// Anti passes may ask from several threads.
+	static std::once_flag Loaded;
+	std::call_once(Loaded, [] {
+		std::ifstream In(CheckFunctionsOpt.c_str());
+		if (!In)
+			report_fatal_error("cannot open " + CheckFunctionsOpt);
+		std::string Name;
+		while (std::getline(In, Name))
+			CheckedFunctions.insert(Name);
+	});
+	return CheckedFunctions.count(F.getName());
+}
+
 Function *getBugOn(const Module *M) {
 	return M->getFunction(OPT_BUGON);
 }
@@ -23,7 +56,8 @@ Function *getOrInsertBugOn(Module *M) {
 	LLVMContext &C = M->getContext();
 	Type *VoidTy = Type::getVoidTy(C);
 	Type *BoolTy = Type::getInt1Ty(C);
-	FunctionType *T = FunctionType::get(VoidTy, BoolTy, false);
+	// Lazy bugons pass operands after the condition.
+	FunctionType *T = FunctionType::get(VoidTy, BoolTy, true);
 	Function *F = cast<Function>(M->getOrInsertFunction(OPT_BUGON, T));
 	F->setDoesNotThrow();
 	return F;
@@ -34,6 +68,11 @@ StringRef BugOnInst::getAnnotation() const {
 	return cast<MDString>(MD->getOperand(0))->getString();
 }
 
+StringRef BugOnInst::getKind() const {
+	MDNode *MD = getMetadata("bugcond");
+	return cast<MDString>(MD->getOperand(0))->getString();
+}
+
 void BugOnPass::getAnalysisUsage(AnalysisUsage &AU) const {
 	AU.setPreservesCFG();
 }
@@ -108,7 +147,7 @@ bool BugOnPass::insert(Value *V, StringRef Bug, const DebugLoc &DbgLoc) {
 			return false;
 		if (ShowTrueOpt) {
 			Instruction *I = Builder->GetInsertPoint();
-			if (Diagnostic::hasSingleDebugLocation(I)) {
+			if (Diagnostic::hasSingleDebugLocation(I) && isCheckedFunction(*I->getParent()->getParent())) {
 				Diagnostic Diag;
 				Diag.bug(Pass::lookupPassInfo(getPassID())->getPassArgument());
 				Diag << "model: |\n" << *I << "\n";
@@ -116,15 +155,94 @@ bool BugOnPass::insert(Value *V, StringRef Bug, const DebugLoc &DbgLoc) {
 			}
 		}
 	}
-	LLVMContext &C = V->getContext();
+	create(V, Bug, DbgLoc);
+	return true;
+}
+
+CallInst *BugOnPass::create(ArrayRef<Value *> Args, StringRef Bug, const DebugLoc &DbgLoc) {
+	LLVMContext &C = Args[0]->getContext();
 	if (!BugOn) {
 		BugOn = getOrInsertBugOn(getModule());
 		MD_bug = C.getMDKindID("bug");
+		MD_bugcond = C.getMDKindID("bugcond");
 	}
-	Instruction *I = Builder->CreateCall(BugOn, V);
+	CallInst *I = Builder->CreateCall(BugOn, Args);
 	I->setDebugLoc(DbgLoc);
 	if (!Bug.empty())
 		I->setMetadata(MD_bug, MDNode::get(C, MDString::get(C, Bug)));
+	return I;
+}
+
+bool BugOnPass::isLazy() {
+	return LazyOpt;
+}
+
+// The condition of a lazy bugon of Kind over L and R if constant,
+// as ValueGen would encode it, or NULL.
+static Constant *foldBugCondition(StringRef Kind, Value *L, Value *R) {
+	LLVMContext &C = L->getContext();
+	if (Kind == "sdiv") {
+		// Overflows only for SMIN / -1.
+		ConstantInt *LC = dyn_cast<ConstantInt>(L);
+		ConstantInt *RC = dyn_cast<ConstantInt>(R);
+		if ((LC && !LC->isMinValue(true)) || (RC && !RC->isAllOnesValue()))
+			return ConstantInt::getFalse(C);
+		if (LC && RC)
+			return ConstantInt::getTrue(C);
+		return NULL;
+	}
+	// The pointer kinds are left to the solver.
+	if (Kind == "noalias" || Kind.startswith("gep."))
+		return NULL;
+	ConstantInt *RC = dyn_cast<ConstantInt>(R);
+	if (!RC)
+		return NULL;
+	APInt RV = RC->getValue();
+	// Shift left by R is multiplication by 1 << R, which is 0
+	// if R is too large.
+	if (Kind.endswith("shl")) {
+		unsigned n = RV.getBitWidth();
+		RV = RV.uge(n) ? APInt(n, 0) : APInt(n, 1).shl(RV);
+		Kind = Kind.startswith("s") ? "smul" : "umul";
+	}
+	// Multiplying by 0, or by 1 if that is not -1, never overflows.
+	if (Kind.endswith("mul") && (!RV || (RV == 1 && (RV.getBitWidth() > 1 || Kind == "umul"))))
+		return ConstantInt::getFalse(C);
+	ConstantInt *LC = dyn_cast<ConstantInt>(L);
+	if (!LC)
+		return NULL;
+	const APInt &LV = LC->getValue();
+	bool Overflow;
+	if (Kind == "sadd")
+		LV.sadd_ov(RV, Overflow);
+	else if (Kind == "uadd")
+		LV.uadd_ov(RV, Overflow);
+	else if (Kind == "ssub")
+		LV.ssub_ov(RV, Overflow);
+	else if (Kind == "usub")
+		LV.usub_ov(RV, Overflow);
+	else if (Kind == "smul")
+		LV.smul_ov(RV, Overflow);
+	else if (Kind == "umul")
+		LV.umul_ov(RV, Overflow);
+	else
+		llvm_unreachable("Unknown bugon kind!");
+	return ConstantInt::get(Type::getInt1Ty(C), Overflow);
+}
+
+bool BugOnPass::insertLazy(StringRef Kind, Value *L, Value *R, StringRef Bug) {
+	const DebugLoc &DbgLoc = Builder->GetInsertPoint()->getDebugLoc();
+	return insertLazy(Kind, L, R, Bug, DbgLoc);
+}
+
+bool BugOnPass::insertLazy(StringRef Kind, Value *L, Value *R, StringRef Bug, const DebugLoc &DbgLoc) {
+	// Same as insert() for a constant condition.
+	if (Constant *V = foldBugCondition(Kind, L, R))
+		return insert(V, Bug, DbgLoc);
+	LLVMContext &C = L->getContext();
+	Value *Args[] = {UndefValue::get(Type::getInt1Ty(C)), L, R};
+	CallInst *I = create(Args, Bug, DbgLoc);
+	I->setMetadata(MD_bugcond, MDNode::get(C, MDString::get(C, Kind)));
 	return true;
 }
 
@@ -239,3 +357,50 @@ Value *BugOnPass::createPointerEQ(Value *V0, Value *V1) {
 		return Builder->getTrue();
 	return Builder->CreateICmpEQ(V0, Builder->CreatePointerCast(V1, V0->getType()));
 }
+
+// The condition of a lazy bugon of Kind over L and R, as ValueGen
+// encodes it; see BugOnInst.  The pointer kinds need DL.
+Value *BugOnPass::createBugCondition(StringRef Kind, Value *L, Value *R, DataLayout *DL) {
+	if (Constant *V = foldBugCondition(Kind, L, R))
+		return V;
+	if (Kind == "sdiv")
+		return createIsSDivWrap(L, R);
+	if (Kind == "noalias")
+		return createAnd(createIsNotNull(L), createPointerEQ(L, R));
+	if (Kind == "gep.max" || Kind == "gep.min") {
+		if (!DL)
+			return NULL;
+		unsigned PtrBits = DL->getPointerSizeInBits(L->getType()->getPointerAddressSpace());
+		IntegerType *PtrIntTy = Type::getIntNTy(L->getContext(), PtrBits);
+		Value *Offset = Builder->CreateSub(
+			Builder->CreatePtrToInt(R, PtrIntTy),
+			Builder->CreatePtrToInt(L, PtrIntTy)
+		);
+		// Extend to n + 1 bits to avoid overflowing ptr + offset.
+		IntegerType *PtrIntExTy = Type::getIntNTy(L->getContext(), PtrBits + 1);
+		Value *End = Builder->CreateAdd(
+			Builder->CreatePtrToInt(L, PtrIntExTy),
+			createSExtOrTrunc(Offset, PtrIntExTy)
+		);
+		if (Kind == "gep.max") {
+			Value *PtrMax = ConstantInt::get(PtrIntExTy, APInt::getMaxValue(PtrBits).zext(PtrBits + 1));
+			return Builder->CreateICmpSGT(End, PtrMax);
+		}
+		return Builder->CreateICmpSLT(End, Constant::getNullValue(PtrIntExTy));
+	}
+	// Shift left by R is multiplication by 1 << R.
+	if (Kind.endswith("shl")) {
+		R = Builder->CreateShl(ConstantInt::get(L->getType(), 1), R);
+		Kind = Kind.startswith("s") ? "smul" : "umul";
+	}
+	Intrinsic::ID ID = StringSwitch<Intrinsic::ID>(Kind)
+		.Case("sadd", Intrinsic::sadd_with_overflow)
+		.Case("uadd", Intrinsic::uadd_with_overflow)
+		.Case("ssub", Intrinsic::ssub_with_overflow)
+		.Case("usub", Intrinsic::usub_with_overflow)
+		.Case("smul", Intrinsic::smul_with_overflow)
+		.Case("umul", Intrinsic::umul_with_overflow)
+		.Default(Intrinsic::not_intrinsic);
+	assert(ID != Intrinsic::not_intrinsic && "Unknown bugon kind!");
+	return createIsWrap(ID, L, R);
+}
@@ -11,6 +11,9 @@ namespace llvm {
 
 llvm::Function *getBugOn(const llvm::Module *);
 llvm::Function *getOrInsertBugOn(llvm::Module *);
+// Return false if -check-functions lists the functions to check,
+// and F is not one of them.
+bool isCheckedFunction(const llvm::Function &);
 
 class BugOnInst : public llvm::CallInst {
 	typedef llvm::CallInst CallInst;
@@ -21,6 +24,18 @@ public:
 	Value *getCondition() const { return getArgOperand(0); }
 	StringRef getAnnotation() const;
 
+	// A lazy bugon (-bugon-lazy) has an undef condition; the bug
+	// condition is given by its kind over two operands passed after
+	// it, and ValueGen encodes it without IR to compute it.
+	//   sadd, uadd, ssub, usub, smul, umul: L op R overflows;
+	//   sdiv: L / R overflows;
+	//   sshl, ushl: L * (1 << R) overflows;
+	//   gep.max, gep.min: GEP R off pointer L out of range;
+	//   noalias: L != null && L == R.
+	bool isLazy() const { return getNumArgOperands() > 1; }
+	StringRef getKind() const;
+	Value *getLazyOperand(unsigned i) const { return getArgOperand(i + 1); }
+
 	// For LLVM casts.
 	static inline bool classof(const CallInst *I) {
 		if (const Function *F = I->getCalledFunction())
@@ -65,6 +80,10 @@ protected:
 
 	bool insert(Value *, llvm::StringRef Bug);
 	bool insert(Value *, llvm::StringRef Bug, const llvm::DebugLoc &);
+	// Insert a lazy bugon of Kind over L and R; see BugOnInst.
+	static bool isLazy();
+	bool insertLazy(llvm::StringRef Kind, Value *L, Value *R, llvm::StringRef Bug);
+	bool insertLazy(llvm::StringRef Kind, Value *L, Value *R, llvm::StringRef Bug, const llvm::DebugLoc &);
 	llvm::Module *getModule();
 	Instruction *setInsertPoint(Instruction *);
 	Instruction *setInsertPointAfter(Instruction *);
@@ -83,8 +102,11 @@ protected:
 	Value *createAnd(Value *, Value *);
 	Value *createSExtOrTrunc(Value *, llvm::IntegerType *);
 	Value *createPointerEQ(Value *, Value *);
+	Value *createBugCondition(llvm::StringRef Kind, Value *L, Value *R, DataLayout *DL);
 
 private:
 	llvm::Function *BugOn;
-	unsigned int MD_bug;
+	unsigned int MD_bug, MD_bugcond;
+
+	llvm::CallInst *create(llvm::ArrayRef<Value *>, llvm::StringRef Bug, const llvm::DebugLoc &);
 };
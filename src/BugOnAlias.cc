@@ -87,13 +87,17 @@ bool BugOnAlias::visitCallInst(CallInst *I) {
 		return false;
 	// Move insert point to after the noalias call.
 	Instruction *OldIP = setInsertPointAfter(I);
-	Value *notNull = createIsNotNull(I);
+	Value *notNull = isLazy() ? NULL : createIsNotNull(I);
 	for (Value *O : Objects) {
 		if (Instruction *OI = dyn_cast<Instruction>(O)) {
 			// OI needs to properly dominate I.
 			if (OI == I || !DT->dominates(OI, I))
 				continue;
 		}
+		if (isLazy()) {
+			insertLazy("noalias", I, O, "noalias");
+			continue;
+		}
 		Value *E = createAnd(notNull, createPointerEQ(I, O));
 		insert(E, "noalias");
 	}
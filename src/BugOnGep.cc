@@ -91,6 +91,18 @@ bool BugOnGep::insertOffsetOverflow(GEPOperator *GEP) {
 		RecursivelyDeleteTriviallyDeadInstructions(Offset, TLI);
 		return false;
 	}
+	if (isLazy()) {
+		// ValueGen takes the offset from the GEP itself, so the
+		// bugons go after it.
+		RecursivelyDeleteTriviallyDeadInstructions(Offset, TLI);
+		Instruction *I = cast<Instruction>(GEP);
+		Instruction *IP = setInsertPointAfter(I);
+		bool Changed = false;
+		Changed |= insertLazy("gep.max", P, I, "pointer overflow", I->getDebugLoc());
+		Changed |= insertLazy("gep.min", P, I, "pointer overflow", I->getDebugLoc());
+		setInsertPoint(IP);
+		return Changed;
+	}
 	unsigned PtrBits = DL->getPointerSizeInBits(GEP->getPointerAddressSpace());
 	LLVMContext &VMCtx = GEP->getContext();
 	// Extend to n + 1 bits to avoid overflowing ptr + offset.
@@ -13,6 +13,7 @@ struct BugOnInt : BugOnPass {
 	virtual bool runOnInstruction(Instruction *);
 private:
 	bool visitShiftOperator(IntegerType *, Value *R, const char *Bug);
+	bool insertWrap(StringRef Kind, Value *L, Value *R, const char *Bug);
 };
 
 } // anonymous namespace
@@ -31,25 +32,25 @@ bool BugOnInt::runOnInstruction(Instruction *I) {
 	default: break;
 	case Instruction::Add:
 		if (BO->hasNoSignedWrap())
-			Changed |= insert(createIsSAddWrap(L, R), "signed addition overflow");
+			Changed |= insertWrap("sadd", L, R, "signed addition overflow");
 		if (BO->hasNoUnsignedWrap())
-			Changed |= insert(createIsUAddWrap(L, R), "unsigned addition overflow");
+			Changed |= insertWrap("uadd", L, R, "unsigned addition overflow");
 		break;
 	case Instruction::Sub:
 		if (BO->hasNoSignedWrap())
-			Changed |= insert(createIsSSubWrap(L, R), "signed subtraction overflow");
+			Changed |= insertWrap("ssub", L, R, "signed subtraction overflow");
 		if (BO->hasNoUnsignedWrap())
-			Changed |= insert(createIsUSubWrap(L, R), "unsigned subtraction overflow");
+			Changed |= insertWrap("usub", L, R, "unsigned subtraction overflow");
 		break;
 	case Instruction::Mul:
 		if (BO->hasNoSignedWrap())
-			Changed |= insert(createIsSMulWrap(L, R), "signed multiplication overflow");
+			Changed |= insertWrap("smul", L, R, "signed multiplication overflow");
 		if (BO->hasNoUnsignedWrap())
-			Changed |= insert(createIsUMulWrap(L, R), "unsigned multiplication overflow");
+			Changed |= insertWrap("umul", L, R, "unsigned multiplication overflow");
 		break;
 	case Instruction::SDiv:
 	case Instruction::SRem:
-		Changed |= insert(createIsSDivWrap(L, R), "signed division overflow");
+		Changed |= insertWrap("sdiv", L, R, "signed division overflow");
 		// Fall through.
 	case Instruction::UDiv:
 	case Instruction::URem:
@@ -57,14 +58,10 @@ bool BugOnInt::runOnInstruction(Instruction *I) {
 		break;
 	case Instruction::Shl:
 		Changed |= visitShiftOperator(T, R, "shift left overflow");
-		if (BO->hasNoSignedWrap()) {
-			Value *Power = Builder->CreateShl(ConstantInt::get(T, 1), R);
-			Changed |= insert(createIsSMulWrap(L, Power), "signed shift left overflow");
-		}
-		if (BO->hasNoUnsignedWrap()) {
-			Value *Power = Builder->CreateShl(ConstantInt::get(T, 1), R);
-			Changed |= insert(createIsUMulWrap(L, Power), "unsigned shift left overflow");
-		}
+		if (BO->hasNoSignedWrap())
+			Changed |= insertWrap("sshl", L, R, "signed shift left overflow");
+		if (BO->hasNoUnsignedWrap())
+			Changed |= insertWrap("ushl", L, R, "unsigned shift left overflow");
 		break;
 	case Instruction::LShr:
 		Changed |= visitShiftOperator(T, R, "logical shift right overflow");
@@ -82,6 +79,13 @@ bool BugOnInt::visitShiftOperator(IntegerType *T, Value *R, const char *Bug) {
 	return insert(V, Bug);
 }
 
+// Insert bugon(L op R overflows); see BugOnInst for the kinds.
+bool BugOnInt::insertWrap(StringRef Kind, Value *L, Value *R, const char *Bug) {
+	if (isLazy())
+		return insertLazy(Kind, L, R, Bug);
+	return insert(createBugCondition(Kind, L, R, NULL), Bug);
+}
+
 char BugOnInt::ID;
 
 static RegisterPass<BugOnInt>
@@ -4,6 +4,7 @@
 #define DEBUG_TYPE "bugon-loop"
 #include "BugOn.h"
 #include <llvm/InstVisitor.h>
+#include <llvm/IR/DataLayout.h>
 #include <llvm/Analysis/LoopInfo.h>
 #include <llvm/Analysis/ScalarEvolution.h>
 #include <llvm/Analysis/ScalarEvolutionExpander.h>
@@ -39,6 +40,7 @@ struct BugOnLoop : BugOnPass, InstVisitor<BugOnLoop, Value *> {
 	Value *visitExtractValueInst(ExtractValueInst &);
 
 private:
+	DataLayout *DL;
 	LoopInfo *LI;
 	ScalarEvolution *SE;
 	const Loop *Scope;
@@ -62,6 +64,7 @@ private:
 bool BugOnLoop::runOnFunction(Function &F) {
 	LI = &getAnalysis<LoopInfo>();
         SE = &getAnalysis<ScalarEvolution>();
+	DL = getAnalysisIfAvailable<DataLayout>();
         return super::runOnFunction(F);
 }
 
@@ -80,7 +83,17 @@ bool BugOnLoop::runOnInstruction(Instruction *I) {
 	// cannot represent many instructions (e.g., comparisons and overflow
 	// intrinsics).  So just do it ourselves and only use SCEV for values
 	// we cannot deal with (e.g., phi).
-	Value *ExitValue = computeValueAtScope(BOI->getCondition(), L->getParentLoop());
+	const Loop *Parent = L->getParentLoop();
+	Value *ExitValue;
+	if (BOI->isLazy()) {
+		// Compute the operands at the exit instead, and the
+		// condition from them in IR.
+		Value *LHS = computeValueAtScope(BOI->getLazyOperand(0), Parent);
+		Value *RHS = LHS ? computeValueAtScope(BOI->getLazyOperand(1), Parent) : NULL;
+		ExitValue = RHS ? createBugCondition(BOI->getKind(), LHS, RHS, DL) : NULL;
+	} else {
+		ExitValue = computeValueAtScope(BOI->getCondition(), Parent);
+	}
 	if (ExitValue)
 		insert(ExitValue, BOI->getAnnotation(), BOI->getDebugLoc());
 	setInsertPoint(IP);
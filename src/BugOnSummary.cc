@@ -0,0 +1,302 @@
+// This pass summarizes each function by the bugons that hold on every
+// call, with conditions over its arguments and return value, and
+// instantiates the summaries of callees at call sites, bottom-up, so
+// that a caller sees its callees' bugons as a few compact conditions
+// instead of their inlined bodies.
+//
+// A bugon is part of the summary if its block post-dominates the entry,
+// and its condition is computed from arguments, constants and the return
+// value only, by instructions that neither touch memory nor trap.  The
+// return value may be used if it comes from the only return and is not
+// computed in a loop, so that it holds the value returned.
+//
+// This over-approximates a callee that does not return, by longjmp() or
+// an endless loop, without being noreturn: its bugons on arguments are
+// asserted before the call all the same.  The anti passes take the
+// bugons of a block as holding for the whole block anyway.
+
+#define DEBUG_TYPE "bugon-summary"
+#include "BugOn.h"
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SCCIterator.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/Analysis/PostDominators.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/CallSite.h>
+#include <llvm/Support/DebugLoc.h>
+
+using namespace llvm;
+
+namespace {
+
+struct BugOnSummary : ModulePass {
+	static char ID;
+	BugOnSummary() : ModulePass(ID) {}
+
+	virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+		AU.addRequired<PostDominatorTree>();
+		AU.setPreservesCFG();
+	}
+
+	virtual bool runOnModule(Module &);
+
+private:
+	struct SummaryTy {
+		// The value returned, mapped to the call.
+		Value *Ret;
+		SmallVector<BugOnInst *, 4> BugOns;
+	};
+	typedef DenseMap<Value *, Value *> ValueMapTy;
+
+	Function *BugOn;
+	DenseMap<Function *, SummaryTy> Summaries;
+	SmallPtrSet<Function *, 32> Visited;
+	SmallVector<Function *, 32> Order;
+
+	void visit(Function *);
+	void summarize(Function &);
+	bool instantiate(Function &);
+	bool instantiate(CallSite, const SummaryTy &);
+	Value *clone(Value *, ValueMapTy &, IRBuilder<> &);
+};
+
+} // anonymous namespace
+
+// Limits on the size of a summary.
+static const unsigned MaxBugOns = 16;
+static const unsigned MaxInsts = 32;
+
+static Function *getCallee(Instruction *I) {
+	CallSite CS(I);
+	if (!CS || isa<BugOnInst>(I))
+		return NULL;
+	return CS.getCalledFunction();
+}
+
+// Return true if V is computed from arguments, constants and Ret only,
+// by at most Budget instructions that are safe to clone elsewhere.
+static bool isExpressible(Value *V, Value *Ret, SmallPtrSet<Value *, 16> &Seen, unsigned &Budget) {
+	if (isa<Argument>(V) || isa<Constant>(V) || V == Ret)
+		return true;
+	Instruction *I = dyn_cast<Instruction>(V);
+	if (!I)
+		return false;
+	if (!Seen.insert(I))
+		return true;
+	if (!Budget--)
+		return false;
+	if (isa<PHINode>(I) || isa<AllocaInst>(I) || isa<TerminatorInst>(I))
+		return false;
+	if (I->mayReadFromMemory() || I->mayHaveSideEffects())
+		return false;
+	// Calls are allowed only to intrinsics such as with.overflow.
+	if (!isSafeToSpeculativelyExecute(I))
+		return false;
+	for (User::op_iterator i = I->op_begin(), e = I->op_end(); i != e; ++i) {
+		if (!isExpressible(*i, Ret, Seen, Budget))
+			return false;
+	}
+	return true;
+}
+
+static bool uses(Value *V, Value *Ret, SmallPtrSet<Value *, 16> &Seen) {
+	if (V == Ret)
+		return true;
+	Instruction *I = dyn_cast<Instruction>(V);
+	if (!I || !Seen.insert(I))
+		return false;
+	for (User::op_iterator i = I->op_begin(), e = I->op_end(); i != e; ++i) {
+		if (uses(*i, Ret, Seen))
+			return true;
+	}
+	return false;
+}
+
+// The location of a callee's instruction as if inlined at the call;
+// see UpdateInlinedAtInfo() in InlineFunction.cpp.
+static DebugLoc getInlinedLoc(const DebugLoc &DL, const DebugLoc &CallDL, LLVMContext &C) {
+	if (DL.isUnknown() || CallDL.isUnknown())
+		return DL;
+	DebugLoc InlinedAt = CallDL;
+	if (MDNode *IA = DL.getInlinedAt(C))
+		InlinedAt = getInlinedLoc(DebugLoc::getFromDILocation(IA), CallDL, C);
+	return DebugLoc::get(DL.getLine(), DL.getCol(), DL.getScope(C), InlinedAt.getAsMDNode(C));
+}
+
+bool BugOnSummary::runOnModule(Module &M) {
+	BugOn = getBugOn(&M);
+	if (!BugOn)
+		return false;
+	for (Module::iterator i = M.begin(), e = M.end(); i != e; ++i)
+		visit(i);
+	bool Changed = false;
+	// Callees come first; a call within a cycle of recursion
+	// may see no summary of its callee.
+	for (unsigned i = 0, n = Order.size(); i != n; ++i) {
+		Function &F = *Order[i];
+		Changed |= instantiate(F);
+		summarize(F);
+	}
+	Summaries.clear();
+	Visited.clear();
+	Order.clear();
+	return Changed;
+}
+
+// Order functions in post-order of the direct call graph.
+void BugOnSummary::visit(Function *F) {
+	if (F->isDeclaration() || !Visited.insert(F))
+		return;
+	for (Function::iterator b = F->begin(), be = F->end(); b != be; ++b) {
+		for (BasicBlock::iterator i = b->begin(), ie = b->end(); i != ie; ++i) {
+			if (Function *Callee = getCallee(i))
+				visit(Callee);
+		}
+	}
+	Order.push_back(F);
+}
+
+void BugOnSummary::summarize(Function &F) {
+	// The definition seen here may not be the one called.
+	if (F.mayBeOverridden())
+		return;
+	PostDominatorTree &PDT = getAnalysis<PostDominatorTree>(F);
+	// Blocks in loops.
+	SmallPtrSet<BasicBlock *, 16> InLoop;
+	for (scc_iterator<Function *> i = scc_begin(&F), e = scc_end(&F); i != e; ++i) {
+		if (i.hasLoop())
+			InLoop.insert((*i).begin(), (*i).end());
+	}
+	// The value returned, if any, from the only return.
+	Value *Ret = NULL;
+	for (Function::iterator b = F.begin(), be = F.end(); b != be; ++b) {
+		ReturnInst *RI = dyn_cast<ReturnInst>(b->getTerminator());
+		if (!RI)
+			continue;
+		if (Ret || !RI->getReturnValue()) {
+			Ret = NULL;
+			break;
+		}
+		Ret = RI->getReturnValue();
+	}
+	// Returned arguments and constants need no mapping.
+	Instruction *RetI = dyn_cast_or_null<Instruction>(Ret);
+	if (!RetI || InLoop.count(RetI->getParent()))
+		Ret = NULL;
+	BasicBlock *Entry = &F.getEntryBlock();
+	SummaryTy &Summary = Summaries[&F];
+	Summary.Ret = Ret;
+	for (Function::iterator b = F.begin(), be = F.end(); b != be; ++b) {
+		BasicBlock *BB = b;
+		if (!PDT.dominates(BB, Entry))
+			continue;
+		for (BasicBlock::iterator i = BB->begin(), ie = BB->end(); i != ie; ++i) {
+			BugOnInst *I = dyn_cast<BugOnInst>(i);
+			if (!I || (!I->isLazy() && isa<Constant>(I->getCondition())))
+				continue;
+			// A lazy bugon has its operands as arguments too.
+			SmallPtrSet<Value *, 16> Seen;
+			unsigned Budget = MaxInsts;
+			bool Expressible = true;
+			for (unsigned k = 0, m = I->getNumArgOperands(); k != m && Expressible; ++k)
+				Expressible = isExpressible(I->getArgOperand(k), Ret, Seen, Budget);
+			if (!Expressible)
+				continue;
+			Summary.BugOns.push_back(I);
+			if (Summary.BugOns.size() == MaxBugOns)
+				return;
+		}
+	}
+}
+
+bool BugOnSummary::instantiate(Function &F) {
+	bool Changed = false;
+	for (Function::iterator b = F.begin(), be = F.end(); b != be; ++b) {
+		for (BasicBlock::iterator i = b->begin(), ie = b->end(); i != ie; ) {
+			Instruction *I = i++;
+			Function *Callee = getCallee(I);
+			if (!Callee)
+				continue;
+			DenseMap<Function *, SummaryTy>::iterator it = Summaries.find(Callee);
+			if (it == Summaries.end() || it->second.BugOns.empty())
+				continue;
+			Changed |= instantiate(CallSite(I), it->second);
+		}
+	}
+	return Changed;
+}
+
+bool BugOnSummary::instantiate(CallSite CS, const SummaryTy &Summary) {
+	Instruction *I = CS.getInstruction();
+	Function *Callee = CS.getCalledFunction();
+	if (CS.arg_size() < Callee->arg_size())
+		return false;
+	LLVMContext &C = I->getContext();
+	const DebugLoc &CallDL = I->getDebugLoc();
+	// Conditions on arguments go before the call, and those on the
+	// return value after it, where the value is available.
+	IRBuilder<> Before(I), After(C);
+	ValueMapTy Args;
+	unsigned Idx = 0;
+	for (Function::arg_iterator a = Callee->arg_begin(), ae = Callee->arg_end(); a != ae; ++a, ++Idx)
+		Args[a] = CS.getArgument(Idx);
+	Value *Ret = Summary.Ret;
+	ValueMapTy Results = Args;
+	if (Ret && isa<CallInst>(I)) {
+		Results[Ret] = I;
+		After.SetInsertPoint(I->getParent(), llvm::next(BasicBlock::iterator(I)));
+	}
+	bool Changed = false;
+	for (unsigned i = 0, n = Summary.BugOns.size(); i != n; ++i) {
+		BugOnInst *BI = Summary.BugOns[i];
+		unsigned NumArgs = BI->getNumArgOperands();
+		SmallPtrSet<Value *, 16> Seen;
+		bool UsesRet = false;
+		for (unsigned k = 0; k != NumArgs && Ret && !UsesRet; ++k)
+			UsesRet = uses(BI->getArgOperand(k), Ret, Seen);
+		if (UsesRet && !After.GetInsertBlock())
+			continue;
+		IRBuilder<> &B = UsesRet ? After : Before;
+		SmallVector<Value *, 3> NewArgs;
+		for (unsigned k = 0; k != NumArgs; ++k)
+			NewArgs.push_back(clone(BI->getArgOperand(k), UsesRet ? Results : Args, B));
+		if (ConstantInt *CI = dyn_cast<ConstantInt>(NewArgs[0])) {
+			if (CI->isZero())
+				continue;
+		}
+		CallInst *NewBI = B.CreateCall(BugOn, NewArgs);
+		NewBI->setMetadata("bug", BI->getMetadata("bug"));
+		NewBI->setMetadata("bugcond", BI->getMetadata("bugcond"));
+		NewBI->setDebugLoc(getInlinedLoc(BI->getDebugLoc(), CallDL, C));
+		Changed = true;
+	}
+	return Changed;
+}
+
+// Clone the computation of V at the insert point of B, with VMap giving
+// the values of arguments and the return value at the call site.
+Value *BugOnSummary::clone(Value *V, ValueMapTy &VMap, IRBuilder<> &B) {
+	if (isa<Constant>(V))
+		return V;
+	ValueMapTy::iterator it = VMap.find(V);
+	if (it != VMap.end())
+		return it->second;
+	Instruction *I = cast<Instruction>(V);
+	Instruction *NewI = I->clone();
+	for (unsigned i = 0, n = I->getNumOperands(); i != n; ++i)
+		NewI->setOperand(i, clone(I->getOperand(i), VMap, B));
+	// Don't set debugging information for inserted instructions.
+	NewI->setDebugLoc(DebugLoc());
+	B.Insert(NewI);
+	VMap[I] = NewI;
+	return NewI;
+}
+
+char BugOnSummary::ID;
+
+static RegisterPass<BugOnSummary>
+X("bugon-summary", "Instantiate bugon summaries of callees at call sites");
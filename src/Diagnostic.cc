@@ -23,13 +23,24 @@ bool Diagnostic::hasSingleDebugLocation(Instruction *I) {
 	return true;
 }
 
-Diagnostic::Diagnostic() : OS(errs()) {}
+// Output of the current thread, if not stderr.
+static __thread raw_ostream *Redirected;
+
+void Diagnostic::redirect(raw_ostream *OS) {
+	Redirected = OS;
+}
+
+raw_ostream &Diagnostic::os() {
+	if (Redirected)
+		return *Redirected;
+	return errs();
+}
 
 void Diagnostic::backtrace(Instruction *I) {
 	MDNode *MD = I->getDebugLoc().getAsMDNode(I->getContext());
 	if (!MD)
 		return;
-	OS << "stack: \n";
+	os() << "stack: \n";
 	DILocation Loc(MD);
 	for (;;) {
 		this->location(Loc);
@@ -47,9 +58,9 @@ void Diagnostic::location(MDNode *MD) {
 		Path.append(Filename.begin(), Filename.end());
 	else
 		sys::path::append(Path, Loc.getDirectory(), Filename);
-	OS << "  - " << Path
-	   << ':' << Loc.getLineNumber()
-	   << ':' << Loc.getColumnNumber() << "\n";
+	os() << "  - " << Path
+	     << ':' << Loc.getLineNumber()
+	     << ':' << Loc.getColumnNumber() << "\n";
 }
 
 void Diagnostic::bug(Instruction *I) {
@@ -60,7 +71,7 @@ void Diagnostic::bug(Instruction *I) {
 }
 
 void Diagnostic::bug(const Twine &Str) {
-	OS << "---\n" << "bug: " << Str << "\n";
+	os() << "---\n" << "bug: " << Str << "\n";
 }
 
 void Diagnostic::status(int Status) {
@@ -71,5 +82,5 @@ void Diagnostic::status(int Status) {
 	case SMT_SAT:     Str = "sat";     break;
 	default:          Str = "timeout"; break;
 	}
-	OS << "status: " << Str << "\n";
+	os() << "status: " << Str << "\n";
 }
@@ -15,9 +15,11 @@ public:
 	// Return if I has a non-inlined debug location.
 	static bool hasSingleDebugLocation(Instruction *I);
 
-	Diagnostic();
+	// Send the output of the calling thread to OS, or back to
+	// stderr if NULL.
+	static void redirect(llvm::raw_ostream *OS);
 
-	llvm::raw_ostream &os() { return OS; }
+	llvm::raw_ostream &os();
 
 	void bug(Instruction *);
 	void bug(const llvm::Twine &);
@@ -28,10 +30,7 @@ public:
 
 	template <typename T> Diagnostic &
 	operator <<(const T &Val) {
-		OS << Val;
+		os() << Val;
 		return *this;
 	}
-
-private:
-	llvm::raw_ostream &OS;
 };
@@ -0,0 +1,43 @@
+// This pass prints the functions that have bugons, with their sizes,
+// for poptck to estimate the cost of checking each.
+
+#include "BugOn.h"
+#include <llvm/Support/InstIterator.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+namespace {
+
+struct ListFunctions : FunctionPass {
+	static char ID;
+	ListFunctions() : FunctionPass(ID) {}
+
+	virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+		AU.setPreservesAll();
+	}
+
+	virtual bool runOnFunction(Function &);
+};
+
+} // anonymous namespace
+
+bool ListFunctions::runOnFunction(Function &F) {
+	unsigned NumBugOns = 0;
+	for (inst_iterator i = inst_begin(F), e = inst_end(F); i != e; ++i) {
+		if (isa<BugOnInst>(&*i))
+			++NumBugOns;
+	}
+	// Nothing to check.
+	if (!NumBugOns)
+		return false;
+	// Diagnostics go to errs(), which optck merges with this; an
+	// outs() buffer could be flushed mid-line between them.
+	errs() << "function: " << F.size() << " " << NumBugOns << " " << F.getName() << "\n";
+	return false;
+}
+
+char ListFunctions::ID;
+
+static RegisterPass<ListFunctions>
+X("list-functions", "Print the functions to check, with their sizes");
@@ -15,11 +15,6 @@ PathGen::PathGen(ValueGen &VG, const EdgeVec &BE)
 PathGen::PathGen(ValueGen &VG, const EdgeVec &Backedges, DominatorTree &DT)
 	: VG(VG), Backedges(Backedges), DT(&DT) {}
 
-PathGen::~PathGen() {
-	for (iterator i = Cache.begin(), e = Cache.end(); i != e; ++i)
-		SMT.decref(i->second);
-}
-
 static BasicBlock *findCommonDominator(BasicBlock *BB, DominatorTree *DT) {
 	pred_iterator i = pred_begin(BB), e = pred_end(BB);
 	BasicBlock *Dom = *i;
@@ -57,14 +52,8 @@ SMTExpr PathGen::get(BasicBlock *BB) {
 		SMTExpr Term = getTermGuard(Pred->getTerminator(), BB);
 		SMTExpr PN = getPHIGuard(BB, Pred);
 		SMTExpr TermWithPN = SMT.bvand(Term, PN);
-		SMT.decref(Term);
-		SMT.decref(PN);
 		SMTExpr Br = SMT.bvand(TermWithPN, get(Pred));
-		SMT.decref(TermWithPN);
-		SMTExpr Tmp = SMT.bvor(G, Br);
-		SMT.decref(G);
-		SMT.decref(Br);
-		G = Tmp;
+		G = SMT.bvor(G, Br);
 	}
 	Cache[BB] = G;
 	return G;
@@ -91,10 +80,7 @@ SMTExpr PathGen::getPHIGuard(BasicBlock *BB, BasicBlock *Pred) {
 			continue;
 		// Generate I == V.
 		SMTExpr PN = SMT.eq(VG.get(I), VG.get(V));
-		SMTExpr Tmp = SMT.bvand(E, PN);
-		SMT.decref(E);
-		SMT.decref(PN);
-		E = Tmp;
+		E = SMT.bvand(E, PN);
 	}
 	return E;
 }
@@ -118,13 +104,10 @@ SMTExpr PathGen::getTermGuard(BranchInst *I, BasicBlock *BB) {
 	// Conditional branch.
 	Value *V = I->getCondition();
 	SMTExpr E = VG.get(V);
-	SMT.incref(E);
 	// True or false branch.
 	if (I->getSuccessor(0) != BB) {
 		assert(I->getSuccessor(1) == BB);
-		SMTExpr Tmp = SMT.bvnot(E);
-		SMT.decref(E);
-		E = Tmp;
+		E = SMT.bvnot(E);
 	}
 	return E;
 }
@@ -140,10 +123,7 @@ SMTExpr PathGen::getTermGuard(SwitchInst *I, BasicBlock *BB) {
 			if (i.getCaseSuccessor() == BB) {
 				ConstantInt *CI = i.getCaseValue();
 				SMTExpr Cond = SMT.eq(L, VG.get(CI));
-				SMTExpr Tmp = SMT.bvor(E, Cond);
-				SMT.decref(Cond);
-				SMT.decref(E);
-				E = Tmp;
+				E = SMT.bvor(E, Cond);
 			}
 		}
 		return E;
@@ -154,12 +134,7 @@ SMTExpr PathGen::getTermGuard(SwitchInst *I, BasicBlock *BB) {
 	for (; i != e; ++i) {
 		ConstantInt *CI = i.getCaseValue();
 		SMTExpr Cond = SMT.eq(L, VG.get(CI));
-		SMTExpr Tmp = SMT.bvor(E, Cond);
-		SMT.decref(Cond);
-		SMT.decref(E);
-		E = Tmp;
+		E = SMT.bvor(E, Cond);
 	}
-	SMTExpr NotE = SMT.bvnot(E);
-	SMT.decref(E);
-	return NotE;
+	return SMT.bvnot(E);
 }
@@ -23,7 +23,6 @@ public:
 
 	PathGen(ValueGen &, const EdgeVec &);
 	PathGen(ValueGen &, const EdgeVec &, llvm::DominatorTree &DT);
-	~PathGen();
 
 	SMTExpr get(llvm::BasicBlock *);
 
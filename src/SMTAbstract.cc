@@ -0,0 +1,164 @@
+// Abstraction refinement for wide nonlinear operators, which blast
+// into huge multiplier and divider circuits.  Each multiplication,
+// division, remainder and multiplication overflow check of two
+// non-constant operands, at least -smt-abstract-width bits wide, is
+// replaced by a fresh variable, constrained by a few cheap axioms.
+// An unsat answer holds for the exact query.  A model is checked
+// against the exact semantics of the abstracted operators, and those
+// it got wrong get their definitions back, until the query is unsat
+// or a model checks.
+
+#include "SMTSolver.h"
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/ErrorHandling.h>
+
+using namespace llvm;
+
+static cl::opt<unsigned>
+SMTAbstractOpt("smt-abstract-width",
+               cl::desc("Abstract nonlinear operators at least this wide (0 to disable)"),
+               cl::value_desc("bits"), cl::init(64));
+
+bool SMTSolver::abstracts() {
+	return SMTAbstractOpt;
+}
+
+static bool isNonlinear(SMTExpr X) {
+	switch (X->getOpcode()) {
+	default: return false;
+	case SMT_MUL:
+	case SMT_SDIV:
+	case SMT_UDIV:
+	case SMT_SREM:
+	case SMT_UREM:
+	case SMT_SMULO:
+	case SMT_UMULO:
+		break;
+	}
+	SMTExpr L = X->getOperand(0), R = X->getOperand(1);
+	// The axioms take 1 as the identity, which a 1-bit signed
+	// operator has not: there 1 is -1, and -1 * -1 overflows.
+	return L->getWidth() >= 2 && L->getWidth() >= SMTAbstractOpt
+		&& L->getOpcode() != SMT_CONST
+		&& R->getOpcode() != SMT_CONST;
+}
+
+// Facts about V = X that need no multiplier or divider.  Division
+// by zero is left alone, as backends may differ on it.
+SMTExpr SMTSolver::axioms(SMTExpr X, SMTExpr V) {
+	SMTExpr L = X->getOperand(0), R = X->getOperand(1);
+	unsigned Width = L->getWidth(), Half = Width / 2;
+	SMTExpr Zero = bvconst(APInt::getNullValue(Width));
+	SMTExpr One = bvconst(APInt(Width, 1));
+	SMTExpr Implied = bvtrue();
+	auto implies = [&](SMTExpr P, SMTExpr Q) {
+		Implied = bvand(Implied, bvor(bvnot(P), Q));
+	};
+	switch (X->getOpcode()) {
+	default: llvm_unreachable("Not abstracted!");
+	case SMT_MUL:
+		implies(bvor(eq(L, Zero), eq(R, Zero)), eq(V, Zero));
+		implies(eq(L, One), eq(V, R));
+		implies(eq(R, One), eq(V, L));
+		break;
+	case SMT_UDIV:
+		implies(eq(R, One), eq(V, L));
+		implies(ne(R, Zero), bvule(V, L));
+		break;
+	case SMT_UREM:
+		implies(ne(R, Zero), bvand(bvult(V, R), bvule(V, L)));
+		break;
+	case SMT_SDIV:
+		implies(eq(R, One), eq(V, L));
+		implies(bvand(bvsge(L, Zero), bvsgt(R, Zero)), bvand(bvsge(V, Zero), bvsle(V, L)));
+		break;
+	case SMT_SREM:
+		// The remainder takes the sign of the dividend.
+		implies(eq(R, One), eq(V, Zero));
+		implies(bvand(ne(R, Zero), bvsge(L, Zero)), bvsge(V, Zero));
+		implies(bvand(ne(R, Zero), bvslt(L, Zero)), bvsle(V, Zero));
+		break;
+	case SMT_UMULO: {
+		// Neither operand wider than half the bits.
+		SMTExpr HalfZero = bvconst(APInt::getNullValue(Width - Half));
+		SMTExpr Fit = bvand(eq(extract(Width - 1, Half, L), HalfZero),
+		                    eq(extract(Width - 1, Half, R), HalfZero));
+		implies(bvor(Fit, bvor(bvule(L, One), bvule(R, One))), bvnot(V));
+		break;
+	}
+	case SMT_SMULO: {
+		// Both operands sign-extended from half the bits.
+		SMTExpr Fit = bvand(eq(L, sign_extend(Width - Half, extract(Half - 1, 0, L))),
+		                    eq(R, sign_extend(Width - Half, extract(Half - 1, 0, R))));
+		SMTExpr Trivial = bvor(bvor(eq(L, Zero), eq(R, Zero)), bvor(eq(L, One), eq(R, One)));
+		implies(bvor(Fit, Trivial), bvnot(V));
+		break;
+	}
+	}
+	return Implied;
+}
+
+// Does the model give V the value of X?
+bool SMTSolver::holds(SMTBackend *B, SMTModel M, SMTExpr X, SMTExpr V) {
+	APInt L, R, Val;
+	B->eval(M, X->getOperand(0), L);
+	B->eval(M, X->getOperand(1), R);
+	B->eval(M, V, Val);
+	bool Overflow;
+	switch (X->getOpcode()) {
+	default: llvm_unreachable("Not abstracted!");
+	case SMT_MUL:  return Val == L * R;
+	case SMT_UDIV: return !!R && Val == L.udiv(R);
+	case SMT_UREM: return !!R && Val == L.urem(R);
+	case SMT_SDIV: return !!R && Val == L.sdiv(R);
+	case SMT_SREM: return !!R && Val == L.srem(R);
+	case SMT_UMULO:
+		L.umul_ov(R, Overflow);
+		return Val.getBoolValue() == Overflow;
+	case SMT_SMULO:
+		L.smul_ov(R, Overflow);
+		return Val.getBoolValue() == Overflow;
+	}
+}
+
+bool SMTSolver::abstract(SMTBackend *B, SMTExpr E, SMTStatus &Status) {
+	if (!SMTAbstractOpt)
+		return false;
+	// Exact nodes over abstracted operands, and their variables.
+	SmallVector<std::pair<SMTExpr, SMTExpr>, 8> Abs;
+	DenseMap<const SMTNode *, SMTExpr> Memo;
+	SMTExpr Q = translateSMT(Memo, E, [this, &Abs](const SMTNode *N, const SMTExpr *Ops) {
+		SMTExpr X = rebuild(N, Ops);
+		if (!isNonlinear(X))
+			return X;
+		SMTExpr V = bvvar(X->getWidth(), "nonlinear");
+		Abs.push_back(std::make_pair(X, V));
+		return V;
+	});
+	if (Abs.empty())
+		return false;
+	for (unsigned i = 0, n = Abs.size(); i != n; ++i)
+		Q = bvand(Q, axioms(Abs[i].first, Abs[i].second));
+	SmallVector<bool, 8> Refined(Abs.size());
+	for (;;) {
+		SMTModel M = NULL;
+		Status = B->solve(Q, &M);
+		if (Status != SMT_SAT)
+			return true;
+		// The backend gives no model to check; solve E exactly.
+		if (!M)
+			return false;
+		bool Changed = false;
+		for (unsigned i = 0, n = Abs.size(); i != n; ++i) {
+			if (Refined[i] || holds(B, M, Abs[i].first, Abs[i].second))
+				continue;
+			Q = bvand(Q, eq(Abs[i].second, Abs[i].first));
+			Refined[i] = Changed = true;
+		}
+		B->release(M);
+		if (!Changed)
+			return true;
+	}
+}
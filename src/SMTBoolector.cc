@@ -1,25 +1,23 @@
 #include "SMTSolver.h"
 #include <llvm/ADT/APInt.h>
+#include <llvm/ADT/DenseMap.h>
 #include <llvm/ADT/SmallString.h>
-#include <llvm/Support/Debug.h>
-#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/ErrorHandling.h>
 #include <algorithm>
+#include <vector>
 #include <assert.h>
 #include <limits.h>
-#include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 extern "C" {
 #include <boolector/boolector.h>
+#define BTOR_USE_LINGELING
+#include <boolector/btorexp.h>
+#include <lingeling/lglib.h>
 }
 
 using namespace llvm;
 
-#define ctx ((Btor *)ctx_)
-#define m   ((Btor *)m_)
-#define e   ((BtorNode *)e_)
-#define lhs ((BtorNode *)lhs_)
-#define rhs ((BtorNode *)rhs_)
-
 // Boolector 1.5 is much slower due to the new SAT backend.
 // Use the workaround to disable preprocessing for performance.
 namespace {
@@ -30,199 +28,17 @@ namespace {
 
 static SMTWorkaround X;
 
-SMTSolver::SMTSolver(bool modelgen) {
-	ctx_ = boolector_new();
-	if (modelgen)
-		boolector_enable_model_gen(ctx);
-	boolector_enable_inc_usage(ctx);
-}
-
-SMTSolver::~SMTSolver() {
-	assert(boolector_get_refs(ctx) == 0);
-	boolector_delete(ctx);
-}
-
-void SMTSolver::assume(SMTExpr e_) {
-	boolector_assert(ctx, e);
-}
-
-SMTStatus SMTSolver::query(SMTExpr e_, SMTModel *m_) {
-	boolector_assume(ctx, e);
-	switch (boolector_sat(ctx)) {
-	default:              return SMT_UNDEF;
-	case BOOLECTOR_UNSAT: return SMT_UNSAT;
-	case BOOLECTOR_SAT:   break;
-	}
-	if (m_)
-		*m_ = ctx_;
-	return SMT_SAT;
-}
-
-void SMTSolver::eval(SMTModel m_, SMTExpr e_, APInt &v) {
-	char *s = boolector_bv_assignment(ctx, e);
-	std::string str(s);
-	boolector_free_bv_assignment(ctx, s);
-	std::replace(str.begin(), str.end(), 'x', '0');
-	v = APInt(bvwidth(e), str.c_str(), 2);
-}
-
-void SMTSolver::release(SMTModel m_) {}
-
-void SMTSolver::dump(SMTExpr e_) {
-	print(e, dbgs());
-	dbgs() << "\n";
-}
-
-void SMTSolver::print(SMTExpr e_, raw_ostream &OS) {
-	FILE *fp = tmpfile();
-	assert(fp && "tmpfile");
-	boolector_dump_btor(ctx, fp, e);
-	long n = ftell(fp);
-	fseek(fp, 0, SEEK_SET);
-	char *s = (char *)malloc(n + 1);
-	n = fread(s, 1, n, fp);
-	assert(n > 0);
-	s[n] = 0;
-	OS << s;
-	free(s);
-	fclose(fp);
-}
-
-void SMTSolver::incref(SMTExpr e_) {
-	boolector_copy(ctx, e);
-}
-
-void SMTSolver::decref(SMTExpr e_) {
-	boolector_release(ctx, e);
-}
-
-unsigned SMTSolver::bvwidth(SMTExpr e_) {
-	return boolector_get_width(ctx, e);
-}
-
-SMTExpr SMTSolver::bvfalse() {
-	return boolector_false(ctx);
-}
-
-SMTExpr SMTSolver::bvtrue() {
-	return boolector_true(ctx);
-}
-
-SMTExpr SMTSolver::bvconst(const APInt &Val) {
+static BtorNode *bvconst(Btor *btor, const APInt &Val) {
 	unsigned intbits = sizeof(unsigned) * CHAR_BIT;
 	unsigned width = Val.getBitWidth();
 	if (width <= intbits)
-		return boolector_unsigned_int(ctx, Val.getZExtValue(), width);
+		return boolector_unsigned_int(btor, Val.getZExtValue(), width);
 	SmallString<32> Str, FullStr;
 	Val.toStringUnsigned(Str, 2);
 	assert(Str.size() <= width);
 	FullStr.assign(width - Str.size(), '0');
 	FullStr += Str;
-	return boolector_const(ctx, FullStr.c_str());
-}
-
-SMTExpr SMTSolver::bvvar(unsigned width, const char *name) {
-	return boolector_var(ctx, width, name);
-}
-
-SMTExpr SMTSolver::ite(SMTExpr e_, SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_cond(ctx, e, lhs, rhs);
-}
-
-SMTExpr SMTSolver::eq(SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_eq(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::ne(SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_ne(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvslt(SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_slt(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvsle(SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_slte(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvsgt(SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_sgt(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvsge(SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_sgte(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvult(SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_ult(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvule(SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_ulte(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvugt(SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_ugt(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvuge(SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_ugte(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::extract(unsigned high, unsigned low, SMTExpr e_) {
-	return boolector_slice(ctx, e, high, low);
-}
-
-SMTExpr SMTSolver::zero_extend(unsigned i, SMTExpr e_) {
-	return boolector_uext(ctx, e, i);
-}
-
-SMTExpr SMTSolver::sign_extend(unsigned i, SMTExpr e_) {
-	return boolector_sext(ctx, e, i);
-}
-
-SMTExpr SMTSolver::bvredand(SMTExpr e_) {
-	return boolector_redand(ctx, e);
-}
-
-SMTExpr SMTSolver::bvredor(SMTExpr e_) {
-	return boolector_redor(ctx, e);
-}
-
-SMTExpr SMTSolver::bvnot(SMTExpr e_) {
-	return boolector_not(ctx, e);
-}
-
-SMTExpr SMTSolver::bvneg(SMTExpr e_) {
-	return boolector_neg(ctx, e);
-}
-
-SMTExpr SMTSolver::bvadd(SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_add(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvsub(SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_sub(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvmul(SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_mul(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvsdiv(SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_sdiv(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvudiv(SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_udiv(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvsrem(SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_srem(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvurem(SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_urem(ctx, lhs, rhs);
+	return boolector_const(btor, FullStr.c_str());
 }
 
 // Shift operations use log2n bits for shifting amount. 
@@ -248,93 +64,279 @@ static inline BtorNode *shift(Btor *btor,  BtorNode *e0,  BtorNode *e1) {
 	return result;
 }
 
-SMTExpr SMTSolver::bvshl(SMTExpr lhs_, SMTExpr rhs_) {
-	// Return 0 if rhs >= n.
-	unsigned n = boolector_get_width(ctx, rhs);
-	BtorNode *width = boolector_unsigned_int(ctx, n, n);
-	BtorNode *cond = boolector_ugte(ctx, rhs, width);
-	BtorNode *zero = boolector_zero(ctx, n);
-	BtorNode *tmp = shift<boolector_sll>(ctx, lhs, rhs);
-	BtorNode *result = boolector_cond(ctx, cond, zero, tmp);
-	boolector_release(ctx, width);
-	boolector_release(ctx, cond);
-	boolector_release(ctx, zero);
-	boolector_release(ctx, tmp);
-	return result;
-}
-
-SMTExpr SMTSolver::bvlshr(SMTExpr lhs_, SMTExpr rhs_) {
-	// Return 0 if rhs >= n.
-	unsigned n = boolector_get_width(ctx, rhs);
-	BtorNode *width = boolector_unsigned_int(ctx, n, n);
-	BtorNode *cond = boolector_ugte(ctx, rhs, width);
-	BtorNode *zero = boolector_zero(ctx, n);
-	BtorNode *tmp = shift<boolector_srl>(ctx, lhs, rhs);
-	BtorNode *result = boolector_cond(ctx, cond, zero, tmp);
-	boolector_release(ctx, width);
-	boolector_release(ctx, cond);
-	boolector_release(ctx, zero);
-	boolector_release(ctx, tmp);
+// Return 0 if rhs >= n.
+template <BtorNode *(*F)(Btor *, BtorNode *,  BtorNode *)>
+static BtorNode *logical_shift(Btor *btor, BtorNode *lhs, BtorNode *rhs) {
+	unsigned n = boolector_get_width(btor, rhs);
+	BtorNode *width = boolector_unsigned_int(btor, n, n);
+	BtorNode *cond = boolector_ugte(btor, rhs, width);
+	BtorNode *zero = boolector_zero(btor, n);
+	BtorNode *tmp = shift<F>(btor, lhs, rhs);
+	BtorNode *result = boolector_cond(btor, cond, zero, tmp);
+	boolector_release(btor, width);
+	boolector_release(btor, cond);
+	boolector_release(btor, zero);
+	boolector_release(btor, tmp);
 	return result;
 }
 
-SMTExpr SMTSolver::bvashr(SMTExpr lhs_, SMTExpr rhs_) {
-	// If rhs is too large, the result is either zero or all-one,
-	// the same as limiting rhs to n - 1.
-	unsigned n = boolector_get_width(ctx, rhs);
-	BtorNode *maxw = boolector_unsigned_int(ctx, n - 1, n);
-	BtorNode *cond = boolector_ugt(ctx, rhs, maxw);
-	BtorNode *rhs_max = boolector_cond(ctx, cond, maxw, rhs);
-	BtorNode *result = shift<boolector_sra>(ctx, lhs, rhs_max);
-	boolector_release(ctx, maxw);
-	boolector_release(ctx, cond);
-	boolector_release(ctx, rhs_max);
+// If rhs is too large, the result is either zero or all-one,
+// the same as limiting rhs to n - 1.
+static BtorNode *arith_shift(Btor *btor, BtorNode *lhs, BtorNode *rhs) {
+	unsigned n = boolector_get_width(btor, rhs);
+	BtorNode *maxw = boolector_unsigned_int(btor, n - 1, n);
+	BtorNode *cond = boolector_ugt(btor, rhs, maxw);
+	BtorNode *rhs_max = boolector_cond(btor, cond, maxw, rhs);
+	BtorNode *result = shift<boolector_sra>(btor, lhs, rhs_max);
+	boolector_release(btor, maxw);
+	boolector_release(btor, cond);
+	boolector_release(btor, rhs_max);
 	return result;
 }
 
-SMTExpr SMTSolver::bvand(SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_and(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvor(SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_or(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvxor(SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_xor(ctx, lhs, rhs);
+static BtorNode *build(Btor *btor, const SMTNode *N, BtorNode **ops) {
+	switch (N->getOpcode()) {
+	default: llvm_unreachable("Unknown opcode!");
+	case SMT_CONST:   return bvconst(btor, N->getValue());
+	case SMT_VAR:     return boolector_var(btor, N->getWidth(), N->getName());
+	case SMT_ITE:     return boolector_cond(btor, ops[0], ops[1], ops[2]);
+	case SMT_EQ:      return boolector_eq(btor, ops[0], ops[1]);
+	case SMT_SLT:     return boolector_slt(btor, ops[0], ops[1]);
+	case SMT_SLE:     return boolector_slte(btor, ops[0], ops[1]);
+	case SMT_ULT:     return boolector_ult(btor, ops[0], ops[1]);
+	case SMT_ULE:     return boolector_ulte(btor, ops[0], ops[1]);
+	case SMT_EXTRACT: return boolector_slice(btor, ops[0], N->getParam(0), N->getParam(1));
+	case SMT_ZEXT:    return boolector_uext(btor, ops[0], N->getParam(0));
+	case SMT_SEXT:    return boolector_sext(btor, ops[0], N->getParam(0));
+	case SMT_REDAND:  return boolector_redand(btor, ops[0]);
+	case SMT_REDOR:   return boolector_redor(btor, ops[0]);
+	case SMT_NOT:     return boolector_not(btor, ops[0]);
+	case SMT_NEG:     return boolector_neg(btor, ops[0]);
+	case SMT_ADD:     return boolector_add(btor, ops[0], ops[1]);
+	case SMT_SUB:     return boolector_sub(btor, ops[0], ops[1]);
+	case SMT_MUL:     return boolector_mul(btor, ops[0], ops[1]);
+	case SMT_SDIV:    return boolector_sdiv(btor, ops[0], ops[1]);
+	case SMT_UDIV:    return boolector_udiv(btor, ops[0], ops[1]);
+	case SMT_SREM:    return boolector_srem(btor, ops[0], ops[1]);
+	case SMT_UREM:    return boolector_urem(btor, ops[0], ops[1]);
+	case SMT_SHL:     return logical_shift<boolector_sll>(btor, ops[0], ops[1]);
+	case SMT_LSHR:    return logical_shift<boolector_srl>(btor, ops[0], ops[1]);
+	case SMT_ASHR:    return arith_shift(btor, ops[0], ops[1]);
+	case SMT_AND:     return boolector_and(btor, ops[0], ops[1]);
+	case SMT_OR:      return boolector_or(btor, ops[0], ops[1]);
+	case SMT_XOR:     return boolector_xor(btor, ops[0], ops[1]);
+	case SMT_SADDO:   return boolector_saddo(btor, ops[0], ops[1]);
+	case SMT_UADDO:   return boolector_uaddo(btor, ops[0], ops[1]);
+	case SMT_SSUBO:   return boolector_ssubo(btor, ops[0], ops[1]);
+	case SMT_USUBO:   return boolector_usubo(btor, ops[0], ops[1]);
+	case SMT_SMULO:   return boolector_smulo(btor, ops[0], ops[1]);
+	case SMT_UMULO:   return boolector_umulo(btor, ops[0], ops[1]);
+	case SMT_SDIVO:   return boolector_sdivo(btor, ops[0], ops[1]);
+	}
 }
 
-SMTExpr SMTSolver::bvneg_overflow(SMTExpr e_) {
-	SMTExpr zero = boolector_zero(ctx, bvwidth(e));
-	SMTExpr tmp = bvssub_overflow(zero, e);
-	decref(zero);
-	return tmp;
-}
+namespace {
 
-SMTExpr SMTSolver::bvsadd_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_saddo(ctx, lhs, rhs);
-}
+class SMTBoolector : public SMTBackend {
+public:
+	explicit SMTBoolector(bool modelgen);
+	~SMTBoolector();
+
+	using SMTBackend::solve;
+	void assume(SMTExpr);
+	SMTStatus solve(SMTExpr, SMTModel *);
+	void core(SMTExpr, unsigned n, const SMTExpr *, bool *);
+	void interrupt();
+	void eval(SMTModel, SMTExpr, APInt &);
+
+private:
+	Btor *btor;
+	LGL *lgl;
+	bool modelgen;
+	volatile int interrupted;
+	// Lingeling propagations at which to stop the query under the
+	// budget, or 0.
+	int64_t limit;
+	// Set after a query under several assumptions; see core().
+	bool stale;
+	std::vector<SMTExpr> assumed;
+	// Boolector terms of translated expressions.
+	DenseMap<const SMTNode *, BtorNode *> terms;
+
+	BtorNode *term(SMTExpr e_) {
+		Btor *btor = this->btor;
+		return translateSMT(terms, e_, [btor](const SMTNode *N, BtorNode **ops) {
+			return build(btor, N, ops);
+		});
+	}
 
-SMTExpr SMTSolver::bvuadd_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_uaddo(ctx, lhs, rhs);
+	void init();
+	void fini();
+	void reset();
+	int sat();
+	static int terminate(void *);
+};
+
+} // anonymous namespace
+
+SMTBoolector::SMTBoolector(bool modelgen)
+	: modelgen(modelgen), interrupted(0), limit(0), stale(false) {
+	init();
+}
+
+SMTBoolector::~SMTBoolector() {
+	fini();
+}
+
+void SMTBoolector::init() {
+	btor = boolector_new();
+	if (modelgen || SMTSolver::abstracts())
+		boolector_enable_model_gen(btor);
+	boolector_enable_inc_usage(btor);
+	// Boolector has no public termination hook; install one on
+	// its Lingeling instance.  Disable forking so that Lingeling
+	// never solves on a clone that doesn't inherit the hook.
+	BtorAIGMgr *amgr = btor_get_aig_mgr_aigvec_mgr(btor->avmgr);
+	BtorSATMgr *smgr = btor_get_sat_mgr_aig_mgr(amgr);
+	btor_enable_lingeling_sat(smgr, NULL, 1);
+	btor_init_sat(smgr);
+	// BtorLGL starts with the LGL pointer.
+	lgl = *(LGL **)BTOR_GET_SOLVER_SAT(smgr);
+	lglseterm(lgl, terminate, this);
+}
+
+// Lingeling polls the hook every few thousand of its steps, so a
+// budget stops a query at the same point on every machine.
+int SMTBoolector::terminate(void *p) {
+	SMTBoolector *b = (SMTBoolector *)p;
+	return b->interrupted || (b->limit && lglgetprops(b->lgl) >= b->limit);
+}
+
+// Propagations are the steps the budget counts.
+int SMTBoolector::sat() {
+	unsigned long long budget = SMTTimer::budget();
+	limit = budget ? lglgetprops(lgl) + budget : 0;
+	return boolector_sat(btor);
+}
+
+void SMTBoolector::fini() {
+	for (auto &i : terms)
+		boolector_release(btor, i.second);
+	terms.clear();
+	assert(boolector_get_refs(btor) == 0);
+	boolector_delete(btor);
+}
+
+// Start afresh with the same assumptions.
+void SMTBoolector::reset() {
+	fini();
+	init();
+	for (SMTExpr a : assumed)
+		boolector_assert(btor, term(a));
+	stale = false;
+}
+
+void SMTBoolector::assume(SMTExpr e_) {
+	boolector_assert(btor, term(e_));
+	assumed.push_back(e_);
+}
+
+SMTStatus SMTBoolector::solve(SMTExpr e_, SMTModel *m_) {
+	if (stale)
+		reset();
+	BtorNode *e = term(e_);
+	if (!SMTTimer::begin(this))
+		return SMT_TIMEOUT;
+	boolector_assume(btor, e);
+	int res = sat();
+	// Only the budget or the timer stops Lingeling.
+	bool stopped = res != BOOLECTOR_SAT && res != BOOLECTOR_UNSAT;
+	if (SMTTimer::end() || (stopped && limit))
+		return SMT_TIMEOUT;
+	switch (res) {
+	default:              return SMT_UNDEF;
+	case BOOLECTOR_UNSAT: return SMT_UNSAT;
+	case BOOLECTOR_SAT:   break;
+	}
+	// The model is that of the last query.
+	if (m_)
+		*m_ = btor;
+	return SMT_SAT;
 }
 
-SMTExpr SMTSolver::bvssub_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_ssubo(ctx, lhs, rhs);
+// The SAT literal that Boolector assumed for e, or 0 if e has been
+// split into conjuncts or folded into a constant.
+static int assumed_lit(Btor *btor, BtorNode *e) {
+	e = btor_pointer_chase_simplified_exp(btor, e);
+	if (!btor_find_in_ptr_hash_table(btor->assumptions, e))
+		return 0;
+	BtorNode *real = BTOR_REAL_ADDR_NODE(e);
+	if (!real->av)
+		return 0;
+	BtorAIG *aig = real->av->aigs[0];
+	if (BTOR_IS_INVERTED_NODE(e))
+		aig = BTOR_INVERT_AIG(aig);
+	if (BTOR_IS_CONST_AIG(aig))
+		return 0;
+	return BTOR_GET_CNF_ID_AIG(aig);
+}
+
+// Boolector has no failed-assumptions API; ask Lingeling about
+// the literals it was given.  Boolector 1.5 may get later queries
+// wrong after an unsat answer under several assumptions, so the
+// instance is rebuilt before the next one.
+void SMTBoolector::core(SMTExpr e_, unsigned n, const SMTExpr *lits, bool *core) {
+	std::fill(core, core + n, true);
+	if (stale)
+		reset();
+	BtorNode *e = term(e_);
+	std::vector<BtorNode *> as(n);
+	for (unsigned i = 0; i != n; ++i)
+		as[i] = term(lits[i]);
+	if (!SMTTimer::begin(this))
+		return;
+	boolector_assume(btor, e);
+	for (unsigned i = 0; i != n; ++i)
+		boolector_assume(btor, as[i]);
+	stale = true;
+	BtorAIGMgr *amgr = btor_get_aig_mgr_aigvec_mgr(btor->avmgr);
+	BtorSATMgr *smgr = btor_get_sat_mgr_aig_mgr(amgr);
+	int calls = smgr->satcalls;
+	int res = sat();
+	if (SMTTimer::end() || res != BOOLECTOR_UNSAT)
+		return;
+	// Boolector may answer without calling Lingeling, e.g., if an
+	// assumption simplifies to false; then nothing has failed.
+	if (smgr->satcalls == calls)
+		return;
+	std::vector<bool> failed(n);
+	bool any = false;
+	for (unsigned i = 0; i != n; ++i) {
+		int lit = assumed_lit(btor, as[i]);
+		failed[i] = !lit || btor_failed_sat(smgr, lit);
+		any |= failed[i];
+	}
+	if (any)
+		std::copy(failed.begin(), failed.end(), core);
 }
 
-SMTExpr SMTSolver::bvusub_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_usubo(ctx, lhs, rhs);
+// Lingeling polls the hook; once it fires, the instance stays
+// terminated, so the backend should be discarded after a timeout.
+void SMTBoolector::interrupt() {
+	interrupted = 1;
 }
 
-SMTExpr SMTSolver::bvsmul_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_smulo(ctx, lhs, rhs);
+void SMTBoolector::eval(SMTModel m_, SMTExpr e_, APInt &v) {
+	char *s = boolector_bv_assignment(btor, term(e_));
+	std::string str(s);
+	boolector_free_bv_assignment(btor, s);
+	std::replace(str.begin(), str.end(), 'x', '0');
+	v = APInt(e_->getWidth(), str.c_str(), 2);
 }
 
-SMTExpr SMTSolver::bvumul_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_umulo(ctx, lhs, rhs);
+static SMTBackend *create(bool modelgen) {
+	return new SMTBoolector(modelgen);
 }
 
-SMTExpr SMTSolver::bvsdiv_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	return boolector_sdivo(ctx, lhs, rhs);
-}
+// The library used unless configured otherwise.
+static SMTBackendRegistration R("boolector", create, 2, true);
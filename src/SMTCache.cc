@@ -0,0 +1,212 @@
+#include "SMTCache.h"
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace llvm;
+
+static cl::opt<std::string>
+SMTCacheOpt("smt-cache",
+            cl::desc("Keep the results of SMT queries in a directory"),
+            cl::value_desc("dir"));
+
+static std::mutex Lock;
+static StringMap<SMTStatus> Memo;
+
+static uint64_t mix(uint64_t H, uint64_t V) {
+	return H ^ (V + 0x9e3779b97f4a7c15ULL + (H << 6) + (H >> 2));
+}
+
+namespace {
+
+// Serialize the DAG in a canonical order: operands of commutative
+// nodes and the assumptions are sorted by a hash of their shape,
+// which ignores variable names and creation order.  Operands of the
+// same shape, such as two variables, are told apart by their uses.
+struct SMTCanonicalizer {
+	DenseMap<const SMTNode *, uint64_t> Shapes, Ranks;
+	DenseMap<const SMTNode *, unsigned> Numbers;
+	std::string Text;
+	raw_string_ostream OS;
+
+	SMTCanonicalizer() : OS(Text) {}
+
+	uint64_t shape(const SMTNode *N) {
+		return translateSMT(Shapes, N, [](const SMTNode *X, const uint64_t *Ops) {
+			uint64_t H = mix(mix(mix(X->getOpcode(), X->getWidth()), X->getParam(0)), X->getParam(1));
+			if (X->getOpcode() == SMT_CONST) {
+				const APInt &V = X->getValue();
+				for (unsigned i = 0, n = V.getNumWords(); i != n; ++i)
+					H = mix(H, V.getRawData()[i]);
+			}
+			unsigned n = X->getNumOperands();
+			if (X->isCommutative()) {
+				H = mix(H, std::min(Ops[0], Ops[1]));
+				return mix(H, std::max(Ops[0], Ops[1]));
+			}
+			for (unsigned i = 0; i != n; ++i)
+				H = mix(H, Ops[i]);
+			return H;
+		});
+	}
+
+	// Call after shape() has seen all the roots.
+	void rank() {
+		DenseMap<const SMTNode *, uint64_t> Uses;
+		for (DenseMap<const SMTNode *, uint64_t>::iterator i = Shapes.begin(), e = Shapes.end(); i != e; ++i) {
+			const SMTNode *N = i->first;
+			bool Comm = N->isCommutative();
+			// Summed, so that the order of users does not matter.
+			for (unsigned k = 0, n = N->getNumOperands(); k != n; ++k)
+				Uses[N->getOperand(k)] += mix(i->second, Comm ? 0 : k + 1);
+		}
+		for (DenseMap<const SMTNode *, uint64_t>::iterator i = Shapes.begin(), e = Shapes.end(); i != e; ++i)
+			Ranks[i->first] = mix(i->second, Uses.lookup(i->first));
+	}
+
+	void operands(const SMTNode *N, const SMTNode **Ops) {
+		for (unsigned i = 0, n = N->getNumOperands(); i != n; ++i)
+			Ops[i] = N->getOperand(i);
+		if (N->isCommutative() && Ranks.lookup(Ops[1]) < Ranks.lookup(Ops[0]))
+			std::swap(Ops[0], Ops[1]);
+	}
+
+	// Number nodes in post-order; a variable is known by its number.
+	void emit(const SMTNode *Root) {
+		SmallVector<const SMTNode *, 64> Stack;
+		Stack.push_back(Root);
+		while (!Stack.empty()) {
+			const SMTNode *N = Stack.back();
+			if (Numbers.count(N)) {
+				Stack.pop_back();
+				continue;
+			}
+			const SMTNode *Ops[3];
+			operands(N, Ops);
+			unsigned n = N->getNumOperands();
+			bool Ready = true;
+			for (unsigned i = n; i != 0; --i) {
+				if (!Numbers.count(Ops[i - 1])) {
+					Stack.push_back(Ops[i - 1]);
+					Ready = false;
+				}
+			}
+			if (!Ready)
+				continue;
+			Stack.pop_back();
+			unsigned Num = Numbers.size();
+			Numbers[N] = Num;
+			OS << N->getOpcode() << " " << N->getWidth() << " "
+			   << N->getParam(0) << " " << N->getParam(1);
+			for (unsigned i = 0; i != n; ++i)
+				OS << " " << Numbers.lookup(Ops[i]);
+			if (N->getOpcode() == SMT_CONST) {
+				const APInt &V = N->getValue();
+				for (unsigned i = 0, e = V.getNumWords(); i != e; ++i) {
+					OS << " ";
+					OS.write_hex(V.getRawData()[i]);
+				}
+			}
+			OS << "\n";
+		}
+		OS << "root " << Numbers.lookup(Root) << "\n";
+	}
+};
+
+} // anonymous namespace
+
+std::string SMTCache::key(ArrayRef<SMTExpr> Roots) {
+	SMTCanonicalizer C;
+	SmallVector<std::pair<uint64_t, SMTExpr>, 8> Assumptions;
+	C.shape(Roots[0]);
+	for (unsigned i = 1, n = Roots.size(); i != n; ++i)
+		Assumptions.push_back(std::make_pair(C.shape(Roots[i]), Roots[i]));
+	C.rank();
+	std::stable_sort(Assumptions.begin(), Assumptions.end(),
+		[](const std::pair<uint64_t, SMTExpr> &L, const std::pair<uint64_t, SMTExpr> &R) {
+			return L.first < R.first;
+		});
+	C.emit(Roots[0]);
+	for (unsigned i = 0, n = Assumptions.size(); i != n; ++i)
+		C.emit(Assumptions[i].second);
+	MD5 Hash;
+	Hash.update(C.OS.str());
+	MD5::MD5Result Result;
+	Hash.final(Result);
+	SmallString<32> Str;
+	MD5::stringifyResult(Result, Str);
+	return std::string(Str.begin(), Str.end());
+}
+
+// Content-addressed: <dir>/<first two hex digits>/<the rest>.
+static std::string path(const std::string &Key) {
+	return SMTCacheOpt + "/" + Key.substr(0, 2) + "/" + Key.substr(2);
+}
+
+bool SMTCache::lookup(const std::string &Key, SMTStatus &Status) {
+	{
+		std::lock_guard<std::mutex> L(Lock);
+		StringMap<SMTStatus>::iterator i = Memo.find(Key);
+		if (i != Memo.end()) {
+			Status = i->second;
+			return true;
+		}
+	}
+	if (SMTCacheOpt.empty())
+		return false;
+	FILE *f = fopen(path(Key).c_str(), "r");
+	if (!f)
+		return false;
+	char buf[16] = "";
+	bool ok = fgets(buf, sizeof(buf), f) != NULL;
+	fclose(f);
+	if (!ok)
+		return false;
+	StringRef Str = StringRef(buf).rtrim();
+	if (Str == "sat")
+		Status = SMT_SAT;
+	else if (Str == "unsat")
+		Status = SMT_UNSAT;
+	else
+		return false;
+	std::lock_guard<std::mutex> L(Lock);
+	Memo[Key] = Status;
+	return true;
+}
+
+void SMTCache::insert(const std::string &Key, SMTStatus Status) {
+	if (Status != SMT_SAT && Status != SMT_UNSAT)
+		return;
+	{
+		std::lock_guard<std::mutex> L(Lock);
+		Memo[Key] = Status;
+	}
+	if (SMTCacheOpt.empty())
+		return;
+	// Concurrent runs may share the directory; write a private
+	// file and rename it into place.
+	mkdir(SMTCacheOpt.c_str(), 0777);
+	mkdir((SMTCacheOpt + "/" + Key.substr(0, 2)).c_str(), 0777);
+	std::string Path = path(Key);
+	std::string Tmp = Path + ".XXXXXX";
+	int fd = mkstemp(&Tmp[0]);
+	if (fd < 0)
+		return;
+	const char *Str = Status == SMT_SAT ? "sat\n" : "unsat\n";
+	bool ok = write(fd, Str, strlen(Str)) == (ssize_t)strlen(Str);
+	close(fd);
+	if (!ok || rename(Tmp.c_str(), Path.c_str()))
+		unlink(Tmp.c_str());
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "SMTSolver.h"
+#include <llvm/ADT/ArrayRef.h>
+#include <string>
+
+// Answers of earlier queries, shared by all solvers in the process
+// and, with -smt-cache=<dir>, by later runs.  Only SAT and UNSAT are
+// kept; a timeout may go either way next time.
+class SMTCache {
+public:
+	// Hash the query Roots[0] and the assumptions it depends on.
+	// Variables are numbered in order of appearance rather than
+	// named, so that alpha-equivalent queries, such as those from
+	// two copies of an inlined function, share a key.
+	static std::string key(llvm::ArrayRef<SMTExpr> Roots);
+	static bool lookup(const std::string &Key, SMTStatus &);
+	static void insert(const std::string &Key, SMTStatus);
+};
@@ -0,0 +1,703 @@
+#include "SMTExpr.h"
+#include "SMTSolver.h"
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/Support/Debug.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <string.h>
+
+using namespace llvm;
+
+static bool isCommutative(SMTOp Op) {
+	switch (Op) {
+	default: return false;
+	case SMT_EQ:
+	case SMT_ADD:
+	case SMT_MUL:
+	case SMT_AND:
+	case SMT_OR:
+	case SMT_XOR:
+	case SMT_SADDO:
+	case SMT_UADDO:
+	case SMT_SMULO:
+	case SMT_UMULO:
+		return true;
+	}
+}
+
+static const char *getOpcodeName(SMTOp Op) {
+	switch (Op) {
+	default:          llvm_unreachable("Unknown opcode!");
+	case SMT_ITE:     return "ite";
+	case SMT_EQ:      return "=";
+	case SMT_SLT:     return "bvslt";
+	case SMT_SLE:     return "bvsle";
+	case SMT_ULT:     return "bvult";
+	case SMT_ULE:     return "bvule";
+	case SMT_EXTRACT: return "extract";
+	case SMT_ZEXT:    return "zero_extend";
+	case SMT_SEXT:    return "sign_extend";
+	case SMT_REDAND:  return "bvredand";
+	case SMT_REDOR:   return "bvredor";
+	case SMT_NOT:     return "bvnot";
+	case SMT_NEG:     return "bvneg";
+	case SMT_ADD:     return "bvadd";
+	case SMT_SUB:     return "bvsub";
+	case SMT_MUL:     return "bvmul";
+	case SMT_SDIV:    return "bvsdiv";
+	case SMT_UDIV:    return "bvudiv";
+	case SMT_SREM:    return "bvsrem";
+	case SMT_UREM:    return "bvurem";
+	case SMT_SHL:     return "bvshl";
+	case SMT_LSHR:    return "bvlshr";
+	case SMT_ASHR:    return "bvashr";
+	case SMT_AND:     return "bvand";
+	case SMT_OR:      return "bvor";
+	case SMT_XOR:     return "bvxor";
+	case SMT_SADDO:   return "bvsaddo";
+	case SMT_UADDO:   return "bvuaddo";
+	case SMT_SSUBO:   return "bvssubo";
+	case SMT_USUBO:   return "bvusubo";
+	case SMT_SMULO:   return "bvsmulo";
+	case SMT_UMULO:   return "bvumulo";
+	case SMT_SDIVO:   return "bvsdivo";
+	}
+}
+
+bool SMTNode::isCommutative() const {
+	return ::isCommutative(Op);
+}
+
+void SMTNode::Profile(FoldingSetNodeID &ID) const {
+	ID.AddInteger(Op);
+	ID.AddInteger(Width);
+	ID.AddInteger(Params[0]);
+	ID.AddInteger(Params[1]);
+	for (unsigned i = 0; i != NumOps; ++i)
+		ID.AddPointer(Ops[i]);
+	if (Op == SMT_CONST)
+		Value.Profile(ID);
+}
+
+void SMTNode::print(raw_ostream &OS) const {
+	switch (Op) {
+	default: break;
+	case SMT_CONST:
+		OS << "(_ bv" << Value.toString(10, false) << " " << Width << ")";
+		return;
+	case SMT_VAR:
+		OS << "|" << Name << "|";
+		return;
+	case SMT_EXTRACT:
+		OS << "((_ extract " << Params[0] << " " << Params[1] << ") ";
+		Ops[0]->print(OS);
+		OS << ")";
+		return;
+	case SMT_ZEXT:
+	case SMT_SEXT:
+		OS << "((_ " << getOpcodeName(Op) << " " << Params[0] << ") ";
+		Ops[0]->print(OS);
+		OS << ")";
+		return;
+	}
+	OS << "(" << getOpcodeName(Op);
+	for (unsigned i = 0; i != NumOps; ++i) {
+		OS << " ";
+		Ops[i]->print(OS);
+	}
+	OS << ")";
+}
+
+SMTNode *SMTArena::create(SMTOp Op, unsigned Width, unsigned NumOps) {
+	SMTNode *N = new (Nodes.Allocate()) SMTNode;
+	N->Op = Op;
+	N->Width = Width;
+	N->ID = NumNodes++;
+	N->NumOps = NumOps;
+	N->Params[0] = N->Params[1] = 0;
+	N->Ops = Alloc.Allocate<const SMTNode *>(NumOps);
+	N->Name = NULL;
+	return N;
+}
+
+const SMTNode *SMTArena::constant(const APInt &Val) {
+	FoldingSetNodeID ID;
+	ID.AddInteger(SMT_CONST);
+	ID.AddInteger(Val.getBitWidth());
+	ID.AddInteger(0);
+	ID.AddInteger(0);
+	Val.Profile(ID);
+	void *InsertPos;
+	if (SMTNode *N = Uniq.FindNodeOrInsertPos(ID, InsertPos))
+		return N;
+	SMTNode *N = create(SMT_CONST, Val.getBitWidth(), 0);
+	N->Value = Val;
+	Uniq.InsertNode(N, InsertPos);
+	return N;
+}
+
+const SMTNode *SMTArena::variable(unsigned Width, const char *Name) {
+	SMTNode *N = create(SMT_VAR, Width, 0);
+	size_t Len = strlen(Name);
+	char *Dup = Alloc.Allocate<char>(Len + 1);
+	memcpy(Dup, Name, Len + 1);
+	N->Name = Dup;
+	return N;
+}
+
+const SMTNode *SMTArena::get(SMTOp Op, unsigned Width,
+                             const SMTNode *A, const SMTNode *B, const SMTNode *C,
+                             unsigned P0, unsigned P1) {
+	const SMTNode *Ops[3] = {A, B, C};
+	unsigned NumOps = C ? 3 : (B ? 2 : 1);
+	// Order the operands of commutative operators for sharing.
+	if (isCommutative(Op) && B->getID() < A->getID())
+		std::swap(Ops[0], Ops[1]);
+	FoldingSetNodeID ID;
+	ID.AddInteger(Op);
+	ID.AddInteger(Width);
+	ID.AddInteger(P0);
+	ID.AddInteger(P1);
+	for (unsigned i = 0; i != NumOps; ++i)
+		ID.AddPointer(Ops[i]);
+	void *InsertPos;
+	if (SMTNode *N = Uniq.FindNodeOrInsertPos(ID, InsertPos))
+		return N;
+	SMTNode *N = create(Op, Width, NumOps);
+	N->Params[0] = P0;
+	N->Params[1] = P1;
+	std::copy(Ops, Ops + NumOps, N->Ops);
+	Uniq.InsertNode(N, InsertPos);
+	return N;
+}
+
+// Word-level rewriting.  The builders below fold constants and
+// drop identities before a node is created, so that backends see
+// smaller formulas; e.g., a GEP scaled by a power of two becomes
+// a shift rather than a multiplier.
+
+static bool isConst(SMTExpr E) {
+	return E->getOpcode() == SMT_CONST;
+}
+
+static bool isZero(SMTExpr E) {
+	return isConst(E) && E->getValue() == 0;
+}
+
+static bool isOne(SMTExpr E) {
+	return isConst(E) && E->getValue() == 1;
+}
+
+static bool isAllOnes(SMTExpr E) {
+	return isConst(E) && E->getValue().isAllOnesValue();
+}
+
+static bool isPowerOf2(SMTExpr E) {
+	return isConst(E) && E->getValue().isPowerOf2();
+}
+
+// Is one the bitwise negation of the other?
+static bool isComplement(SMTExpr L, SMTExpr R) {
+	return (L->getOpcode() == SMT_NOT && L->getOperand(0) == R)
+	    || (R->getOpcode() == SMT_NOT && R->getOperand(0) == L);
+}
+
+static APInt shift(SMTOp Op, const APInt &L, const APInt &R) {
+	unsigned Width = L.getBitWidth();
+	uint64_t n = R.getLimitedValue(Width);
+	if (n == Width) {
+		if (Op == SMT_ASHR && L.isNegative())
+			return APInt::getAllOnesValue(Width);
+		return APInt::getNullValue(Width);
+	}
+	switch (Op) {
+	default: llvm_unreachable("Not a shift!");
+	case SMT_SHL:  return L.shl(n);
+	case SMT_LSHR: return L.lshr(n);
+	case SMT_ASHR: return L.ashr(n);
+	}
+}
+
+// Evaluate Op over constant operands.  Return false to leave the
+// node to the solver, as for division by zero.
+static bool fold(SMTOp Op, unsigned Width, SMTExpr A, SMTExpr B,
+                 unsigned P0, unsigned P1, APInt &V) {
+	const APInt &L = A->getValue();
+	const APInt &R = B ? B->getValue() : L;
+	bool Ov = false;
+	switch (Op) {
+	default: return false;
+	case SMT_EQ:      V = APInt(1, L == R); return true;
+	case SMT_SLT:     V = APInt(1, L.slt(R)); return true;
+	case SMT_SLE:     V = APInt(1, L.sle(R)); return true;
+	case SMT_ULT:     V = APInt(1, L.ult(R)); return true;
+	case SMT_ULE:     V = APInt(1, L.ule(R)); return true;
+	case SMT_EXTRACT: V = L.lshr(P1).trunc(Width); return true;
+	case SMT_ZEXT:    V = L.zext(Width); return true;
+	case SMT_SEXT:    V = L.sext(Width); return true;
+	case SMT_REDAND:  V = APInt(1, L.isAllOnesValue()); return true;
+	case SMT_REDOR:   V = APInt(1, L != 0); return true;
+	case SMT_NOT:     V = ~L; return true;
+	case SMT_NEG:     V = -L; return true;
+	case SMT_ADD:     V = L + R; return true;
+	case SMT_SUB:     V = L - R; return true;
+	case SMT_MUL:     V = L * R; return true;
+	case SMT_AND:     V = L & R; return true;
+	case SMT_OR:      V = L | R; return true;
+	case SMT_XOR:     V = L ^ R; return true;
+	case SMT_SHL:
+	case SMT_LSHR:
+	case SMT_ASHR:
+		V = shift(Op, L, R);
+		return true;
+	case SMT_SDIV:
+	case SMT_UDIV:
+	case SMT_SREM:
+	case SMT_UREM:
+		if (R == 0)
+			return false;
+		V = Op == SMT_SDIV ? L.sdiv(R) : Op == SMT_UDIV ? L.udiv(R)
+		  : Op == SMT_SREM ? L.srem(R) : L.urem(R);
+		return true;
+	case SMT_SADDO:   V = L.sadd_ov(R, Ov); break;
+	case SMT_UADDO:   V = L.uadd_ov(R, Ov); break;
+	case SMT_SSUBO:   V = L.ssub_ov(R, Ov); break;
+	case SMT_USUBO:   Ov = L.ult(R); break;
+	case SMT_SMULO:   V = L.smul_ov(R, Ov); break;
+	case SMT_UMULO:   V = L.umul_ov(R, Ov); break;
+	case SMT_SDIVO:   Ov = L.isMinSignedValue() && R.isAllOnesValue(); break;
+	}
+	V = APInt(1, Ov);
+	return true;
+}
+
+// Create a node, or a constant if all operands are constants.
+static SMTExpr make(SMTArena &Arena, SMTOp Op, unsigned Width,
+                    SMTExpr A, SMTExpr B = NULL,
+                    unsigned P0 = 0, unsigned P1 = 0) {
+	APInt V;
+	if (isConst(A) && (!B || isConst(B)) && fold(Op, Width, A, B, P0, P1, V))
+		return Arena.constant(V);
+	return Arena.get(Op, Width, A, B, NULL, P0, P1);
+}
+
+// Expression construction, shared by all backends.
+
+void SMTSolver::dump(SMTExpr E) {
+	print(E, dbgs());
+	dbgs() << "\n";
+}
+
+void SMTSolver::print(SMTExpr E, raw_ostream &OS) {
+	E->print(OS);
+}
+
+unsigned SMTSolver::bvwidth(SMTExpr E) {
+	return E->getWidth();
+}
+
+SMTExpr SMTSolver::bvfalse() {
+	return Arena.constant(APInt(1, 0));
+}
+
+SMTExpr SMTSolver::bvtrue() {
+	return Arena.constant(APInt(1, 1));
+}
+
+SMTExpr SMTSolver::bvconst(const APInt &Val) {
+	return Arena.constant(Val);
+}
+
+SMTExpr SMTSolver::bvvar(unsigned Width, const char *Name) {
+	return Arena.variable(Width, Name);
+}
+
+SMTExpr SMTSolver::ite(SMTExpr C, SMTExpr L, SMTExpr R) {
+	if (isConst(C))
+		return isOne(C) ? L : R;
+	if (L == R)
+		return L;
+	if (C->getOpcode() == SMT_NOT)
+		return ite(C->getOperand(0), R, L);
+	// Nested on the same condition.
+	if (L->getOpcode() == SMT_ITE && L->getOperand(0) == C)
+		return ite(C, L->getOperand(1), R);
+	if (R->getOpcode() == SMT_ITE && R->getOperand(0) == C)
+		return ite(C, L, R->getOperand(2));
+	if (L->getWidth() == 1 && isConst(L) && isConst(R))
+		return isOne(L) ? C : bvnot(C);
+	return Arena.get(SMT_ITE, L->getWidth(), C, L, R);
+}
+
+SMTExpr SMTSolver::eq(SMTExpr L, SMTExpr R) {
+	if (L == R)
+		return bvtrue();
+	if (isConst(L))
+		std::swap(L, R);
+	if (L->getWidth() == 1 && isConst(R) && !isConst(L))
+		return isOne(R) ? L : bvnot(L);
+	return make(Arena, SMT_EQ, 1, L, R);
+}
+
+SMTExpr SMTSolver::ne(SMTExpr L, SMTExpr R) {
+	return bvnot(eq(L, R));
+}
+
+SMTExpr SMTSolver::bvslt(SMTExpr L, SMTExpr R) {
+	if (L == R)
+		return bvfalse();
+	return make(Arena, SMT_SLT, 1, L, R);
+}
+
+SMTExpr SMTSolver::bvsle(SMTExpr L, SMTExpr R) {
+	if (L == R)
+		return bvtrue();
+	return make(Arena, SMT_SLE, 1, L, R);
+}
+
+SMTExpr SMTSolver::bvsgt(SMTExpr L, SMTExpr R) {
+	return bvslt(R, L);
+}
+
+SMTExpr SMTSolver::bvsge(SMTExpr L, SMTExpr R) {
+	return bvsle(R, L);
+}
+
+SMTExpr SMTSolver::bvult(SMTExpr L, SMTExpr R) {
+	if (L == R || isZero(R))
+		return bvfalse();
+	return make(Arena, SMT_ULT, 1, L, R);
+}
+
+SMTExpr SMTSolver::bvule(SMTExpr L, SMTExpr R) {
+	if (L == R || isZero(L) || isAllOnes(R))
+		return bvtrue();
+	return make(Arena, SMT_ULE, 1, L, R);
+}
+
+SMTExpr SMTSolver::bvugt(SMTExpr L, SMTExpr R) {
+	return bvult(R, L);
+}
+
+SMTExpr SMTSolver::bvuge(SMTExpr L, SMTExpr R) {
+	return bvule(R, L);
+}
+
+SMTExpr SMTSolver::extract(unsigned High, unsigned Low, SMTExpr E) {
+	if (Low == 0 && High + 1 == E->getWidth())
+		return E;
+	switch (E->getOpcode()) {
+	default: break;
+	case SMT_EXTRACT: {
+		unsigned Base = E->getParam(1);
+		return extract(High + Base, Low + Base, E->getOperand(0));
+	}
+	case SMT_ZEXT:
+	case SMT_SEXT:
+		// Only the original bits.
+		if (High < E->getOperand(0)->getWidth())
+			return extract(High, Low, E->getOperand(0));
+		break;
+	}
+	return make(Arena, SMT_EXTRACT, High - Low + 1, E, NULL, High, Low);
+}
+
+SMTExpr SMTSolver::zero_extend(unsigned i, SMTExpr E) {
+	if (i == 0)
+		return E;
+	return make(Arena, SMT_ZEXT, E->getWidth() + i, E, NULL, i);
+}
+
+SMTExpr SMTSolver::sign_extend(unsigned i, SMTExpr E) {
+	if (i == 0)
+		return E;
+	return make(Arena, SMT_SEXT, E->getWidth() + i, E, NULL, i);
+}
+
+SMTExpr SMTSolver::bvredand(SMTExpr E) {
+	if (E->getWidth() == 1)
+		return E;
+	return make(Arena, SMT_REDAND, 1, E);
+}
+
+SMTExpr SMTSolver::bvredor(SMTExpr E) {
+	if (E->getWidth() == 1)
+		return E;
+	return make(Arena, SMT_REDOR, 1, E);
+}
+
+SMTExpr SMTSolver::bvnot(SMTExpr E) {
+	if (E->getOpcode() == SMT_NOT)
+		return E->getOperand(0);
+	return make(Arena, SMT_NOT, E->getWidth(), E);
+}
+
+SMTExpr SMTSolver::bvneg(SMTExpr E) {
+	if (E->getOpcode() == SMT_NEG)
+		return E->getOperand(0);
+	return make(Arena, SMT_NEG, E->getWidth(), E);
+}
+
+SMTExpr SMTSolver::bvadd(SMTExpr L, SMTExpr R) {
+	if (isZero(L))
+		return R;
+	if (isZero(R))
+		return L;
+	return make(Arena, SMT_ADD, L->getWidth(), L, R);
+}
+
+SMTExpr SMTSolver::bvsub(SMTExpr L, SMTExpr R) {
+	if (L == R)
+		return bvconst(APInt::getNullValue(L->getWidth()));
+	if (isZero(R))
+		return L;
+	if (isZero(L))
+		return bvneg(R);
+	return make(Arena, SMT_SUB, L->getWidth(), L, R);
+}
+
+SMTExpr SMTSolver::bvmul(SMTExpr L, SMTExpr R) {
+	if (isConst(L))
+		std::swap(L, R);
+	if (isZero(R))
+		return R;
+	if (isOne(R))
+		return L;
+	// x * 2^k => x << k.
+	if (isPowerOf2(R) && !isConst(L)) {
+		unsigned Width = L->getWidth();
+		return bvshl(L, bvconst(APInt(Width, R->getValue().logBase2())));
+	}
+	return make(Arena, SMT_MUL, L->getWidth(), L, R);
+}
+
+SMTExpr SMTSolver::bvsdiv(SMTExpr L, SMTExpr R) {
+	if (isOne(R))
+		return L;
+	return make(Arena, SMT_SDIV, L->getWidth(), L, R);
+}
+
+SMTExpr SMTSolver::bvudiv(SMTExpr L, SMTExpr R) {
+	// x / 2^k => x >> k.
+	if (isPowerOf2(R) && !isConst(L)) {
+		unsigned Width = L->getWidth();
+		return bvlshr(L, bvconst(APInt(Width, R->getValue().logBase2())));
+	}
+	return make(Arena, SMT_UDIV, L->getWidth(), L, R);
+}
+
+SMTExpr SMTSolver::bvsrem(SMTExpr L, SMTExpr R) {
+	if (isOne(R))
+		return bvconst(APInt::getNullValue(L->getWidth()));
+	return make(Arena, SMT_SREM, L->getWidth(), L, R);
+}
+
+SMTExpr SMTSolver::bvurem(SMTExpr L, SMTExpr R) {
+	// x % 2^k => x & (2^k - 1).
+	if (isPowerOf2(R) && !isConst(L))
+		return bvand(L, bvconst(R->getValue() - 1));
+	return make(Arena, SMT_UREM, L->getWidth(), L, R);
+}
+
+SMTExpr SMTSolver::bvshl(SMTExpr L, SMTExpr R) {
+	if (isZero(L) || isZero(R))
+		return L;
+	return make(Arena, SMT_SHL, L->getWidth(), L, R);
+}
+
+SMTExpr SMTSolver::bvlshr(SMTExpr L, SMTExpr R) {
+	if (isZero(L) || isZero(R))
+		return L;
+	return make(Arena, SMT_LSHR, L->getWidth(), L, R);
+}
+
+SMTExpr SMTSolver::bvashr(SMTExpr L, SMTExpr R) {
+	if (isZero(L) || isAllOnes(L) || isZero(R))
+		return L;
+	return make(Arena, SMT_ASHR, L->getWidth(), L, R);
+}
+
+SMTExpr SMTSolver::bvand(SMTExpr L, SMTExpr R) {
+	if (L == R || isZero(L) || isAllOnes(R))
+		return L;
+	if (isZero(R) || isAllOnes(L))
+		return R;
+	if (isComplement(L, R))
+		return bvconst(APInt::getNullValue(L->getWidth()));
+	return make(Arena, SMT_AND, L->getWidth(), L, R);
+}
+
+SMTExpr SMTSolver::bvor(SMTExpr L, SMTExpr R) {
+	if (L == R || isAllOnes(L) || isZero(R))
+		return L;
+	if (isAllOnes(R) || isZero(L))
+		return R;
+	if (isComplement(L, R))
+		return bvconst(APInt::getAllOnesValue(L->getWidth()));
+	return make(Arena, SMT_OR, L->getWidth(), L, R);
+}
+
+SMTExpr SMTSolver::bvxor(SMTExpr L, SMTExpr R) {
+	if (L == R)
+		return bvconst(APInt::getNullValue(L->getWidth()));
+	if (isConst(L))
+		std::swap(L, R);
+	if (isZero(R))
+		return L;
+	if (isAllOnes(R))
+		return bvnot(L);
+	return make(Arena, SMT_XOR, L->getWidth(), L, R);
+}
+
+SMTExpr SMTSolver::bvneg_overflow(SMTExpr E) {
+	return bvssub_overflow(bvconst(APInt::getNullValue(E->getWidth())), E);
+}
+
+SMTExpr SMTSolver::bvsadd_overflow(SMTExpr L, SMTExpr R) {
+	if (isZero(L) || isZero(R))
+		return bvfalse();
+	return make(Arena, SMT_SADDO, 1, L, R);
+}
+
+SMTExpr SMTSolver::bvuadd_overflow(SMTExpr L, SMTExpr R) {
+	if (isZero(L) || isZero(R))
+		return bvfalse();
+	return make(Arena, SMT_UADDO, 1, L, R);
+}
+
+SMTExpr SMTSolver::bvssub_overflow(SMTExpr L, SMTExpr R) {
+	if (L == R || isZero(R))
+		return bvfalse();
+	return make(Arena, SMT_SSUBO, 1, L, R);
+}
+
+SMTExpr SMTSolver::bvusub_overflow(SMTExpr L, SMTExpr R) {
+	if (L == R || isZero(R))
+		return bvfalse();
+	return make(Arena, SMT_USUBO, 1, L, R);
+}
+
+SMTExpr SMTSolver::bvsmul_overflow(SMTExpr L, SMTExpr R) {
+	if (isZero(L) || isZero(R))
+		return bvfalse();
+	// A 1-bit 1 is -1, and -1 * -1 overflows.
+	if (L->getWidth() > 1 && (isOne(L) || isOne(R)))
+		return bvfalse();
+	return make(Arena, SMT_SMULO, 1, L, R);
+}
+
+SMTExpr SMTSolver::bvumul_overflow(SMTExpr L, SMTExpr R) {
+	if (isZero(L) || isZero(R) || isOne(L) || isOne(R))
+		return bvfalse();
+	return make(Arena, SMT_UMULO, 1, L, R);
+}
+
+SMTExpr SMTSolver::bvsdiv_overflow(SMTExpr L, SMTExpr R) {
+	// Only INT_MIN / -1 overflows.
+	if (isConst(L) && !L->getValue().isMinSignedValue())
+		return bvfalse();
+	if (isConst(R) && !R->getValue().isAllOnesValue())
+		return bvfalse();
+	return make(Arena, SMT_SDIVO, 1, L, R);
+}
+
+// Apply the rewrites above to N with new operands.
+SMTExpr SMTSolver::rebuild(const SMTNode *N, const SMTExpr *Ops) {
+	switch (N->getOpcode()) {
+	default:          llvm_unreachable("Unknown opcode!");
+	case SMT_CONST:
+	case SMT_VAR:     return N;
+	case SMT_ITE:     return ite(Ops[0], Ops[1], Ops[2]);
+	case SMT_EQ:      return eq(Ops[0], Ops[1]);
+	case SMT_SLT:     return bvslt(Ops[0], Ops[1]);
+	case SMT_SLE:     return bvsle(Ops[0], Ops[1]);
+	case SMT_ULT:     return bvult(Ops[0], Ops[1]);
+	case SMT_ULE:     return bvule(Ops[0], Ops[1]);
+	case SMT_EXTRACT: return extract(N->getParam(0), N->getParam(1), Ops[0]);
+	case SMT_ZEXT:    return zero_extend(N->getParam(0), Ops[0]);
+	case SMT_SEXT:    return sign_extend(N->getParam(0), Ops[0]);
+	case SMT_REDAND:  return bvredand(Ops[0]);
+	case SMT_REDOR:   return bvredor(Ops[0]);
+	case SMT_NOT:     return bvnot(Ops[0]);
+	case SMT_NEG:     return bvneg(Ops[0]);
+	case SMT_ADD:     return bvadd(Ops[0], Ops[1]);
+	case SMT_SUB:     return bvsub(Ops[0], Ops[1]);
+	case SMT_MUL:     return bvmul(Ops[0], Ops[1]);
+	case SMT_SDIV:    return bvsdiv(Ops[0], Ops[1]);
+	case SMT_UDIV:    return bvudiv(Ops[0], Ops[1]);
+	case SMT_SREM:    return bvsrem(Ops[0], Ops[1]);
+	case SMT_UREM:    return bvurem(Ops[0], Ops[1]);
+	case SMT_SHL:     return bvshl(Ops[0], Ops[1]);
+	case SMT_LSHR:    return bvlshr(Ops[0], Ops[1]);
+	case SMT_ASHR:    return bvashr(Ops[0], Ops[1]);
+	case SMT_AND:     return bvand(Ops[0], Ops[1]);
+	case SMT_OR:      return bvor(Ops[0], Ops[1]);
+	case SMT_XOR:     return bvxor(Ops[0], Ops[1]);
+	case SMT_SADDO:   return bvsadd_overflow(Ops[0], Ops[1]);
+	case SMT_UADDO:   return bvuadd_overflow(Ops[0], Ops[1]);
+	case SMT_SSUBO:   return bvssub_overflow(Ops[0], Ops[1]);
+	case SMT_USUBO:   return bvusub_overflow(Ops[0], Ops[1]);
+	case SMT_SMULO:   return bvsmul_overflow(Ops[0], Ops[1]);
+	case SMT_UMULO:   return bvumul_overflow(Ops[0], Ops[1]);
+	case SMT_SDIVO:   return bvsdiv_overflow(Ops[0], Ops[1]);
+	}
+}
+
+// Equality propagation.  A top-level conjunct T = C with C constant
+// lets the other conjuncts use C in place of T; so does a 1-bit
+// conjunct T (T = 1) or its negation (T = 0).  The conjuncts that
+// define the substitution are kept, so models stay complete.
+SMTExpr SMTSolver::simplify(SMTExpr E) {
+	SmallVector<SMTExpr, 16> Conjuncts, Stack;
+	SmallPtrSet<SMTExpr, 16> Visited;
+	Stack.push_back(E);
+	while (!Stack.empty()) {
+		SMTExpr X = Stack.pop_back_val();
+		if (Visited.count(X))
+			continue;
+		Visited.insert(X);
+		if (X->getOpcode() == SMT_AND && X->getWidth() == 1) {
+			Stack.push_back(X->getOperand(0));
+			Stack.push_back(X->getOperand(1));
+			continue;
+		}
+		Conjuncts.push_back(X);
+	}
+	DenseMap<const SMTNode *, SMTExpr> Subst;
+	SmallPtrSet<SMTExpr, 16> Defs;
+	for (unsigned i = 0, n = Conjuncts.size(); i != n; ++i) {
+		SMTExpr C = Conjuncts[i], T = C, V = bvtrue();
+		if (C->getOpcode() == SMT_NOT) {
+			T = C->getOperand(0);
+			V = bvfalse();
+		} else if (C->getOpcode() == SMT_EQ) {
+			T = C->getOperand(0);
+			V = C->getOperand(1);
+			if (isConst(T))
+				std::swap(T, V);
+			if (!isConst(V))
+				continue;
+		}
+		if (isConst(T))
+			continue;
+		std::pair<DenseMap<const SMTNode *, SMTExpr>::iterator, bool> Res =
+			Subst.insert(std::make_pair(T, V));
+		// T = C1 and T = C2.
+		if (!Res.second && Res.first->second != V)
+			return bvfalse();
+		Defs.insert(C);
+	}
+	if (Subst.empty())
+		return E;
+	DenseMap<const SMTNode *, SMTExpr> Memo(Subst);
+	SMTExpr Result = bvtrue();
+	for (unsigned i = 0, n = Conjuncts.size(); i != n; ++i) {
+		SMTExpr C = Conjuncts[i];
+		if (!Defs.count(C))
+			C = translateSMT(Memo, C, [this](const SMTNode *N, const SMTExpr *Ops) {
+				return rebuild(N, Ops);
+			});
+		Result = bvand(Result, C);
+	}
+	return Result;
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <llvm/ADT/APInt.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/FoldingSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/Allocator.h>
+
+namespace llvm {
+	class raw_ostream;
+} // namespace llvm
+
+// Bit-vector expressions, independent of the solver backend.
+// Booleans are 1-bit vectors.  Comparisons and overflow checks
+// yield 1 bit; sgt, sge, ugt, uge and ne are rewritten in terms
+// of the others.
+enum SMTOp {
+	SMT_CONST,
+	SMT_VAR,
+	SMT_ITE,
+	SMT_EQ,
+	SMT_SLT,
+	SMT_SLE,
+	SMT_ULT,
+	SMT_ULE,
+	SMT_EXTRACT,
+	SMT_ZEXT,
+	SMT_SEXT,
+	SMT_REDAND,
+	SMT_REDOR,
+	SMT_NOT,
+	SMT_NEG,
+	SMT_ADD,
+	SMT_SUB,
+	SMT_MUL,
+	SMT_SDIV,
+	SMT_UDIV,
+	SMT_SREM,
+	SMT_UREM,
+	SMT_SHL,
+	SMT_LSHR,
+	SMT_ASHR,
+	SMT_AND,
+	SMT_OR,
+	SMT_XOR,
+	SMT_SADDO,
+	SMT_UADDO,
+	SMT_SSUBO,
+	SMT_USUBO,
+	SMT_SMULO,
+	SMT_UMULO,
+	SMT_SDIVO,
+};
+
+class SMTNode : public llvm::FoldingSetNode {
+public:
+	SMTOp getOpcode() const { return Op; }
+	unsigned getWidth() const { return Width; }
+	// Nodes are numbered in order of creation, so operands
+	// always have smaller IDs than their users.
+	unsigned getID() const { return ID; }
+	unsigned getNumOperands() const { return NumOps; }
+	bool isCommutative() const;
+	const SMTNode *getOperand(unsigned i) const { return Ops[i]; }
+	// The high and low bits of SMT_EXTRACT, or the number of
+	// bits added by SMT_ZEXT and SMT_SEXT.
+	unsigned getParam(unsigned i) const { return Params[i]; }
+	// SMT_CONST only.
+	const llvm::APInt &getValue() const { return Value; }
+	// SMT_VAR only.
+	const char *getName() const { return Name; }
+
+	void Profile(llvm::FoldingSetNodeID &) const;
+	// Print in SMT-LIB syntax, expanding shared nodes.
+	void print(llvm::raw_ostream &) const;
+
+private:
+	friend class SMTArena;
+	SMTOp Op;
+	unsigned Width;
+	unsigned ID;
+	unsigned NumOps;
+	unsigned Params[2];
+	const SMTNode **Ops;
+	const char *Name;
+	llvm::APInt Value;
+};
+
+// Owns the nodes of one solver and hash-conses them, so that
+// structurally equal expressions are the same pointer.  Nodes
+// live as long as the arena; there is no reference counting.
+class SMTArena {
+public:
+	SMTArena() : NumNodes(0) {}
+
+	const SMTNode *constant(const llvm::APInt &);
+	// Each call makes a distinct variable, even for the same name.
+	const SMTNode *variable(unsigned Width, const char *Name);
+	const SMTNode *get(SMTOp, unsigned Width,
+	                   const SMTNode *, const SMTNode * = NULL, const SMTNode * = NULL,
+	                   unsigned P0 = 0, unsigned P1 = 0);
+
+	unsigned size() const { return NumNodes; }
+
+private:
+	llvm::BumpPtrAllocator Alloc;
+	llvm::SpecificBumpPtrAllocator<SMTNode> Nodes;
+	llvm::FoldingSet<SMTNode> Uniq;
+	unsigned NumNodes;
+
+	SMTNode *create(SMTOp, unsigned Width, unsigned NumOps);
+};
+
+// Translate the DAG rooted at N into backend terms bottom-up,
+// without recursion.  Build(N, Ops) returns the term for N given
+// the terms of its operands; Memo maps translated nodes to terms
+// and carries over between calls.
+template <typename T, typename BuildT>
+T translateSMT(llvm::DenseMap<const SMTNode *, T> &Memo, const SMTNode *N, BuildT Build) {
+	typename llvm::DenseMap<const SMTNode *, T>::iterator i = Memo.find(N);
+	if (i != Memo.end())
+		return i->second;
+	llvm::SmallVector<const SMTNode *, 64> Stack;
+	Stack.push_back(N);
+	while (!Stack.empty()) {
+		const SMTNode *X = Stack.back();
+		if (Memo.count(X)) {
+			Stack.pop_back();
+			continue;
+		}
+		bool Ready = true;
+		for (unsigned k = 0, n = X->getNumOperands(); k != n; ++k) {
+			if (!Memo.count(X->getOperand(k))) {
+				Stack.push_back(X->getOperand(k));
+				Ready = false;
+			}
+		}
+		if (!Ready)
+			continue;
+		Stack.pop_back();
+		T Ops[3];
+		for (unsigned k = 0, n = X->getNumOperands(); k != n; ++k)
+			Ops[k] = Memo.lookup(X->getOperand(k));
+		T Term = Build(X, Ops);
+		Memo[X] = Term;
+	}
+	return Memo.lookup(N);
+}
@@ -1,389 +1,536 @@
 #include "config.h"
 #include "SMTSolver.h"
 #include <llvm/ADT/APInt.h>
+#include <llvm/ADT/DenseMap.h>
 #include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringMap.h>
 #include <llvm/Support/Allocator.h>
+#include <llvm/Support/CommandLine.h>
 #include <llvm/Support/Debug.h>
+#include <llvm/Support/ErrorHandling.h>
 #include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
 #include <sys/wait.h>
 #include <err.h>
+#include <errno.h>
+#include <signal.h>
 #include <stdarg.h>
-#include <termios.h>
 #include <unistd.h>
 
-extern "C" int forkpty(int *amaster, char *name, struct termios *termp, struct winsize *winp);
-
 using namespace llvm;
 
-struct SMTExprImpl {
-	unsigned width;
-	const char *data;
-};
-
-class SMTContextImpl {
-public:
-	SMTExprImpl *bvtrue;
-	SMTExprImpl *bvfalse;
-	pid_t pid;
-	FILE *fp;
-
-	explicit SMTContextImpl(pid_t pid, int fd) : pid(pid) {
-		fp = fdopen(fd, "r+");
-		setbuf(fp, NULL);
-		bvtrue = newexpr(1, "(_ bv1 1)");
-		bvfalse = newexpr(1, "(_ bv0 1)");
-	}
-
-	~SMTContextImpl() {
-		fclose(fp);
-		int status;
-		waitpid(pid, &status, 0);
-	}
-
-	void write(const char *fmt, ...) {
-		va_list args;
-		va_start(args, fmt);
-		vfprintf(fp, fmt, args);
-		va_end(args);
-	}
-
-	void readline(char *buf, size_t len) {
-		if (!fgets(buf, len, fp))
-			errx(1, "fgets");
-	} 
-
-	SMTExprImpl *newexpr(unsigned width, const char *data, size_t len) {
-		char *dup = (char *)alloc.Allocate(len + 1, AlignOf<char>::Alignment);
-		memcpy(dup, data, len);
-		dup[len] = 0;
-		SMTExprImpl *e_ = alloc.Allocate<SMTExprImpl>();
-		e_->width = width;
-		e_->data = static_cast<const char *>(dup);
-		return e_;
-	}
-
-	SMTExprImpl *newexpr(unsigned width, const char *s) {
-		return newexpr(width, s, strlen(s));
-	}
-
-	SMTExprImpl *newexpr(unsigned width, StringRef s) {
-		return newexpr(width, s.data(), s.size());
-	}
-
-	SMTExprImpl *bv2bool(SMTExprImpl *e_) {
-		std::string s = "(= " + std::string(e_->data) + " (_ bv1 1))";
-		return newexpr(1, s);
-	}
-	
-	SMTExprImpl *bool2bv(SMTExprImpl *e_) {
-		std::string s = "(ite " + std::string(e_->data) + " (_ bv1 1) (_ bv0 1))";
-		return newexpr(1, s);
-	}
-
-	SMTExprImpl *uniop(const std::string &op, unsigned width, SMTExprImpl *e_) {
-		std::string s = "(" + op + " " + e_->data + ")";
-		return newexpr(width, s);
-	}
-	
-	SMTExprImpl *binop(const std::string &op, unsigned width, SMTExprImpl *lhs_, SMTExprImpl *rhs_) {
-		std::string s = "(" + op + " " + lhs_->data + " " + rhs_->data + ")";
-		return newexpr(width, s);
-	}
-	
-	SMTExprImpl *triop(const std::string &op, unsigned width, SMTExprImpl *e_, SMTExprImpl *lhs_, SMTExprImpl *rhs_) {
-		std::string s = "(" + op + " " + e_->data + " " + lhs_->data + " " + rhs_->data + ")";
-		return newexpr(width, s);
-	}
+static cl::opt<unsigned>
+SMTLIBPoolOpt("smtlib-pool",
+              cl::desc("Number of idle SMT-LIB solvers to keep for reuse"),
+              cl::init(1));
 
-	SMTExprImpl *newint(const APInt &Val) {
-		unsigned w = Val.getBitWidth();
-		std::string s = "(_ bv" + Val.toString(10, false) + " " + utostr(w) + ")";
-		return newexpr(w, s);
-	}
+// A healthy solver answers a ping at once.
+#define PING_TIMEOUT 1000
 
-private:
-	BumpPtrAllocator alloc;
+// A solver child process, talking over a socket.
+struct SMTProcess {
+	pid_t pid;
+	int fd;
 };
 
-#define ctx ((SMTContextImpl *)ctx_)
-#define e   ((SMTExprImpl *)e_)
-#define lhs ((SMTExprImpl *)lhs_)
-#define rhs ((SMTExprImpl *)rhs_)
-
-SMTSolver::SMTSolver(bool modelgen) {
+static SMTProcess spawn() {
 	const char *cmd = getenv("SMTLIB");
 	if (!cmd)
 		cmd = SMTLIB;
-	int fd;
-	pid_t pid = forkpty(&fd, NULL, NULL, NULL);
+	// Let the solver replace the shell, so that its CPU time
+	// is charged to the timer.
+	std::string line = std::string("exec ") + cmd;
+	// The solver must flush each answer, as interactive solvers do.
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv))
+		err(1, "socketpair");
+	pid_t pid = fork();
 	if (pid < 0)
-		err(1, "forkpty");
+		err(1, "fork");
 	if (pid == 0) {
-		execl("/bin/sh", "sh", "-c", cmd, NULL);
+		dup2(sv[1], STDIN_FILENO);
+		dup2(sv[1], STDOUT_FILENO);
+		dup2(sv[1], STDERR_FILENO);
+		execl("/bin/sh", "sh", "-c", line.c_str(), NULL);
 		err(1, "execl");
 	}
-	// Disable echo.
-	struct termios term = {0};
-	if (tcgetattr(fd, &term))
-		err(1, "tcgetattr");
-	term.c_lflag &= ~(ECHO | ECHOE | ECHOK | ECHONL | ICANON);
-	term.c_oflag &= ~(ONLCR);
-	if (tcsetattr(fd, TCSANOW, &term))
-		err(1, "tcsetattr");
-	ctx_ = new SMTContextImpl(pid, fd);
-	ctx->write("(set-option :print-success false)\n");
+	close(sv[1]);
+	SMTProcess p = {pid, sv[0]};
+	return p;
 }
 
-SMTSolver::~SMTSolver() {
-	delete ctx;
+static void discard(SMTProcess p) {
+	kill(p.pid, SIGKILL);
+	close(p.fd);
+	int status;
+	waitpid(p.pid, &status, 0);
 }
 
-void SMTSolver::assume(SMTExpr e_) {
-	ctx->write("(assert %s)\n", ctx->bv2bool(e)->data);
-}
-
-SMTStatus SMTSolver::query(SMTExpr e_, SMTModel *m_) {
-	ctx->write("(push 1)\n");
-	assume(e);
-	ctx->write("(check-sat)\n");
-	char buf[16];
-	ctx->readline(buf, sizeof(buf));
-	ctx->write("(pop 1)\n");
-	StringRef status = StringRef(buf).rtrim();
-	if (status == "unsat")
-		return SMT_UNSAT;
-	if (status == "sat")
-		return SMT_SAT;
-	dbgs() << "[SMTLIB] unknown response: " << status << "\n";
-	return SMT_UNDEF;
-}
-
-void SMTSolver::eval(SMTModel, SMTExpr, APInt &) {
-}
-
-void SMTSolver::release(SMTModel) {}
-
-void SMTSolver::dump(SMTExpr e_) {
-	print(e, dbgs());
-	dbgs() << "\n";
-}
-
-void SMTSolver::print(SMTExpr e_, raw_ostream &OS) {
-	// TODO
-}
-
-// Managed by BumpPtrAllocator.
-void SMTSolver::incref(SMTExpr e_) {}
-void SMTSolver::decref(SMTExpr e_) {}
-
-unsigned SMTSolver::bvwidth(SMTExpr e_) {
-	return e->width;
-}
-
-SMTExpr SMTSolver::bvfalse() {
-	return ctx->bvfalse;
-}
-
-SMTExpr SMTSolver::bvtrue() {
-	return ctx->bvtrue;
-}
-
-SMTExpr SMTSolver::bvconst(const APInt &Val) {
-	return ctx->newint(Val);
-}
-
-SMTExpr SMTSolver::bvvar(unsigned width, const char *name) {
-	ctx->write("(declare-fun %s () (_ BitVec %u))\n", name, width);
-	return ctx->newexpr(width, name);;
-}
-
-SMTExpr SMTSolver::ite(SMTExpr e_, SMTExpr lhs_, SMTExpr rhs_) {
-	return ctx->triop("ite", lhs->width, ctx->bv2bool(e), lhs, rhs);
-}
-
-SMTExpr SMTSolver::eq(SMTExpr lhs_, SMTExpr rhs_) {
-	return ctx->bool2bv(ctx->binop("=", 1, lhs, rhs));
-}
-
-SMTExpr SMTSolver::ne(SMTExpr lhs_, SMTExpr rhs_) {
-	return bvnot(eq(lhs_, rhs_));
-}
-
-SMTExpr SMTSolver::bvslt(SMTExpr lhs_, SMTExpr rhs_) {
-	return ctx->bool2bv(ctx->binop("bvslt", 1, lhs, rhs));
-}
-
-SMTExpr SMTSolver::bvsle(SMTExpr lhs_, SMTExpr rhs_) {
-	return ctx->bool2bv(ctx->binop("bvsle", 1, lhs, rhs));
-}
-
-SMTExpr SMTSolver::bvsgt(SMTExpr lhs_, SMTExpr rhs_) {
-	return ctx->bool2bv(ctx->binop("bvsgt", 1, lhs, rhs));
-}
-
-SMTExpr SMTSolver::bvsge(SMTExpr lhs_, SMTExpr rhs_) {
-	return ctx->bool2bv(ctx->binop("bvsge", 1, lhs, rhs));
-}
+// Solvers wiped by (reset) after use, kept for later SMTSolver
+// instances so as to save a shell and solver startup for each.
+class SMTPool {
+public:
+	static SMTPool &get() {
+		static SMTPool Pool;
+		return Pool;
+	}
 
-SMTExpr SMTSolver::bvult(SMTExpr lhs_, SMTExpr rhs_) {
-	return ctx->bool2bv(ctx->binop("bvult", 1, lhs, rhs));
-}
+	~SMTPool() {
+		for (SMTProcess p : Idle)
+			discard(p);
+	}
 
-SMTExpr SMTSolver::bvule(SMTExpr lhs_, SMTExpr rhs_) {
-	return ctx->bool2bv(ctx->binop("bvule", 1, lhs, rhs));
-}
+	SMTProcess acquire() {
+		std::unique_lock<std::mutex> L(Lock);
+		while (!Idle.empty()) {
+			SMTProcess p = Idle.back();
+			Idle.pop_back();
+			// Skip solvers that died while idle.
+			int status;
+			if (waitpid(p.pid, &status, WNOHANG) == 0)
+				return p;
+			close(p.fd);
+		}
+		L.unlock();
+		return spawn();
+	}
 
-SMTExpr SMTSolver::bvugt(SMTExpr lhs_, SMTExpr rhs_) {
-	return ctx->bool2bv(ctx->binop("bvugt", 1, lhs, rhs));
-}
+	void release(SMTProcess p) {
+		{
+			std::lock_guard<std::mutex> L(Lock);
+			if (Idle.size() < SMTLIBPoolOpt) {
+				Idle.push_back(p);
+				return;
+			}
+		}
+		discard(p);
+	}
 
-SMTExpr SMTSolver::bvuge(SMTExpr lhs_, SMTExpr rhs_) {
-	return ctx->bool2bv(ctx->binop("bvuge", 1, lhs, rhs));
-}
+private:
+	std::mutex Lock;
+	std::vector<SMTProcess> Idle;
+};
 
-SMTExpr SMTSolver::extract(unsigned high, unsigned low, SMTExpr e_) {
-	std::string op = "(_ extract " + utostr(high) + " " + utostr(low) + ")";
-	return ctx->uniop(op, high - low + 1, e);
-}
+class SMTLIBContext {
+public:
+	pid_t pid;
+	int fd;
+	// Number of activation literals.
+	unsigned nact;
+	// Number of declarations of each name.
+	StringMap<unsigned> names;
+	// Text of translated expressions: a constant, or the name of
+	// a variable or of a define-fun for a compound expression.
+	DenseMap<const SMTNode *, const char *> terms;
+
+	explicit SMTLIBContext(SMTProcess p) : pid(p.pid), fd(p.fd), nact(0), rpos(0), rlen(0), nterms(0) {
+		write("(set-option :print-success false)\n");
+		// For unsatCore(); a solver without it may complain, so
+		// wait for the answer to stay in sync.
+		write("(set-option :produce-unsat-assumptions true)\n(echo \"ok\")\n");
+		ping();
+	}
 
-SMTExpr SMTSolver::zero_extend(unsigned i, SMTExpr e_) {
-	std::string op = "(_ zero_extend " + utostr(i) + ")";
-	return ctx->uniop(op, e->width + i, e);
-}
+	// Return the solver to the pool if it survives a reset;
+	// one killed on timeout or hung is replaced.
+	~SMTLIBContext() {
+		SMTProcess p = {pid, fd};
+		write("(reset)\n(echo \"ok\")\n");
+		if (ping())
+			SMTPool::get().release(p);
+		else
+			discard(p);
+	}
 
-SMTExpr SMTSolver::sign_extend(unsigned i, SMTExpr e_) {
-	std::string op = "(_ sign_extend " + utostr(i) + ")";
-	return ctx->uniop(op, e->width + i, e);
-}
+	bool ping() {
+		char buf[4096];
+		// Skip any "success" printed before options are set,
+		// or an error about an unsupported one.
+		for (int i = 0; i != 4; ++i) {
+			if (!readline(buf, sizeof(buf), PING_TIMEOUT))
+				return false;
+			StringRef s = StringRef(buf).trim().trim('"');
+			if (s == "ok")
+				return rpos == rlen;
+		}
+		return false;
+	}
 
-SMTExpr SMTSolver::bvredand(SMTExpr e_) {
-	SMTExprImpl *umax = ctx->newint(APInt::getAllOnesValue(e->width));
-	return ctx->binop("bvcomp", 1, e, umax);
-}
+	// Commands are buffered until an answer is needed.
+	void write(const char *fmt, ...) {
+		va_list args, copy;
+		va_start(args, fmt);
+		va_copy(copy, args);
+		size_t len = wbuf.size();
+		int n = vsnprintf(NULL, 0, fmt, args);
+		wbuf.resize(len + n + 1);
+		vsnprintf(&wbuf[len], n + 1, fmt, copy);
+		wbuf.resize(len + n);
+		va_end(copy);
+		va_end(args);
+		if (wbuf.size() >= WBUF_SIZE)
+			flush();
+	}
 
-SMTExpr SMTSolver::bvredor(SMTExpr e_) {
-	SMTExprImpl *zero = ctx->newint(APInt::getNullValue(e->width));
-	return bvnot(ctx->binop("bvcomp", 1, e, zero));
-}
+	// A dead solver shows up as a failed read.
+	void flush() {
+		const char *p = wbuf.data();
+		size_t n = wbuf.size();
+		while (n) {
+			ssize_t r = send(fd, p, n, MSG_NOSIGNAL);
+			if (r < 0) {
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+			p += r;
+			n -= r;
+		}
+		wbuf.clear();
+	}
 
-SMTExpr SMTSolver::bvnot(SMTExpr e_) {
-	return ctx->uniop("bvnot", e->width, e);
-}
+	// Give up after ms milliseconds without input, unless ms < 0.
+	bool readline(char *buf, size_t len, int ms = -1) {
+		flush();
+		size_t i = 0;
+		while (i + 1 < len) {
+			if (rpos == rlen) {
+				if (ms >= 0) {
+					struct pollfd pfd = {fd, POLLIN, 0};
+					if (poll(&pfd, 1, ms) <= 0)
+						return false;
+				}
+				ssize_t r = recv(fd, rbuf, sizeof(rbuf), 0);
+				if (r < 0 && errno == EINTR)
+					continue;
+				if (r <= 0)
+					return false;
+				rpos = 0;
+				rlen = r;
+			}
+			char c = rbuf[rpos++];
+			buf[i++] = c;
+			if (c == '\n')
+				break;
+		}
+		buf[i] = 0;
+		return true;
+	}
 
-SMTExpr SMTSolver::bvneg(SMTExpr e_) {
-	return ctx->uniop("bvneg", e->width, e);
-}
+	// Read an s-expression, which may span lines, or an atom.
+	bool readsexp(std::string &s) {
+		char buf[4096];
+		int depth = 0;
+		bool open = false, quoted = false;
+		do {
+			if (!readline(buf, sizeof(buf)))
+				return false;
+			if (!open && StringRef(buf).trim().empty())
+				continue;
+			s += buf;
+			for (const char *p = buf; *p; ++p) {
+				if (*p == '"')
+					quoted = !quoted;
+				else if (quoted)
+					continue;
+				else if (*p == '(')
+					++depth, open = true;
+				else if (*p == ')')
+					--depth;
+			}
+		} while (open && depth > 0);
+		return true;
+	}
 
-SMTExpr SMTSolver::bvadd(SMTExpr lhs_, SMTExpr rhs_) {
-	return ctx->binop("bvadd", lhs->width, lhs, rhs);
-}
+	const char *term(SMTExpr e_) {
+		return translateSMT(terms, e_, [this](const SMTNode *N, const char **ops) {
+			return build(N, ops);
+		});
+	}
 
-SMTExpr SMTSolver::bvsub(SMTExpr lhs_, SMTExpr rhs_) {
-	return ctx->binop("bvsub", lhs->width, lhs, rhs);
-}
+	// Boolean terms are not named; they only appear inline.
+	std::string bv2bool(const char *s) {
+		return "(= " + std::string(s) + " (_ bv1 1))";
+	}
 
-SMTExpr SMTSolver::bvmul(SMTExpr lhs_, SMTExpr rhs_) {
-	return ctx->binop("bvmul", lhs->width, lhs, rhs);
-}
+private:
+	const char *save(StringRef s) {
+		char *dup = alloc.Allocate<char>(s.size() + 1);
+		memcpy(dup, s.data(), s.size());
+		dup[s.size()] = 0;
+		return dup;
+	}
 
-SMTExpr SMTSolver::bvsdiv(SMTExpr lhs_, SMTExpr rhs_) {
-	return ctx->binop("bvsdiv", lhs->width, lhs, rhs);
-}
+	const char *define(unsigned width, const std::string &s) {
+		std::string name = "t!" + utostr(nterms++);
+		write("(define-fun %s () (_ BitVec %u) %s)\n", name.c_str(), width, s.c_str());
+		return save(name);
+	}
 
-SMTExpr SMTSolver::bvudiv(SMTExpr lhs_, SMTExpr rhs_) {
-	return ctx->binop("bvudiv", lhs->width, lhs, rhs);
-}
+	static std::string bool2bv(const std::string &s) {
+		return "(ite " + s + " (_ bv1 1) (_ bv0 1))";
+	}
 
-SMTExpr SMTSolver::bvsrem(SMTExpr lhs_, SMTExpr rhs_) {
-	return ctx->binop("bvsrem", lhs->width, lhs, rhs);
-}
+	static std::string sign(unsigned w, const std::string &s) {
+		return "((_ extract " + utostr(w - 1) + " " + utostr(w - 1) + ") " + s + ")";
+	}
 
-SMTExpr SMTSolver::bvurem(SMTExpr lhs_, SMTExpr rhs_) {
-	return ctx->binop("bvurem", lhs->width, lhs, rhs);
-}
+	static std::string constant(const APInt &Val) {
+		unsigned w = Val.getBitWidth();
+		return "(_ bv" + Val.toString(10, false) + " " + utostr(w) + ")";
+	}
 
-SMTExpr SMTSolver::bvshl(SMTExpr lhs_, SMTExpr rhs_) {
-	return ctx->binop("bvshl", lhs->width, lhs, rhs);
-}
+	const char *build(const SMTNode *N, const char **ops) {
+		unsigned w = N->getWidth();
+		switch (N->getOpcode()) {
+		default: break;
+		case SMT_CONST:
+			return save(constant(N->getValue()));
+		case SMT_VAR: {
+			// A long-lived solver may see a name again, e.g., from
+			// a new value at the address of a deleted one; keep
+			// them distinct.
+			std::string s = N->getName();
+			if (unsigned n = names[s]++)
+				s += "!" + utostr(n);
+			write("(declare-fun %s () (_ BitVec %u))\n", s.c_str(), w);
+			return save(s);
+		}
+		}
+		return define(w, text(N, ops));
+	}
 
-SMTExpr SMTSolver::bvlshr(SMTExpr lhs_, SMTExpr rhs_) {
-	return ctx->binop("bvlshr", lhs->width, lhs, rhs);
-}
+	// Overflow checks are lowered to plain bit-vector operations.
+	std::string text(const SMTNode *N, const char **ops) {
+		std::string lhs = ops[0], rhs = N->getNumOperands() > 1 ? ops[1] : "";
+		unsigned w = N->getOperand(0)->getWidth();
+		std::string op;
+		switch (N->getOpcode()) {
+		default: llvm_unreachable("Unknown opcode!");
+		case SMT_ITE:
+			return "(ite " + bv2bool(ops[0]) + " " + ops[1] + " " + ops[2] + ")";
+		case SMT_EQ:  return bool2bv("(= " + lhs + " " + rhs + ")");
+		case SMT_SLT: return bool2bv("(bvslt " + lhs + " " + rhs + ")");
+		case SMT_SLE: return bool2bv("(bvsle " + lhs + " " + rhs + ")");
+		case SMT_ULT: return bool2bv("(bvult " + lhs + " " + rhs + ")");
+		case SMT_ULE: return bool2bv("(bvule " + lhs + " " + rhs + ")");
+		case SMT_EXTRACT:
+			return "((_ extract " + utostr(N->getParam(0)) + " " + utostr(N->getParam(1)) + ") " + lhs + ")";
+		case SMT_ZEXT:
+			return "((_ zero_extend " + utostr(N->getParam(0)) + ") " + lhs + ")";
+		case SMT_SEXT:
+			return "((_ sign_extend " + utostr(N->getParam(0)) + ") " + lhs + ")";
+		case SMT_REDAND:
+			return "(bvcomp " + lhs + " " + constant(APInt::getAllOnesValue(w)) + ")";
+		case SMT_REDOR:
+			return "(bvnot (bvcomp " + lhs + " " + constant(APInt::getNullValue(w)) + "))";
+		case SMT_NOT:  return "(bvnot " + lhs + ")";
+		case SMT_NEG:  return "(bvneg " + lhs + ")";
+		case SMT_ADD:  op = "bvadd"; break;
+		case SMT_SUB:  op = "bvsub"; break;
+		case SMT_MUL:  op = "bvmul"; break;
+		case SMT_SDIV: op = "bvsdiv"; break;
+		case SMT_UDIV: op = "bvudiv"; break;
+		case SMT_SREM: op = "bvsrem"; break;
+		case SMT_UREM: op = "bvurem"; break;
+		case SMT_SHL:  op = "bvshl"; break;
+		case SMT_LSHR: op = "bvlshr"; break;
+		case SMT_ASHR: op = "bvashr"; break;
+		case SMT_AND:  op = "bvand"; break;
+		case SMT_OR:   op = "bvor"; break;
+		case SMT_XOR:  op = "bvxor"; break;
+		case SMT_SADDO:
+			// Overflow:
+			// * lhs and rhs are of the same sign, and
+			// * sum has a different sign.
+			return bool2bv("(and (= " + sign(w, lhs) + " " + sign(w, rhs) + ") "
+				"(distinct " + sign(w, lhs) + " " + sign(w, "(bvadd " + lhs + " " + rhs + ")") + "))");
+		case SMT_UADDO:
+			return "((_ extract " + utostr(w) + " " + utostr(w) + ") "
+				"(bvadd ((_ zero_extend 1) " + lhs + ") ((_ zero_extend 1) " + rhs + ")))";
+		case SMT_SSUBO:
+			// Overflow:
+			// * lhs and rhs are of the opposite sign, and
+			// * diff has a different sign from lhs.
+			return bool2bv("(and (distinct " + sign(w, lhs) + " " + sign(w, rhs) + ") "
+				"(distinct " + sign(w, lhs) + " " + sign(w, "(bvsub " + lhs + " " + rhs + ")") + "))");
+		case SMT_USUBO:
+			return bool2bv("(bvult " + lhs + " " + rhs + ")");
+		case SMT_SMULO: {
+			// sign_bits:
+			// * 000..0 if lhs and rhs are of the same sign;
+			// * 111..1 if lhs and rhs are of the opposite sign.
+			std::string ext = "(_ sign_extend " + utostr(w) + ")";
+			std::string sign_bits = "(" + ext + " " + bool2bv("(distinct " + sign(w, lhs) + " " + sign(w, rhs) + ")") + ")";
+			std::string prod = "(bvmul (" + ext + " " + lhs + ") (" + ext + " " + rhs + "))";
+			std::string high_bits = "((_ extract " + utostr(w + w - 1) + " " + utostr(w - 1) + ") " + prod + ")";
+			return bool2bv("(distinct " + high_bits + " " + sign_bits + ")");
+		}
+		case SMT_UMULO: {
+			std::string ext = "(_ zero_extend " + utostr(w) + ")";
+			std::string prod = "(bvmul (" + ext + " " + lhs + ") (" + ext + " " + rhs + "))";
+			std::string high_bits = "((_ extract " + utostr(w + w - 1) + " " + utostr(w) + ") " + prod + ")";
+			return bool2bv("(distinct " + high_bits + " " + constant(APInt::getNullValue(w)) + ")");
+		}
+		case SMT_SDIVO:
+			return bool2bv("(and (= " + lhs + " " + constant(APInt::getSignedMinValue(w)) + ") "
+				"(= " + rhs + " " + constant(APInt::getAllOnesValue(w)) + "))");
+		}
+		return "(" + op + " " + lhs + " " + rhs + ")";
+	}
 
-SMTExpr SMTSolver::bvashr(SMTExpr lhs_, SMTExpr rhs_) {
-	return ctx->binop("bvashr", lhs->width, lhs, rhs);
-}
+	enum { WBUF_SIZE = 1 << 20 };
+	std::string wbuf;
+	char rbuf[4096];
+	size_t rpos, rlen;
+	BumpPtrAllocator alloc;
+	unsigned nterms;
+};
 
-SMTExpr SMTSolver::bvand(SMTExpr lhs_, SMTExpr rhs_) {
-	return ctx->binop("bvand", lhs->width, lhs, rhs);
-}
+namespace {
 
-SMTExpr SMTSolver::bvor(SMTExpr lhs_, SMTExpr rhs_) {
-	return ctx->binop("bvor", lhs->width, lhs, rhs);
-}
+// No models; solve() never sets one.
+class SMTLIBBackend : public SMTBackend {
+public:
+	SMTLIBBackend() : ctx(SMTPool::get().acquire()), interrupted(0) {}
 
-SMTExpr SMTSolver::bvxor(SMTExpr lhs_, SMTExpr rhs_) {
-	return ctx->binop("bvxor", lhs->width, lhs, rhs);
-}
+	void assume(SMTExpr);
+	SMTStatus solve(SMTExpr, SMTModel *);
+	void solve(unsigned n, const SMTExpr *, SMTStatus *);
+	void core(SMTExpr, unsigned n, const SMTExpr *, bool *);
+	void interrupt();
 
-SMTExpr SMTSolver::bvneg_overflow(SMTExpr e_) {
-	unsigned w = e->width;
-	SMTExprImpl *smin = ctx->newint(APInt::getSignedMinValue(w));
-	return eq(e, smin);
-}
+private:
+	SMTLIBContext ctx;
+	// Set before the solver is killed, so that the failed
+	// read that follows is not taken for a crash.
+	volatile int interrupted;
+};
 
-SMTExpr SMTSolver::bvsadd_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	unsigned w = lhs->width;
-	// Overflow:
-	// * lhs and rhs are of the same sign, and
-	// * sum has a different sign.
-	SMTExpr lhs_sign = extract(w - 1, w - 1, lhs);
-	SMTExpr rhs_sign = extract(w - 1, w - 1, lhs);
-	SMTExpr sum_sign = extract(w - 1, w - 1, bvadd(lhs, rhs));
-	return bvand(eq(lhs_sign, rhs_sign), ne(lhs_sign, sum_sign));
-}
+} // anonymous namespace
 
-SMTExpr SMTSolver::bvuadd_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	unsigned w = lhs->width;
-	return extract(w, w, bvadd(zero_extend(1, lhs), zero_extend(1, rhs)));
+void SMTLIBBackend::assume(SMTExpr e_) {
+	ctx.write("(assert %s)\n", ctx.bv2bool(ctx.term(e_)).c_str());
 }
 
-SMTExpr SMTSolver::bvssub_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	unsigned w = lhs->width;
-	// Overflow:
-	// * lhs and rhs are of the opposite sign, and
-	// * diff has a different sign from lhs.
-	SMTExpr lhs_sign = extract(w - 1, w - 1, lhs);
-	SMTExpr rhs_sign = extract(w - 1, w - 1, lhs);
-	SMTExpr diff_sign = extract(w - 1, w - 1, bvsub(lhs, rhs));
-	return bvand(ne(lhs_sign, rhs_sign), ne(lhs_sign, diff_sign));
+SMTStatus SMTLIBBackend::solve(SMTExpr e_, SMTModel *m_) {
+	SMTStatus status;
+	solve(1, &e_, &status);
+	return status;
 }
 
-SMTExpr SMTSolver::bvusub_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	return bvult(lhs, rhs);
+// Send all queries before reading any answer.
+void SMTLIBBackend::solve(unsigned n, const SMTExpr *es, SMTStatus *res) {
+	std::fill(res, res + n, SMT_TIMEOUT);
+	if (!SMTTimer::begin(this, ctx.pid))
+		return;
+	// Guard each query with a fresh activation literal rather than
+	// push/pop, so that the solver keeps what it has learned.
+	unsigned act = ctx.nact;
+	ctx.nact += n;
+	for (unsigned i = 0; i != n; ++i) {
+		std::string cond = ctx.bv2bool(ctx.term(es[i]));
+		ctx.write("(declare-fun act!%u () Bool)\n", act + i);
+		ctx.write("(assert (=> act!%u %s))\n", act + i, cond.c_str());
+		ctx.write("(check-sat-assuming (act!%u))\n", act + i);
+	}
+	bool ok = true;
+	for (unsigned i = 0; i != n; ++i) {
+		char buf[16];
+		ok = ctx.readline(buf, sizeof(buf));
+		if (!ok)
+			break;
+		StringRef status = StringRef(buf).rtrim();
+		if (status == "unsat") {
+			res[i] = SMT_UNSAT;
+		} else if (status == "sat") {
+			res[i] = SMT_SAT;
+		} else {
+			dbgs() << "[SMTLIB] unknown response: " << status << "\n";
+			res[i] = SMT_UNDEF;
+		}
+	}
+	if (SMTTimer::end() || interrupted) {
+		std::fill(res, res + n, SMT_TIMEOUT);
+		return;
+	}
+	if (!ok)
+		errx(1, "readline");
+	// Retire the literals.
+	for (unsigned i = 0; i != n; ++i)
+		ctx.write("(assert (not act!%u))\n", act + i);
+}
+
+// Guard E and each of the literals with an activation literal,
+// as in solve(), and map the failed ones back.
+void SMTLIBBackend::core(SMTExpr e_, unsigned n, const SMTExpr *lits, bool *core) {
+	std::fill(core, core + n, true);
+	if (!SMTTimer::begin(this, ctx.pid))
+		return;
+	unsigned act = ctx.nact;
+	ctx.nact += n + 1;
+	std::string acts;
+	for (unsigned i = 0; i <= n; ++i) {
+		std::string cond = ctx.bv2bool(ctx.term(i ? lits[i - 1] : e_));
+		ctx.write("(declare-fun act!%u () Bool)\n", act + i);
+		ctx.write("(assert (=> act!%u %s))\n", act + i, cond.c_str());
+		acts += " act!" + utostr(act + i);
+	}
+	ctx.write("(check-sat-assuming (%s))\n", acts.c_str() + 1);
+	char buf[16];
+	std::string failed;
+	bool ok = ctx.readline(buf, sizeof(buf));
+	bool unsat = ok && StringRef(buf).rtrim() == "unsat";
+	if (unsat) {
+		ctx.write("(get-unsat-assumptions)\n");
+		ok = ctx.readsexp(failed);
+	}
+	if (SMTTimer::end() || interrupted)
+		return;
+	if (!ok)
+		errx(1, "readline");
+	for (unsigned i = 0; i <= n; ++i)
+		ctx.write("(assert (not act!%u))\n", act + i);
+	// Expect a list of literals; anything else, such as an error,
+	// leaves all of them in the core.
+	std::replace(failed.begin(), failed.end(), '\n', ' ');
+	StringRef s = StringRef(failed).trim();
+	if (!unsat || !s.startswith("(") || s.startswith("(error"))
+		return;
+	SmallVector<StringRef, 16> tokens;
+	s.substr(1, s.size() - 2).split(tokens, " ", -1, false);
+	SmallVector<bool, 16> found(n);
+	bool any = false;
+	for (StringRef tok : tokens) {
+		unsigned k;
+		tok = tok.trim();
+		if (!tok.startswith("act!") || tok.substr(4).getAsInteger(10, k))
+			return;
+		if (k > act && k <= act + n) {
+			found[k - act - 1] = true;
+			any = true;
+		}
+	}
+	if (any)
+		std::copy(found.begin(), found.end(), core);
 }
 
-SMTExpr SMTSolver::bvsmul_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	unsigned w = lhs->width;
-	SMTExpr lhs_sign = extract(w - 1, w - 1, lhs);
-	SMTExpr rhs_sign = extract(w - 1, w - 1, lhs);
-	// sign_bits:
-	// * 000..0 if lhs and rhs are of the same sign;
-	// * 111..1 if lhs and rhs are of the opposite sign.
-	SMTExpr sign_bits = sign_extend(w, ne(lhs_sign, rhs_sign));
-	SMTExpr prod = bvmul(sign_extend(w, lhs), sign_extend(w, rhs));
-	SMTExpr high_bits = extract(w + w - 1, w - 1, prod);
-	return ne(high_bits, sign_bits);
+// Kill the solver; the pending read then fails.  The backend
+// is unusable afterwards and should be discarded; the pool
+// then starts a fresh solver.
+void SMTLIBBackend::interrupt() {
+	interrupted = 1;
+	kill(ctx.pid, SIGKILL);
 }
 
-SMTExpr SMTSolver::bvumul_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	unsigned w = lhs->width;
-	SMTExpr prod = bvmul(zero_extend(w, lhs), zero_extend(w, rhs));
-	return bvredor(extract(w + w - 1, w, prod));
+static SMTBackend *create(bool) {
+	return new SMTLIBBackend;
 }
 
-SMTExpr SMTSolver::bvsdiv_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	unsigned w = lhs->width;
-	SMTExprImpl *minusone = ctx->newint(APInt::getAllOnesValue(w));
-	return bvand(bvneg_overflow(lhs), eq(rhs, minusone));
-}
+// Linked in only if configured with a solver, which then takes
+// precedence.
+static SMTBackendRegistration R("smtlib", create, 3);
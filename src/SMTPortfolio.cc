@@ -0,0 +1,329 @@
+// Race several backends on each query, one thread each, and take the
+// first answer.  The others are interrupted and, as a backend may be
+// unusable afterwards, replaced by fresh ones given the assumptions.
+// Queries are classified by the operators they use and their width;
+// once a class has been raced a few times, its queries go straight to
+// the backend that has won most of its races.  With -smt-portfolio-log,
+// the winners are kept in a file, so that later runs route from the
+// start.
+
+#include "SMTSolver.h"
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/MathExtras.h>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+using namespace llvm;
+
+static cl::opt<std::string>
+SMTPortfolioLogOpt("smt-portfolio-log",
+                   cl::desc("Keep the winners of portfolio races in a file"),
+                   cl::value_desc("file"));
+
+// Races of a class before its queries are routed.
+static const unsigned MinRaces = 3;
+
+namespace {
+
+// Wins of each backend by query class, shared by all solvers in the
+// process and, through the log, by later runs.
+class SMTWinners {
+public:
+	static SMTWinners &get() {
+		static SMTWinners W;
+		return W;
+	}
+
+	// The index in Names of the backend to route the class to,
+	// or -1 to race.
+	int route(const std::string &Class, ArrayRef<std::string> Names);
+	void record(const std::string &Class, StringRef Name);
+
+private:
+	SMTWinners();
+	std::mutex Lock;
+	StringMap<StringMap<unsigned> > Wins;
+};
+
+// A model and the backend it came from.
+struct SMTPortfolioModel {
+	SMTBackend *Backend;
+	SMTModel Model;
+};
+
+class SMTPortfolio : public SMTBackend {
+public:
+	SMTPortfolio(ArrayRef<std::string> Names, bool modelgen);
+	~SMTPortfolio();
+
+	void assume(SMTExpr);
+	SMTStatus solve(SMTExpr, SMTModel *);
+	void solve(unsigned n, const SMTExpr *, SMTStatus *);
+	void core(SMTExpr, unsigned n, const SMTExpr *, bool *);
+	void interrupt();
+	void eval(SMTModel, SMTExpr, APInt &);
+	void release(SMTModel);
+
+private:
+	std::vector<std::string> Names;
+	bool ModelGen;
+	SmallVector<SMTBackend *, 4> Backends;
+	std::vector<SMTExpr> Assumed;
+
+	SMTStatus race(SMTExpr, const std::string &Class, SMTModel *);
+	void replace(unsigned i);
+	SMTModel wrap(unsigned i, SMTModel M) {
+		SMTPortfolioModel *PM = new SMTPortfolioModel;
+		PM->Backend = Backends[i];
+		PM->Model = M;
+		return PM;
+	}
+};
+
+} // anonymous namespace
+
+// A log line is "<class> <backend>".
+SMTWinners::SMTWinners() {
+	if (SMTPortfolioLogOpt.empty())
+		return;
+	FILE *f = fopen(SMTPortfolioLogOpt.c_str(), "r");
+	if (!f)
+		return;
+	char buf[128];
+	while (fgets(buf, sizeof(buf), f)) {
+		std::pair<StringRef, StringRef> P = StringRef(buf).rtrim().split(' ');
+		if (!P.first.empty() && !P.second.empty())
+			++Wins[P.first][P.second];
+	}
+	fclose(f);
+}
+
+int SMTWinners::route(const std::string &Class, ArrayRef<std::string> Names) {
+	std::lock_guard<std::mutex> L(Lock);
+	StringMap<StringMap<unsigned> >::iterator i = Wins.find(Class);
+	if (i == Wins.end())
+		return -1;
+	unsigned Races = 0;
+	for (StringMap<unsigned>::iterator k = i->second.begin(), e = i->second.end(); k != e; ++k)
+		Races += k->second;
+	if (Races < MinRaces)
+		return -1;
+	// Ties go to the backend given first.
+	int Best = -1;
+	unsigned BestWins = 0;
+	for (unsigned k = 0, e = Names.size(); k != e; ++k) {
+		unsigned Won = i->second.lookup(Names[k]);
+		if (Won > BestWins) {
+			Best = k;
+			BestWins = Won;
+		}
+	}
+	return Best;
+}
+
+void SMTWinners::record(const std::string &Class, StringRef Name) {
+	{
+		std::lock_guard<std::mutex> L(Lock);
+		++Wins[Class][Name];
+	}
+	if (SMTPortfolioLogOpt.empty())
+		return;
+	// Concurrent runs may share the log; a single short write
+	// in append mode is not interleaved with theirs.
+	int fd = open(SMTPortfolioLogOpt.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+	if (fd < 0)
+		return;
+	std::string Line = Class + " " + Name.str() + "\n";
+	if (write(fd, Line.data(), Line.size()) < 0)
+		perror("smt-portfolio-log");
+	close(fd);
+}
+
+// The operators in E, and the width of its widest node rounded up
+// to a power of two.  The assumptions are left out: they are the
+// same for the queries of a function.
+static std::string classify(SMTExpr E) {
+	uint64_t Ops = 0;
+	unsigned Width = 1;
+	SmallPtrSet<SMTExpr, 32> Visited;
+	SmallVector<SMTExpr, 32> Stack;
+	Stack.push_back(E);
+	while (!Stack.empty()) {
+		SMTExpr X = Stack.pop_back_val();
+		if (Visited.count(X))
+			continue;
+		Visited.insert(X);
+		Ops |= 1ULL << X->getOpcode();
+		Width = std::max(Width, X->getWidth());
+		for (unsigned i = 0, n = X->getNumOperands(); i != n; ++i)
+			Stack.push_back(X->getOperand(i));
+	}
+	return utohexstr(Ops) + "/" + utostr(1U << Log2_32_Ceil(Width));
+}
+
+SMTPortfolio::SMTPortfolio(ArrayRef<std::string> Names, bool modelgen)
+	: Names(Names.begin(), Names.end()), ModelGen(modelgen) {
+	for (unsigned i = 0, n = Names.size(); i != n; ++i)
+		Backends.push_back(create(Names[i], modelgen));
+}
+
+SMTPortfolio::~SMTPortfolio() {
+	for (unsigned i = 0, n = Backends.size(); i != n; ++i)
+		delete Backends[i];
+}
+
+void SMTPortfolio::assume(SMTExpr E) {
+	for (unsigned i = 0, n = Backends.size(); i != n; ++i)
+		Backends[i]->assume(E);
+	Assumed.push_back(E);
+}
+
+SMTStatus SMTPortfolio::solve(SMTExpr E, SMTModel *M) {
+	std::string Class = classify(E);
+	int i = SMTWinners::get().route(Class, Names);
+	if (i < 0)
+		return race(E, Class, M);
+	SMTModel Model = NULL;
+	SMTStatus Status = Backends[i]->solve(E, M ? &Model : NULL);
+	if (Model)
+		*M = wrap(i, Model);
+	return Status;
+}
+
+// Batch the routed queries by backend, and race the rest one by one.
+void SMTPortfolio::solve(unsigned n, const SMTExpr *Es, SMTStatus *Res) {
+	unsigned NumBackends = Backends.size();
+	std::vector<SmallVector<unsigned, 4> > Routed(NumBackends);
+	for (unsigned i = 0; i != n; ++i) {
+		std::string Class = classify(Es[i]);
+		int k = SMTWinners::get().route(Class, Names);
+		if (k < 0)
+			Res[i] = race(Es[i], Class, NULL);
+		else
+			Routed[k].push_back(i);
+	}
+	for (unsigned k = 0; k != NumBackends; ++k) {
+		unsigned m = Routed[k].size();
+		if (!m)
+			continue;
+		SmallVector<SMTExpr, 4> Queries;
+		SmallVector<SMTStatus, 4> Status(m);
+		for (unsigned i = 0; i != m; ++i)
+			Queries.push_back(Es[Routed[k][i]]);
+		Backends[k]->solve(m, Queries.data(), Status.data());
+		for (unsigned i = 0; i != m; ++i)
+			Res[Routed[k][i]] = Status[i];
+	}
+}
+
+// The first backend runs on the calling thread; once it stops without
+// an answer, so do the others.  The others run under timers of their
+// own with what is left of the current one, so that the watchdog
+// stops every backend at the deadline, and a backend that cannot be
+// interrupted otherwise knows to solve in a child.
+SMTStatus SMTPortfolio::race(SMTExpr E, const std::string &Class, SMTModel *M) {
+	// Don't start backends only to interrupt them.
+	if (SMTTimer::outOfTime())
+		return SMT_TIMEOUT;
+	unsigned Ms = SMTTimer::remaining();
+	unsigned n = Backends.size();
+	std::mutex Lock;
+	int Winner = -1;
+	SmallVector<SMTStatus, 4> Status(n, SMT_UNDEF);
+	SmallVector<SMTModel, 4> Models(n);
+	SmallVector<bool, 4> Running(n, true), Interrupted(n);
+	auto interruptOthers = [&]() {
+		for (unsigned k = 0; k != n; ++k) {
+			if (!Running[k])
+				continue;
+			Backends[k]->interrupt();
+			Interrupted[k] = true;
+		}
+	};
+	auto run = [&](unsigned i) {
+		SMTStatus S;
+		{
+			// The first keeps the timer of the calling thread.
+			std::unique_ptr<SMTTimer> Timer;
+			if (i || !SMTTimer::armed())
+				Timer.reset(new SMTTimer(Ms));
+			S = Backends[i]->solve(E, M ? &Models[i] : NULL);
+		}
+		std::lock_guard<std::mutex> L(Lock);
+		Status[i] = S;
+		Running[i] = false;
+		if (Winner >= 0 || (S != SMT_SAT && S != SMT_UNSAT))
+			return;
+		Winner = i;
+		interruptOthers();
+	};
+	std::vector<std::thread> Threads;
+	for (unsigned i = 1; i != n; ++i)
+		Threads.push_back(std::thread(run, i));
+	run(0);
+	{
+		std::lock_guard<std::mutex> L(Lock);
+		if (Winner < 0)
+			interruptOthers();
+	}
+	for (unsigned i = 0, e = Threads.size(); i != e; ++i)
+		Threads[i].join();
+	for (unsigned i = 0; i != n; ++i) {
+		if ((int)i != Winner && Models[i])
+			Backends[i]->release(Models[i]);
+		if (Interrupted[i])
+			replace(i);
+	}
+	if (Winner < 0)
+		return Status[0];
+	SMTWinners::get().record(Class, Names[Winner]);
+	if (Models[Winner])
+		*M = wrap(Winner, Models[Winner]);
+	return Status[Winner];
+}
+
+// Start afresh with the same assumptions.
+void SMTPortfolio::replace(unsigned i) {
+	delete Backends[i];
+	Backends[i] = create(Names[i], ModelGen);
+	for (unsigned k = 0, e = Assumed.size(); k != e; ++k)
+		Backends[i]->assume(Assumed[k]);
+}
+
+// Cores are rarely asked for; don't race them.
+void SMTPortfolio::core(SMTExpr E, unsigned n, const SMTExpr *Lits, bool *Core) {
+	Backends[0]->core(E, n, Lits, Core);
+}
+
+void SMTPortfolio::interrupt() {
+	for (unsigned i = 0, n = Backends.size(); i != n; ++i)
+		Backends[i]->interrupt();
+}
+
+// A model is valid until the next query, which may replace the
+// backend that produced it.
+void SMTPortfolio::eval(SMTModel M, SMTExpr E, APInt &V) {
+	SMTPortfolioModel *PM = (SMTPortfolioModel *)M;
+	PM->Backend->eval(PM->Model, E, V);
+}
+
+void SMTPortfolio::release(SMTModel M) {
+	SMTPortfolioModel *PM = (SMTPortfolioModel *)M;
+	PM->Backend->release(PM->Model);
+	delete PM;
+}
+
+SMTBackend *SMTBackend::createPortfolio(ArrayRef<std::string> Names, bool modelgen) {
+	return new SMTPortfolio(Names, modelgen);
+}
@@ -0,0 +1,342 @@
+// Random simulation: evaluate a query on 64 assignments at once
+// before handing it to the solver.  Most queries of the anti-passes
+// are satisfiable and a witness is often easy to come by.
+
+#include "SMTSolver.h"
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/CommandLine.h>
+#include <algorithm>
+#include <vector>
+#include <stdint.h>
+
+using namespace llvm;
+
+static cl::opt<unsigned>
+SMTSimulateOpt("smt-simulate",
+               cl::desc("Rounds of random simulation before solving"),
+               cl::value_desc("rounds"), cl::init(2));
+
+namespace {
+
+enum { LANES = 64, POOL = 64 };
+
+inline uint64_t mask(unsigned Width) {
+	return Width == 64 ? ~0ULL : (1ULL << Width) - 1;
+}
+
+inline int64_t sx(uint64_t V, unsigned Width) {
+	return (int64_t)(V << (64 - Width)) >> (64 - Width);
+}
+
+inline uint64_t sign(uint64_t V, unsigned Width) {
+	return (V >> (Width - 1)) & 1;
+}
+
+// Deterministic, so that results do not vary between runs.
+struct XorShift {
+	uint64_t S;
+	XorShift() : S(0x9e3779b97f4a7c15ULL) {}
+	uint64_t next() {
+		S ^= S << 13;
+		S ^= S >> 7;
+		S ^= S << 17;
+		return S;
+	}
+};
+
+struct SMTSimulator {
+	std::vector<const SMTNode *> Nodes;
+	SmallPtrSet<const SMTNode *, 32> Visited;
+	bool Wide;
+
+	SMTSimulator() : Wide(false) {}
+
+	void collect(const SMTNode *N) {
+		SmallVector<const SMTNode *, 64> Stack;
+		Stack.push_back(N);
+		while (!Stack.empty()) {
+			const SMTNode *X = Stack.pop_back_val();
+			if (Visited.count(X))
+				continue;
+			Visited.insert(X);
+			Nodes.push_back(X);
+			if (X->getWidth() > 64)
+				Wide = true;
+			for (unsigned i = 0, n = X->getNumOperands(); i != n; ++i)
+				Stack.push_back(X->getOperand(i));
+		}
+	}
+
+	bool run(ArrayRef<const SMTNode *> Roots, unsigned Rounds);
+	void eval(const SMTNode *, uint64_t *, const uint64_t *const *, uint64_t &Poison);
+};
+
+} // anonymous namespace
+
+static bool byID(const SMTNode *L, const SMTNode *R) {
+	return L->getID() < R->getID();
+}
+
+bool SMTSimulator::run(ArrayRef<const SMTNode *> Roots, unsigned Rounds) {
+	// Operands are created before their users.
+	std::sort(Nodes.begin(), Nodes.end(), byID);
+	DenseMap<const SMTNode *, unsigned> Index;
+	for (unsigned i = 0, n = Nodes.size(); i != n; ++i)
+		Index[Nodes[i]] = i;
+
+	// Seed variables with boundary values, and with the constants
+	// of the same width and their neighbors, such as range edges.
+	DenseMap<unsigned, SmallVector<uint64_t, POOL> > Pools;
+	for (unsigned i = 0, n = Nodes.size(); i != n; ++i) {
+		const SMTNode *N = Nodes[i];
+		if (N->getOpcode() != SMT_VAR)
+			continue;
+		unsigned Width = N->getWidth();
+		SmallVector<uint64_t, POOL> &Pool = Pools[Width];
+		if (!Pool.empty())
+			continue;
+		uint64_t M = mask(Width);
+		Pool.push_back(0);
+		Pool.push_back(1);
+		Pool.push_back(M);
+		Pool.push_back(1ULL << (Width - 1));
+		Pool.push_back(M >> 1);
+	}
+	for (unsigned i = 0, n = Nodes.size(); i != n; ++i) {
+		const SMTNode *N = Nodes[i];
+		if (N->getOpcode() != SMT_CONST || !Pools.count(N->getWidth()))
+			continue;
+		SmallVector<uint64_t, POOL> &Pool = Pools[N->getWidth()];
+		if (Pool.size() + 3 > POOL)
+			continue;
+		uint64_t M = mask(N->getWidth()), C = N->getValue().getZExtValue();
+		Pool.push_back(C);
+		Pool.push_back((C - 1) & M);
+		Pool.push_back((C + 1) & M);
+	}
+
+	std::vector<uint64_t> Vals(Nodes.size() * LANES);
+	XorShift Rand;
+	for (unsigned Round = 0; Round != Rounds; ++Round) {
+		uint64_t Poison = 0;
+		for (unsigned i = 0, n = Nodes.size(); i != n; ++i) {
+			const SMTNode *N = Nodes[i];
+			uint64_t *V = &Vals[i * LANES];
+			if (N->getOpcode() != SMT_VAR) {
+				const uint64_t *Ops[3];
+				for (unsigned k = 0, e = N->getNumOperands(); k != e; ++k)
+					Ops[k] = &Vals[Index.lookup(N->getOperand(k)) * LANES];
+				eval(N, V, Ops, Poison);
+				continue;
+			}
+			const SmallVector<uint64_t, POOL> &Pool = Pools[N->getWidth()];
+			uint64_t M = mask(N->getWidth());
+			for (unsigned l = 0; l != LANES; ++l) {
+				uint64_t R = Rand.next();
+				if (Round == 0 && l < 5)
+					V[l] = Pool[l];	// All variables on the same boundary.
+				else if (Round == 0 || R & 1)
+					V[l] = Pool[(R >> 1) % Pool.size()];
+				else
+					V[l] = (R >> 1) & M;
+			}
+		}
+		uint64_t Hit = ~Poison;
+		for (unsigned i = 0, n = Roots.size(); i != n; ++i) {
+			const uint64_t *V = &Vals[Index.lookup(Roots[i]) * LANES];
+			uint64_t Bits = 0;
+			for (unsigned l = 0; l != LANES; ++l)
+				Bits |= (V[l] & 1) << l;
+			Hit &= Bits;
+		}
+		if (Hit)
+			return true;
+	}
+	return false;
+}
+
+// Lanes with a division by zero are poisoned, rather than relying
+// on the solver's semantics.
+void SMTSimulator::eval(const SMTNode *N, uint64_t *V, const uint64_t *const *Ops, uint64_t &Poison) {
+	unsigned Width = N->getWidth();
+	unsigned OpWidth = N->getNumOperands() ? N->getOperand(0)->getWidth() : Width;
+	uint64_t M = mask(Width), OpM = mask(OpWidth);
+	const uint64_t *A = Ops[0], *B = Ops[1];
+	switch (N->getOpcode()) {
+	default: llvm_unreachable("Unknown opcode!");
+	case SMT_CONST:
+		std::fill(V, V + LANES, N->getValue().getZExtValue());
+		return;
+	case SMT_ITE:
+		for (unsigned l = 0; l != LANES; ++l)
+			V[l] = (A[l] & 1) ? B[l] : Ops[2][l];
+		return;
+	case SMT_EQ:
+		for (unsigned l = 0; l != LANES; ++l)
+			V[l] = A[l] == B[l];
+		return;
+	case SMT_SLT:
+		for (unsigned l = 0; l != LANES; ++l)
+			V[l] = sx(A[l], OpWidth) < sx(B[l], OpWidth);
+		return;
+	case SMT_SLE:
+		for (unsigned l = 0; l != LANES; ++l)
+			V[l] = sx(A[l], OpWidth) <= sx(B[l], OpWidth);
+		return;
+	case SMT_ULT:
+		for (unsigned l = 0; l != LANES; ++l)
+			V[l] = A[l] < B[l];
+		return;
+	case SMT_ULE:
+		for (unsigned l = 0; l != LANES; ++l)
+			V[l] = A[l] <= B[l];
+		return;
+	case SMT_EXTRACT:
+		for (unsigned l = 0; l != LANES; ++l)
+			V[l] = (A[l] >> N->getParam(1)) & M;
+		return;
+	case SMT_ZEXT:
+		std::copy(A, A + LANES, V);
+		return;
+	case SMT_SEXT:
+		for (unsigned l = 0; l != LANES; ++l)
+			V[l] = sx(A[l], OpWidth) & M;
+		return;
+	case SMT_REDAND:
+		for (unsigned l = 0; l != LANES; ++l)
+			V[l] = A[l] == OpM;
+		return;
+	case SMT_REDOR:
+		for (unsigned l = 0; l != LANES; ++l)
+			V[l] = A[l] != 0;
+		return;
+	case SMT_NOT:
+		for (unsigned l = 0; l != LANES; ++l)
+			V[l] = ~A[l] & M;
+		return;
+	case SMT_NEG:
+		for (unsigned l = 0; l != LANES; ++l)
+			V[l] = -A[l] & M;
+		return;
+	case SMT_ADD:
+		for (unsigned l = 0; l != LANES; ++l)
+			V[l] = (A[l] + B[l]) & M;
+		return;
+	case SMT_SUB:
+		for (unsigned l = 0; l != LANES; ++l)
+			V[l] = (A[l] - B[l]) & M;
+		return;
+	case SMT_MUL:
+		for (unsigned l = 0; l != LANES; ++l)
+			V[l] = (A[l] * B[l]) & M;
+		return;
+	case SMT_UDIV:
+	case SMT_UREM:
+		for (unsigned l = 0; l != LANES; ++l) {
+			if (!B[l]) {
+				Poison |= 1ULL << l;
+				V[l] = 0;
+				continue;
+			}
+			V[l] = N->getOpcode() == SMT_UDIV ? A[l] / B[l] : A[l] % B[l];
+		}
+		return;
+	case SMT_SDIV:
+	case SMT_SREM:
+		for (unsigned l = 0; l != LANES; ++l) {
+			int64_t X = sx(A[l], Width), Y = sx(B[l], Width);
+			if (!Y) {
+				Poison |= 1ULL << l;
+				V[l] = 0;
+				continue;
+			}
+			// INT_MIN / -1 wraps; avoid trapping on 64 bits.
+			if (Y == -1) {
+				V[l] = N->getOpcode() == SMT_SDIV ? -A[l] & M : 0;
+				continue;
+			}
+			V[l] = (N->getOpcode() == SMT_SDIV ? X / Y : X % Y) & M;
+		}
+		return;
+	case SMT_SHL:
+		for (unsigned l = 0; l != LANES; ++l)
+			V[l] = B[l] >= Width ? 0 : (A[l] << B[l]) & M;
+		return;
+	case SMT_LSHR:
+		for (unsigned l = 0; l != LANES; ++l)
+			V[l] = B[l] >= Width ? 0 : A[l] >> B[l];
+		return;
+	case SMT_ASHR:
+		for (unsigned l = 0; l != LANES; ++l) {
+			unsigned n = std::min<uint64_t>(B[l], Width - 1);
+			V[l] = (sx(A[l], Width) >> n) & M;
+		}
+		return;
+	case SMT_AND:
+		for (unsigned l = 0; l != LANES; ++l)
+			V[l] = A[l] & B[l];
+		return;
+	case SMT_OR:
+		for (unsigned l = 0; l != LANES; ++l)
+			V[l] = A[l] | B[l];
+		return;
+	case SMT_XOR:
+		for (unsigned l = 0; l != LANES; ++l)
+			V[l] = A[l] ^ B[l];
+		return;
+	case SMT_SADDO:
+		for (unsigned l = 0; l != LANES; ++l) {
+			uint64_t S = (A[l] + B[l]) & OpM;
+			V[l] = sign(A[l], OpWidth) == sign(B[l], OpWidth)
+			    && sign(S, OpWidth) != sign(A[l], OpWidth);
+		}
+		return;
+	case SMT_UADDO:
+		for (unsigned l = 0; l != LANES; ++l)
+			V[l] = ((A[l] + B[l]) & OpM) < A[l];
+		return;
+	case SMT_SSUBO:
+		for (unsigned l = 0; l != LANES; ++l) {
+			uint64_t S = (A[l] - B[l]) & OpM;
+			V[l] = sign(A[l], OpWidth) != sign(B[l], OpWidth)
+			    && sign(S, OpWidth) != sign(A[l], OpWidth);
+		}
+		return;
+	case SMT_USUBO:
+		for (unsigned l = 0; l != LANES; ++l)
+			V[l] = A[l] < B[l];
+		return;
+	case SMT_SMULO:
+		for (unsigned l = 0; l != LANES; ++l) {
+			__int128 P = (__int128)sx(A[l], OpWidth) * sx(B[l], OpWidth);
+			V[l] = P != sx((uint64_t)P & OpM, OpWidth);
+		}
+		return;
+	case SMT_UMULO:
+		for (unsigned l = 0; l != LANES; ++l) {
+			unsigned __int128 P = (unsigned __int128)A[l] * B[l];
+			V[l] = P > OpM;
+		}
+		return;
+	case SMT_SDIVO:
+		for (unsigned l = 0; l != LANES; ++l)
+			V[l] = A[l] == 1ULL << (OpWidth - 1) && B[l] == OpM;
+		return;
+	}
+}
+
+// Roots are the query and the assumptions it depends on; a witness
+// must satisfy all of them.
+bool SMTSolver::simulate(ArrayRef<SMTExpr> Roots) {
+	if (!SMTSimulateOpt)
+		return false;
+	SMTSimulator Sim;
+	for (unsigned i = 0, n = Roots.size(); i != n; ++i)
+		Sim.collect(Roots[i]);
+	if (Sim.Wide)
+		return false;
+	return Sim.run(Roots, SMTSimulateOpt);
+}
@@ -1,8 +1,20 @@
+#include "SMTSolver.h"
+#include "SMTCache.h"
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/Support/CommandLine.h>
-#include <sys/time.h>
-#include <sys/wait.h>
+#include <llvm/Support/ErrorHandling.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include <err.h>
-#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
 
 using namespace llvm;
 
@@ -11,35 +23,486 @@ SMTTimeoutOpt("smt-timeout",
               cl::desc("Specify a timeout for SMT solver"),
               cl::value_desc("milliseconds"));
 
-static pid_t pid;
+static cl::opt<unsigned>
+SMTBudgetOpt("smt-budget",
+             cl::desc("Specify a budget for SMT solver in thousands of steps"),
+             cl::value_desc("thousands"));
+
+static cl::opt<std::string>
+SMTBackendOpt("smt-backend",
+              cl::desc("Specify the SMT backend (default: the preferred one linked in)"),
+              cl::value_desc("boolector|z3|sonolar|smtlib"));
+
+static cl::list<std::string>
+SMTPortfolioOpt("smt-portfolio",
+                cl::desc("Race several SMT backends on each query"),
+                cl::value_desc("backend,backend,..."),
+                cl::CommaSeparated);
+
+// Innermost timer of the current thread.
+static __thread SMTTimer *Current;
+
+static bool countsSteps();
+
+// Whether -smt-timeout applies: a budget replaces it only if the
+// backend counts steps.
+static bool timed() {
+	static bool Timed = SMTTimeoutOpt && !(SMTBudgetOpt && countsSteps());
+	return Timed;
+}
+
+static unsigned long long cputime(clockid_t Clock) {
+	struct timespec ts;
+	if (clock_gettime(Clock, &ts))
+		err(1, "clock_gettime");
+	return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct SMTWatchdog {
+	std::mutex Lock;
+	std::condition_variable Cond;
+	SMTTimer *Timers;
+
+	SMTWatchdog() : Timers(NULL) {
+		std::thread(&SMTWatchdog::run, this).detach();
+	}
+
+	// Never destroyed: the thread outlives static destructors.
+	static SMTWatchdog &get() {
+		static SMTWatchdog *W = new SMTWatchdog;
+		return *W;
+	}
 
-int SMTFork()
-{
-	if (!SMTTimeoutOpt)
+	void run() {
+		std::unique_lock<std::mutex> L(Lock);
+		for (;;) {
+			unsigned long long Wait = UINT64_MAX;
+			for (SMTTimer *T = Timers; T; T = T->Next) {
+				if (T->Expired)
+					continue;
+				unsigned long long Now = T->elapsed();
+				if (Now < T->Deadline) {
+					unsigned long long Left = T->Deadline - Now;
+					// The child and this thread may run in parallel.
+					if (T->HasChild)
+						Left /= 2;
+					Wait = std::min(Wait, Left);
+					continue;
+				}
+				T->Expired = true;
+				if (T->Target)
+					T->Target->interrupt();
+			}
+			// CPU time runs no faster than wall time, so sleeping
+			// for the remaining budget never overshoots.
+			if (Wait == UINT64_MAX)
+				Cond.wait(L);
+			else
+				Cond.wait_for(L, std::chrono::nanoseconds(Wait));
+		}
+	}
+};
+
+SMTTimer::SMTTimer()
+	: HasChild(false), Armed(SMTTimeoutOpt || SMTBudgetOpt), Watched(false), Expired(false), Target(NULL), Prev(NULL), Next(NULL) {
+	if (Armed)
+		arm(timed() ? SMTTimeoutOpt : 0);
+}
+
+SMTTimer::SMTTimer(unsigned Ms)
+	: HasChild(false), Armed(true), Watched(false), Expired(false), Target(NULL), Prev(NULL), Next(NULL) {
+	arm(Ms);
+}
+
+void SMTTimer::arm(unsigned Ms) {
+	Prev = Current;
+	Current = this;
+	// Only a time limit needs the watchdog.
+	if (!Ms)
+		return;
+	Watched = true;
+	if (pthread_getcpuclockid(pthread_self(), &Clock))
+		err(1, "pthread_getcpuclockid");
+	Deadline = cputime(Clock) + (unsigned long long)Ms * 1000000;
+	SMTWatchdog &W = SMTWatchdog::get();
+	std::lock_guard<std::mutex> L(W.Lock);
+	Next = W.Timers;
+	W.Timers = this;
+	W.Cond.notify_one();
+}
+
+SMTTimer::~SMTTimer() {
+	if (!Armed)
+		return;
+	if (Watched) {
+		SMTWatchdog &W = SMTWatchdog::get();
+		std::lock_guard<std::mutex> L(W.Lock);
+		SMTTimer **p = &W.Timers;
+		while (*p != this)
+			p = &(*p)->Next;
+		*p = Next;
+	}
+	Current = Prev;
+}
+
+bool SMTTimer::expired() const {
+	if (!Armed)
+		return false;
+	std::lock_guard<std::mutex> L(SMTWatchdog::get().Lock);
+	return Expired;
+}
+
+// Called with the watchdog lock held.
+unsigned long long SMTTimer::elapsed() const {
+	unsigned long long Now = cputime(Clock);
+	if (HasChild) {
+		struct timespec ts;
+		// The child may have died; then it has nothing to add.
+		if (!clock_gettime(ChildClock, &ts))
+			Now += (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec - ChildStart;
+	}
+	return Now;
+}
+
+bool SMTTimer::begin(SMTBackend *S, pid_t Child) {
+	SMTTimer *T = Current;
+	if (!T)
+		return true;
+	std::lock_guard<std::mutex> L(SMTWatchdog::get().Lock);
+	if (T->Expired)
+		return false;
+	T->Target = S;
+	if (Child && T->Watched && !clock_getcpuclockid(Child, &T->ChildClock)) {
+		T->HasChild = true;
+		T->ChildStart = cputime(T->ChildClock);
+	}
+	return true;
+}
+
+bool SMTTimer::end() {
+	SMTTimer *T = Current;
+	if (!T)
+		return false;
+	std::lock_guard<std::mutex> L(SMTWatchdog::get().Lock);
+	// Charge the time the child spent to the budget.
+	if (T->HasChild) {
+		unsigned long long Now = cputime(T->Clock);
+		T->Deadline -= std::min(T->Deadline, T->elapsed() - Now);
+		T->HasChild = false;
+	}
+	T->Target = NULL;
+	return T->Expired;
+}
+
+bool SMTTimer::armed() {
+	return Current != NULL;
+}
+
+bool SMTTimer::outOfTime() {
+	SMTTimer *T = Current;
+	if (!T)
+		return false;
+	std::lock_guard<std::mutex> L(SMTWatchdog::get().Lock);
+	return T->Expired;
+}
+
+unsigned SMTTimer::remaining() {
+	SMTTimer *T = Current;
+	if (!T || !T->Watched)
 		return 0;
-	pid = fork();
-	if (pid < 0)
-		err(1, "fork");
-	// Parent process.
-	if (pid)
+	std::lock_guard<std::mutex> L(SMTWatchdog::get().Lock);
+	unsigned long long Now = T->elapsed();
+	if (T->Expired || Now >= T->Deadline)
 		return 1;
-	// Child process.
-	struct itimerval itv = {{0, 0}, {(time_t)SMTTimeoutOpt / 1000, (suseconds_t)SMTTimeoutOpt % 1000 * 1000}};
-	setitimer(ITIMER_VIRTUAL, &itv, NULL);
-	return 0;
+	unsigned long long Left = (T->Deadline - Now + 999999) / 1000000;
+	return std::min(Left, (unsigned long long)UINT_MAX);
+}
+
+// Per query rather than per timer, so that an answer does not
+// depend on how many others in the scope the cache has settled.
+unsigned long long SMTTimer::budget() {
+	if (!Current || !SMTBudgetOpt || !countsSteps())
+		return 0;
+	return (unsigned long long)SMTBudgetOpt * 1000;
+}
+
+// Shared lock of the current thread.
+static __thread SMTSharedLock *Shared;
+
+SMTSharedLock::SMTSharedLock(std::mutex &L) : Lock(L), Prev(Shared) {
+	Lock.lock();
+	Shared = this;
+}
+
+SMTSharedLock::~SMTSharedLock() {
+	Shared = Prev;
+	Lock.unlock();
+}
+
+std::mutex *SMTSharedLock::held() {
+	return Shared ? &Shared->Lock : NULL;
+}
+
+void SMTSharedLock::release() {
+	if (Shared)
+		Shared->Lock.unlock();
 }
 
-void SMTJoin(int *status)
-{
-	if (!SMTTimeoutOpt)
+void SMTSharedLock::acquire() {
+	if (Shared)
+		Shared->Lock.lock();
+}
+
+namespace {
+	struct SMTBackendInfo {
+		const char *Name;
+		SMTBackend::Factory Create;
+		unsigned Priority;
+		bool CountsSteps;
+	};
+}
+
+// Filled in by static constructors, hence not a plain global.
+static std::vector<SMTBackendInfo> &backends() {
+	static std::vector<SMTBackendInfo> Backends;
+	return Backends;
+}
+
+SMTBackendRegistration::SMTBackendRegistration(const char *Name, SMTBackend::Factory Create, unsigned Priority, bool CountsSteps) {
+	SMTBackendInfo Info = {Name, Create, Priority, CountsSteps};
+	backends().push_back(Info);
+}
+
+// The backend the options ask for, or NULL if unknown.
+static const SMTBackendInfo *chosen(StringRef Name) {
+	const SMTBackendInfo *Best = NULL;
+	for (const SMTBackendInfo &Info : backends()) {
+		if (!Name.empty() && Name == Info.Name)
+			return &Info;
+		if (Name.empty() && (!Best || Info.Priority > Best->Priority))
+			Best = &Info;
+	}
+	return Best;
+}
+
+// Whether the backend queries go to counts steps; a portfolio does
+// not, as its backends race in time.
+static bool countsSteps() {
+	if (SMTPortfolioOpt.size() > 1)
+		return false;
+	const SMTBackendInfo *Info = chosen(SMTPortfolioOpt.empty() ? SMTBackendOpt : SMTPortfolioOpt[0]);
+	return Info && Info->CountsSteps;
+}
+
+SMTBackend *SMTBackend::create(StringRef Name, bool modelgen) {
+	std::string Linked;
+	for (const SMTBackendInfo &Info : backends()) {
+		if (Name == Info.Name)
+			return Info.Create(modelgen);
+		Linked += std::string(" ") + Info.Name;
+	}
+	errx(1, "unknown SMT backend: %s (linked in:%s)", Name.str().c_str(), Linked.c_str());
+}
+
+SMTBackend *SMTBackend::create(bool modelgen) {
+	if (SMTPortfolioOpt.size() > 1)
+		return createPortfolio(SMTPortfolioOpt, modelgen);
+	if (SMTPortfolioOpt.size() == 1)
+		return create(SMTPortfolioOpt[0], modelgen);
+	if (!SMTBackendOpt.empty())
+		return create(SMTBackendOpt, modelgen);
+	const SMTBackendInfo *Best = chosen("");
+	if (!Best)
+		errx(1, "no SMT backend");
+	return Best->Create(modelgen);
+}
+
+void SMTBackend::solve(unsigned n, const SMTExpr *Es, SMTStatus *Res) {
+	for (unsigned i = 0; i != n; ++i)
+		Res[i] = solve(Es[i], NULL);
+}
+
+void SMTBackend::core(SMTExpr, unsigned n, const SMTExpr *, bool *Core) {
+	std::fill(Core, Core + n, true);
+}
+
+// Backends without models never set one.
+void SMTBackend::eval(SMTModel, SMTExpr, APInt &) {
+	llvm_unreachable("No models!");
+}
+
+SMTSolver::SMTSolver(bool modelgen) : Backend(SMTBackend::create(modelgen)) {}
+
+SMTSolver::~SMTSolver() {
+	delete Backend;
+}
+
+void SMTSolver::assume(SMTExpr E) {
+	Backend->assume(E);
+	Assumed.push_back(E);
+}
+
+void SMTSolver::interrupt() {
+	Backend->interrupt();
+}
+
+void SMTSolver::eval(SMTModel M, SMTExpr E, APInt &V) {
+	Backend->eval(M, E, V);
+}
+
+void SMTSolver::release(SMTModel M) {
+	Backend->release(M);
+}
+
+namespace {
+	// Expressions belong to the solver, so a query does not need
+	// the shared lock.
+	struct SMTUnlocked {
+		SMTUnlocked() { SMTSharedLock::release(); }
+		~SMTUnlocked() { SMTSharedLock::acquire(); }
+	};
+}
+
+SMTStatus SMTSolver::query(SMTExpr E, SMTModel *M) {
+	// Only the solver produces models.
+	if (M) {
+		SMTUnlocked U;
+		return Backend->solve(simplify(E), M);
+	}
+	SMTStatus Status;
+	query(1, &E, &Status);
+	return Status;
+}
+
+// Try the cache, simulation and abstraction first; the solver gets
+// the rest.  Under a budget, each query goes to a backend of its
+// own, given only the assumptions it depends on, so that the steps
+// it takes do not depend on what the backend learned from earlier
+// queries, which the cache decides.
+void SMTSolver::query(unsigned n, const SMTExpr *Es, SMTStatus *Res) {
+	SMTUnlocked U;
+	unsigned long long Budget = SMTTimer::budget();
+	SmallVector<unsigned, 4> Pending;
+	SmallVector<SMTExpr, 4> Queries;
+	SmallVector<std::string, 4> Keys;
+	for (unsigned i = 0; i != n; ++i) {
+		SMTExpr E = simplify(Es[i]);
+		SmallVector<SMTExpr, 8> Roots;
+		Roots.push_back(E);
+		depends(E, Roots);
+		std::string Key = SMTCache::key(Roots);
+		if (SMTCache::lookup(Key, Res[i]))
+			continue;
+		if (simulate(Roots)) {
+			Res[i] = SMT_SAT;
+			SMTCache::insert(Key, SMT_SAT);
+			continue;
+		}
+		if (Budget) {
+			std::unique_ptr<SMTBackend> B(SMTBackend::create(false));
+			for (unsigned k = 1, e = Roots.size(); k != e; ++k)
+				B->assume(Roots[k]);
+			if (!abstract(B.get(), E, Res[i]))
+				Res[i] = B->solve(E, NULL);
+			SMTCache::insert(Key, Res[i]);
+			continue;
+		}
+		if (abstract(Backend, E, Res[i])) {
+			SMTCache::insert(Key, Res[i]);
+			continue;
+		}
+		Pending.push_back(i);
+		Queries.push_back(E);
+		Keys.push_back(Key);
+	}
+	if (Queries.empty())
 		return;
-	// Child process.
-	if (pid == 0)
-		_exit(*status);
-	// Parent process.
-	waitpid(pid, status, 0);
-	if (WIFEXITED(*status))
-		*status = WEXITSTATUS(*status);
-	else
-		*status = -1;
+	SmallVector<SMTStatus, 4> Status(Queries.size());
+	Backend->solve(Queries.size(), Queries.data(), Status.data());
+	for (unsigned i = 0, e = Pending.size(); i != e; ++i) {
+		Res[Pending[i]] = Status[i];
+		SMTCache::insert(Keys[i], Status[i]);
+	}
+}
+
+void SMTSolver::unsatCore(SMTExpr E, unsigned n, const SMTExpr *Lits, bool *Core) {
+	SMTUnlocked U;
+	Backend->core(E, n, Lits, Core);
+}
+
+static void collectVars(SMTExpr E, SmallPtrSet<SMTExpr, 32> &Visited,
+                        SmallPtrSet<SMTExpr, 16> &Vars) {
+	SmallVector<SMTExpr, 32> Stack;
+	Stack.push_back(E);
+	while (!Stack.empty()) {
+		SMTExpr X = Stack.pop_back_val();
+		if (Visited.count(X))
+			continue;
+		Visited.insert(X);
+		if (X->getOpcode() == SMT_VAR)
+			Vars.insert(X);
+		for (unsigned i = 0, n = X->getNumOperands(); i != n; ++i)
+			Stack.push_back(X->getOperand(i));
+	}
+}
+
+void SMTSolver::depends(SMTExpr E, SmallVectorImpl<SMTExpr> &Roots) {
+	SmallVector<SMTExpr, 16> Parts(Assumed.begin(), Assumed.end());
+	slice(E, Parts);
+	for (SMTExpr A : Parts) {
+		if (A)
+			Roots.push_back(A);
+	}
+}
+
+void SMTSolver::conjuncts(SMTExpr E, SmallVectorImpl<SMTExpr> &Parts) {
+	SmallPtrSet<SMTExpr, 32> Visited;
+	SmallVector<SMTExpr, 32> Stack;
+	Stack.push_back(E);
+	while (!Stack.empty()) {
+		SMTExpr X = Stack.pop_back_val();
+		if (Visited.count(X))
+			continue;
+		Visited.insert(X);
+		if (X->getOpcode() != SMT_AND || X->getWidth() != 1) {
+			Parts.push_back(X);
+			continue;
+		}
+		Stack.push_back(X->getOperand(1));
+		Stack.push_back(X->getOperand(0));
+	}
+}
+
+void SMTSolver::slice(SMTExpr E, MutableArrayRef<SMTExpr> Parts) {
+	SmallPtrSet<SMTExpr, 32> Visited;
+	SmallPtrSet<SMTExpr, 16> Vars;
+	collectVars(E, Visited, Vars);
+	unsigned n = Parts.size();
+	SmallVector<SmallPtrSet<SMTExpr, 16>, 16> PartVars(n);
+	SmallVector<bool, 16> Used(n);
+	for (unsigned i = 0; i != n; ++i) {
+		SmallPtrSet<SMTExpr, 32> Seen;
+		collectVars(Parts[i], Seen, PartVars[i]);
+		// A constant may be false, which decides the answer.
+		Used[i] = PartVars[i].empty();
+	}
+	for (bool Changed = true; Changed; ) {
+		Changed = false;
+		for (unsigned i = 0; i != n; ++i) {
+			if (Used[i])
+				continue;
+			bool Shared = false;
+			for (SmallPtrSet<SMTExpr, 16>::iterator v = PartVars[i].begin(), ve = PartVars[i].end(); v != ve; ++v)
+				Shared |= Vars.count(*v);
+			if (!Shared)
+				continue;
+			Used[i] = true;
+			Changed = true;
+			Vars.insert(PartVars[i].begin(), PartVars[i].end());
+		}
+	}
+	for (unsigned i = 0; i != n; ++i) {
+		if (!Used[i])
+			Parts[i] = NULL;
+	}
 }
@@ -1,9 +1,12 @@
 #pragma once
 
-namespace llvm {
-	class APInt;
-	class raw_ostream;
-} // namespace llvm
+#include "SMTExpr.h"
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <time.h>
 
 enum SMTStatus {
 	SMT_TIMEOUT = -1,
@@ -12,30 +15,158 @@ enum SMTStatus {
 	SMT_SAT,
 };
 
-typedef void *SMTContext;
-typedef void *SMTExpr;
+typedef const SMTNode *SMTExpr;
 typedef void *SMTModel;
 
-int SMTFork();
-void SMTJoin(int *);
+class SMTBackend;
+
+// Limit the SMT queries issued within the scope of a timer to
+// -smt-timeout milliseconds of CPU time of the calling thread in
+// total.  A watchdog thread interrupts a query running past the
+// limit, which then returns SMT_TIMEOUT, as do later queries.
+// -smt-budget limits each query to thousands of solver steps
+// instead, which, unlike time, gives the same answers on every
+// machine; the time limit still applies if the backend cannot
+// count steps.
+class SMTTimer {
+public:
+	SMTTimer();
+	// A timer of Ms milliseconds, or of none if 0, for a thread
+	// working for another, such as a backend in a portfolio race.
+	explicit SMTTimer(unsigned Ms);
+	~SMTTimer();
+
+	bool expired() const;
+
+	// Backends call these around each solver call.
+	// begin() returns false if the current timer has expired;
+	// end() returns true if the solver has been interrupted.
+	// A backend running the solver in a child process passes
+	// its pid, so that the CPU time of the child counts too.
+	static bool begin(SMTBackend *, pid_t = 0);
+	static bool end();
+	// True if there is a current timer, so that a query may be
+	// interrupted; a backend that cannot stop a running query
+	// must then run it in a child.
+	static bool armed();
+	// True if the current timer, if any, has expired.
+	static bool outOfTime();
+	// Milliseconds of CPU time left to the current timer, at
+	// least 1, or 0 if there is none; for backends that limit
+	// the time of a query themselves.
+	static unsigned remaining();
+	// Steps a query within the current timer may take, or 0 if
+	// there is no budget; a backend that counts steps stops the
+	// query there and returns SMT_TIMEOUT, and the timer goes on.
+	static unsigned long long budget();
+
+private:
+	friend struct SMTWatchdog;
+	void arm(unsigned Ms);
+	unsigned long long elapsed() const;
+	clockid_t Clock, ChildClock;
+	unsigned long long Deadline, ChildStart;
+	bool HasChild;
+	bool Armed;
+	// Registered with the watchdog for a time limit.
+	bool Watched;
+	bool Expired;
+	SMTBackend *Target;
+	SMTTimer *Prev, *Next;
+};
+
+// Within the scope of an SMTSharedLock, the calling thread holds
+// the lock except during queries, so that other threads may use
+// what it guards, such as the IR, while this one waits for the
+// solver.
+class SMTSharedLock {
+public:
+	explicit SMTSharedLock(std::mutex &);
+	~SMTSharedLock();
+
+	// Return the lock the calling thread holds, or NULL.
+	static std::mutex *held();
+	// Called by the query front ends around solver calls.
+	static void release();
+	static void acquire();
+
+private:
+	std::mutex &Lock;
+	SMTSharedLock *Prev;
+};
+
+// A solver library, such as Boolector, behind SMTSolver.  A backend
+// translates expressions when it first sees them, in assume() or a
+// query.  Each SMT*.cc defines one and registers it by name, so that
+// several may be linked into libsat.
+class SMTBackend {
+public:
+	virtual ~SMTBackend() {}
+
+	virtual void assume(SMTExpr) = 0;
+	// Set the model only on SAT, if asked for and supported.
+	virtual SMTStatus solve(SMTExpr, SMTModel *) = 0;
+	// By default, solve the queries one by one.
+	virtual void solve(unsigned n, const SMTExpr *, SMTStatus *);
+	// By default, mark all of Lits; see SMTSolver::unsatCore().
+	virtual void core(SMTExpr, unsigned n, const SMTExpr *Lits, bool *Core);
+	// Abort a running query, from another thread; the backend
+	// may be unusable afterwards.
+	virtual void interrupt() = 0;
+	virtual void eval(SMTModel, SMTExpr, llvm::APInt &);
+	virtual void release(SMTModel) {}
+
+	typedef SMTBackend *(*Factory)(bool modelgen);
+	// The backend of the given name, or the one the options ask for.
+	static SMTBackend *create(llvm::StringRef Name, bool modelgen);
+	static SMTBackend *create(bool modelgen);
+	// Race the named backends on each query; see SMTPortfolio.cc.
+	static SMTBackend *createPortfolio(llvm::ArrayRef<std::string> Names, bool modelgen);
+};
+
+// Link a backend in by a static instance of this.  Unless -smt-backend
+// or -smt-portfolio says otherwise, queries go to the backend of the
+// highest priority.  A backend that counts steps honors -smt-budget.
+struct SMTBackendRegistration {
+	SMTBackendRegistration(const char *Name, SMTBackend::Factory, unsigned Priority = 0, bool CountsSteps = false);
+};
 
 class SMTSolver {
 public:
 	SMTSolver(bool modelgen);
 	~SMTSolver();
 
+	// True if queries may need models from the backend, even when
+	// the solver is created without modelgen; see abstract().
+	static bool abstracts();
+
 	void assume(SMTExpr);
 
 	SMTStatus query(SMTExpr, SMTModel * = 0);
+	// Solve independent queries at once; an external solver
+	// gets all of them before any answer is read.
+	void query(unsigned n, const SMTExpr *, SMTStatus *);
+	// Given that E and all of Lits are unsat together, mark in
+	// Core a subset of Lits that is still unsat with E, from the
+	// solver's failed assumptions.  Backends that cannot tell
+	// mark all of them.
+	void unsatCore(SMTExpr E, unsigned n, const SMTExpr *Lits, bool *Core);
+	// Split E into its top-level conjuncts.
+	void conjuncts(SMTExpr E, llvm::SmallVectorImpl<SMTExpr> &);
+	// Cone of influence: clear the Parts that share no variables
+	// with E, directly or through other Parts kept.  If E and the
+	// Parts kept are unsat together, so are E and all the Parts;
+	// if sat, so are they all, unless a part cleared is unsat on
+	// its own.
+	void slice(SMTExpr E, llvm::MutableArrayRef<SMTExpr> Parts);
+	// Abort a running query from another thread.
+	void interrupt();
 	void eval(SMTModel, SMTExpr, llvm::APInt &);
 	void release(SMTModel);
 
 	void dump(SMTExpr);
 	void print(SMTExpr, llvm::raw_ostream &);
 
-	void incref(SMTExpr);
-	void decref(SMTExpr);
-
 	unsigned bvwidth(SMTExpr);
 
 	SMTExpr bvfalse();
@@ -93,5 +224,29 @@ public:
 	SMTExpr bvsdiv_overflow(SMTExpr, SMTExpr);
 
 private:
-	SMTContext ctx_;
+	// Apply the word-level rewrites to a node with new operands.
+	SMTExpr rebuild(const SMTNode *, const SMTExpr *);
+	// Propagate top-level equalities with constants.
+	SMTExpr simplify(SMTExpr);
+	// Add the assumptions that share variables with E, directly
+	// or through other assumptions.  The rest are taken to be
+	// satisfiable on their own and do not affect the answer.
+	void depends(SMTExpr, llvm::SmallVectorImpl<SMTExpr> &);
+	// Look for an assignment satisfying all of the expressions
+	// by evaluating them on random inputs; true if one is found.
+	bool simulate(llvm::ArrayRef<SMTExpr>);
+	// Solve E with wide nonlinear operators abstracted, refining
+	// them as models of B show wrong; false if E has none or B
+	// gives no model, in which case Status is not set.
+	bool abstract(SMTBackend *B, SMTExpr E, SMTStatus &Status);
+	SMTExpr axioms(SMTExpr Exact, SMTExpr Var);
+	bool holds(SMTBackend *B, SMTModel, SMTExpr Exact, SMTExpr Var);
+
+	// Expressions are built here; a backend sees them when a
+	// query is solved.
+	SMTArena Arena;
+	llvm::SmallVector<SMTExpr, 16> Assumed;
+	// Gets the simplified queries that neither the cache nor
+	// simulation settles, unless there is a budget; see query().
+	SMTBackend *Backend;
 };
@@ -1,254 +1,172 @@
 #include "SMTSolver.h"
 #include <sonolar/sonolar.h>
 #include <llvm/ADT/APInt.h>
-#include <llvm/Support/Debug.h>
-#include <llvm/Support/raw_ostream.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/Support/ErrorHandling.h>
 #include <assert.h>
+#include <err.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 using namespace llvm;
 
-#define ctx ((sonolar_t)ctx_)
-#define m   ((sonolar_t *)m_)
-#define e   ((sonolar_term_t *)e_)
-#define lhs ((sonolar_term_t *)lhs_)
-#define rhs ((sonolar_term_t *)rhs_)
-
-SMTSolver::SMTSolver(bool /*modelgen*/) {
-	ctx_ = sonolar_create();
-	if (sonolar_set_sat_solver(ctx, SONOLAR_SAT_SOLVER_MINISAT))
-		assert(0 && "sonolar_set_sat_solver");
-}
-
-SMTSolver::~SMTSolver() {
-	sonolar_destroy(ctx);
-}
-
-void SMTSolver::assume(SMTExpr e_) {
-	sonolar_assert_formula(ctx, e);
-}
-
-SMTStatus SMTSolver::query(SMTExpr e_, SMTModel *m_) {
-	if (sonolar_assume_formula(ctx, e))
-		assert(0 && "sonolar_assume_formula");
-	switch (sonolar_solve(ctx)) {
-	default:                         return SMT_UNDEF;
-	case SONOLAR_SOLVE_RESULT_UNSAT: return SMT_UNSAT;
-	case SONOLAR_SOLVE_RESULT_SAT:   break;
+static sonolar_term_t *build(sonolar_t s, const SMTNode *N, sonolar_term_t **ops) {
+	sonolar_term_t *lhs = ops[0], *rhs = ops[1];
+	switch (N->getOpcode()) {
+	default: llvm_unreachable("Unknown opcode!");
+	case SMT_CONST:
+		return sonolar_make_constant_bytes(s, N->getValue().getRawData(), N->getWidth(), SONOLAR_BYTE_ORDER_NATIVE);
+	case SMT_VAR:     return sonolar_make_variable(s, N->getWidth(), N->getName());
+	case SMT_ITE:     return sonolar_make_ite(s, ops[0], ops[1], ops[2]);
+	case SMT_EQ:      return sonolar_make_equal(s, lhs, rhs);
+	case SMT_SLT:     return sonolar_make_bv_slt(s, lhs, rhs);
+	case SMT_SLE:     return sonolar_make_bv_sle(s, lhs, rhs);
+	case SMT_ULT:     return sonolar_make_bv_ult(s, lhs, rhs);
+	case SMT_ULE:     return sonolar_make_bv_ule(s, lhs, rhs);
+	case SMT_EXTRACT: return sonolar_make_bv_extract(s, lhs, N->getParam(0), N->getParam(1));
+	case SMT_ZEXT:    return sonolar_make_bv_zero_extend(s, lhs, N->getParam(0));
+	case SMT_SEXT:    return sonolar_make_bv_sign_extend(s, lhs, N->getParam(0));
+	case SMT_REDAND: {
+		sonolar_term_t *neg = sonolar_make_bv_not(s, lhs);
+		sonolar_term_t *tmp = sonolar_make_is_zero(s, neg);
+		sonolar_remove_reference(s, neg);
+		return tmp;
+	}
+	case SMT_REDOR: {
+		sonolar_term_t *z = sonolar_make_is_zero(s, lhs);
+		sonolar_term_t *nz = sonolar_make_not(s, z);
+		sonolar_remove_reference(s, z);
+		return nz;
+	}
+	case SMT_NOT:     return sonolar_make_bv_not(s, lhs);
+	case SMT_NEG:     return sonolar_make_bv_neg(s, lhs);
+	case SMT_ADD:     return sonolar_make_bv_add(s, lhs, rhs);
+	case SMT_SUB:     return sonolar_make_bv_sub(s, lhs, rhs);
+	case SMT_MUL:     return sonolar_make_bv_mul(s, lhs, rhs);
+	case SMT_SDIV:    return sonolar_make_bv_sdiv(s, lhs, rhs);
+	case SMT_UDIV:    return sonolar_make_bv_udiv(s, lhs, rhs);
+	case SMT_SREM:    return sonolar_make_bv_srem(s, lhs, rhs);
+	case SMT_UREM:    return sonolar_make_bv_urem(s, lhs, rhs);
+	case SMT_SHL:     return sonolar_make_bv_shl(s, lhs, rhs);
+	case SMT_LSHR:    return sonolar_make_bv_lshr(s, lhs, rhs);
+	case SMT_ASHR:    return sonolar_make_bv_ashr(s, lhs, rhs);
+	case SMT_AND:     return sonolar_make_bv_and(s, lhs, rhs);
+	case SMT_OR:      return sonolar_make_bv_or(s, lhs, rhs);
+	case SMT_XOR:     return sonolar_make_bv_xor(s, lhs, rhs);
+	case SMT_SADDO:   return sonolar_make_bv_sadd_ovfl(s, lhs, rhs);
+	case SMT_UADDO:   return sonolar_make_bv_uadd_ovfl(s, lhs, rhs);
+	case SMT_SSUBO:   return sonolar_make_bv_ssub_ovfl(s, lhs, rhs);
+	case SMT_USUBO:   return sonolar_make_bv_usub_ovfl(s, lhs, rhs);
+	case SMT_SMULO:   return sonolar_make_bv_smul_ovfl(s, lhs, rhs);
+	case SMT_UMULO:   return sonolar_make_bv_umul_ovfl(s, lhs, rhs);
+	case SMT_SDIVO:   return sonolar_make_bv_sdiv_ovfl(s, lhs, rhs);
 	}
-	if (m_)
-		*m_ = ctx;
-	return SMT_SAT;
-}
-
-void SMTSolver::eval(SMTModel m_, SMTExpr e_, APInt &) {
-	assert(0 && "NOT SUPPORTED");
-}
-
-void SMTSolver::release(SMTModel m_) {}
-
-void SMTSolver::dump(SMTExpr e_) {
-	print(e, dbgs());
-	dbgs() << "\n";
-}
-
-void SMTSolver::print(SMTExpr e_, raw_ostream &OS) {
-	OS << "NOT SUPPORTED";
-}
-
-void SMTSolver::incref(SMTExpr e_) {
-	sonolar_add_reference(ctx, e);
-}
-
-void SMTSolver::decref(SMTExpr e_) {
-	sonolar_remove_reference(ctx, e);
-}
-
-unsigned SMTSolver::bvwidth(SMTExpr e_) {
-	size_t width;
-	if (sonolar_get_bitwidth(ctx, e, &width))
-		assert(0 && "sonolar_get_bitwidth");
-	return (unsigned)width;
-}
-
-SMTExpr SMTSolver::bvfalse() {
-	return sonolar_make_constant_false(ctx);
-}
-
-SMTExpr SMTSolver::bvtrue() {
-	return sonolar_make_constant_true(ctx);
-}
-
-SMTExpr SMTSolver::bvconst(const APInt &Val) {
-	const void *data = Val.getRawData();
-	unsigned width = Val.getBitWidth();
-	return sonolar_make_constant_bytes(ctx, data, width, SONOLAR_BYTE_ORDER_NATIVE);
-}
-
-SMTExpr SMTSolver::bvvar(unsigned width, const char *name) {
-	return sonolar_make_variable(ctx, width, name);
-}
-
-SMTExpr SMTSolver::ite(SMTExpr e_, SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_ite(ctx, e, lhs, rhs);
-}
-
-SMTExpr SMTSolver::eq(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_equal(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::ne(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_distinct(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvslt(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_slt(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvsle(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_sle(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvsgt(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_sgt(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvsge(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_sge(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvult(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_ult(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvule(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_ule(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvugt(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_ugt(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvuge(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_uge(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::extract(unsigned high, unsigned low, SMTExpr e_) {
-	return sonolar_make_bv_extract(ctx, e, high, low);
-}
-
-SMTExpr SMTSolver::zero_extend(unsigned i, SMTExpr e_) {
-	return sonolar_make_bv_zero_extend(ctx, e, i);
-}
-
-SMTExpr SMTSolver::sign_extend(unsigned i, SMTExpr e_) {
-	return sonolar_make_bv_sign_extend(ctx, e, i);
-}
-
-SMTExpr SMTSolver::bvredand(SMTExpr e_) {
-	SMTExpr neg = bvnot(e);
-	SMTExpr tmp = sonolar_make_is_zero(ctx, neg);
-	decref(neg);
-	return tmp;
-}
-
-SMTExpr SMTSolver::bvredor(SMTExpr e_) {
-	SMTExpr z = sonolar_make_is_zero(ctx, e);
-	SMTExpr nz = sonolar_make_not(ctx, z);
-	decref(z);
-	return nz;
-}
-
-SMTExpr SMTSolver::bvnot(SMTExpr e_) {
-	return sonolar_make_bv_not(ctx, e);
-}
-
-SMTExpr SMTSolver::bvneg(SMTExpr e_) {
-	return sonolar_make_bv_neg(ctx, e);
-}
-
-SMTExpr SMTSolver::bvadd(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_add(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvsub(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_sub(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvmul(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_mul(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvsdiv(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_sdiv(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvudiv(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_udiv(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvsrem(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_srem(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvurem(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_urem(ctx, lhs, rhs);
 }
 
-SMTExpr SMTSolver::bvshl(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_shl(ctx, lhs, rhs);
-}
+namespace {
 
-SMTExpr SMTSolver::bvlshr(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_lshr(ctx, lhs, rhs);
-}
+// No models; solve() never sets one.
+class SMTSonolar : public SMTBackend {
+public:
+	SMTSonolar();
+	~SMTSonolar();
 
-SMTExpr SMTSolver::bvashr(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_ashr(ctx, lhs, rhs);
-}
+	using SMTBackend::solve;
+	void assume(SMTExpr);
+	SMTStatus solve(SMTExpr, SMTModel *);
+	void interrupt();
 
-SMTExpr SMTSolver::bvand(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_and(ctx, lhs, rhs);
-}
+private:
+	sonolar_t s;
+	// The child solving the current query under a time limit, or 0.
+	volatile pid_t child;
+	// Sonolar terms of translated expressions.
+	DenseMap<const SMTNode *, sonolar_term_t *> terms;
 
-SMTExpr SMTSolver::bvor(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_or(ctx, lhs, rhs);
-}
+	sonolar_term_t *term(SMTExpr e_) {
+		sonolar_t s = this->s;
+		return translateSMT(terms, e_, [s](const SMTNode *N, sonolar_term_t **ops) {
+			return build(s, N, ops);
+		});
+	}
+};
 
-SMTExpr SMTSolver::bvxor(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_xor(ctx, lhs, rhs);
-}
+} // anonymous namespace
 
-SMTExpr SMTSolver::bvneg_overflow(SMTExpr e_) {
-	SMTExpr zero = sonolar_make_constant_0_bits(ctx, bvwidth(e));
-	SMTExpr tmp = bvssub_overflow(zero, e);
-	decref(zero);
-	return tmp;
+SMTSonolar::SMTSonolar() : child(0) {
+	s = sonolar_create();
+	if (sonolar_set_sat_solver(s, SONOLAR_SAT_SOLVER_MINISAT))
+		assert(0 && "sonolar_set_sat_solver");
 }
 
-SMTExpr SMTSolver::bvsadd_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_sadd_ovfl(ctx, lhs, rhs);
+SMTSonolar::~SMTSonolar() {
+	sonolar_destroy(s);
 }
 
-SMTExpr SMTSolver::bvuadd_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_uadd_ovfl(ctx, lhs, rhs);
+void SMTSonolar::assume(SMTExpr e_) {
+	sonolar_assert_formula(s, term(e_));
 }
 
-SMTExpr SMTSolver::bvssub_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_ssub_ovfl(ctx, lhs, rhs);
+static SMTStatus status(int res) {
+	switch (res) {
+	default:                         return SMT_UNDEF;
+	case SONOLAR_SOLVE_RESULT_UNSAT: return SMT_UNSAT;
+	case SONOLAR_SOLVE_RESULT_SAT:   return SMT_SAT;
+	}
 }
 
-SMTExpr SMTSolver::bvusub_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_usub_ovfl(ctx, lhs, rhs);
+// Sonolar cannot be interrupted.  Under a timer, which may interrupt
+// the query, as may a portfolio race, solve in a forked child, which
+// interrupt() kills, as SMTFork did before; what the child learns is
+// lost with it.
+SMTStatus SMTSonolar::solve(SMTExpr e_, SMTModel *m_) {
+	sonolar_term_t *e = term(e_);
+	if (!SMTTimer::armed()) {
+		if (sonolar_assume_formula(s, e))
+			assert(0 && "sonolar_assume_formula");
+		return status(sonolar_solve(s));
+	}
+	if (SMTTimer::outOfTime())
+		return SMT_TIMEOUT;
+	int fds[2];
+	if (pipe(fds))
+		err(1, "pipe");
+	pid_t pid = fork();
+	if (pid < 0)
+		err(1, "fork");
+	if (pid == 0) {
+		close(fds[0]);
+		if (sonolar_assume_formula(s, e))
+			_exit(1);
+		int res = sonolar_solve(s);
+		if (write(fds[1], &res, sizeof(res)) != sizeof(res))
+			_exit(1);
+		_exit(0);
+	}
+	close(fds[1]);
+	child = pid;
+	int res;
+	bool done = SMTTimer::begin(this, pid) && read(fds[0], &res, sizeof(res)) == sizeof(res);
+	bool expired = SMTTimer::end();
+	child = 0;
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	close(fds[0]);
+	// A child killed or crashed counts as timed out.
+	if (expired || !done)
+		return SMT_TIMEOUT;
+	return status(res);
 }
 
-SMTExpr SMTSolver::bvsmul_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_smul_ovfl(ctx, lhs, rhs);
+void SMTSonolar::interrupt() {
+	pid_t pid = child;
+	if (pid)
+		kill(pid, SIGKILL);
 }
 
-SMTExpr SMTSolver::bvumul_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_umul_ovfl(ctx, lhs, rhs);
+static SMTBackend *create(bool) {
+	return new SMTSonolar;
 }
 
-SMTExpr SMTSolver::bvsdiv_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	return sonolar_make_bv_sdiv_ovfl(ctx, lhs, rhs);
-}
+static SMTBackendRegistration R("sonolar", create);
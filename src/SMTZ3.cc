@@ -1,125 +1,109 @@
+// Z3 through its solver API, on a reference-counted context, so that
+// terms of queries are freed once no longer referenced rather than
+// when the solver goes away.  The solver runs an explicit tactic:
+// simplify, then qfbv, which preprocesses and bit-blasts to SAT.
+// Each query is guarded by an activation literal passed as an
+// assumption, and retired afterwards.
+
 #include "SMTSolver.h"
 #include <llvm/ADT/APInt.h>
+#include <llvm/ADT/DenseMap.h>
 #include <llvm/ADT/SmallString.h>
-#include <llvm/Support/Debug.h>
-#include <llvm/Support/raw_ostream.h>
-#include <assert.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/ErrorHandling.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <limits.h>
+#include <string.h>
 #include <z3.h>
 
 using namespace llvm;
 
-struct SMTContextImpl {
-	Z3_context c;
-	Z3_ast bvfalse;
-	Z3_ast bvtrue;
-};
-
-#define imp ((SMTContextImpl *)ctx_)
-#define ctx (imp->c)
-#define m   ((Z3_model)m_)
-#define e   ((Z3_ast)e_)
-#define lhs ((Z3_ast)lhs_)
-#define rhs ((Z3_ast)rhs_)
-
-static inline Z3_ast bv2bool_(SMTContextImpl *ctx_, Z3_ast e0) {
-	return Z3_mk_eq(ctx, e0, ctx_->bvtrue);
-}
-
-static inline Z3_ast bool2bv_(SMTContextImpl *ctx_, Z3_ast e0) {
-	return Z3_mk_ite(ctx, e0, ctx_->bvtrue, ctx_->bvfalse);
-}
+namespace {
 
-#define bv2bool(x) bv2bool_(imp, x)
-#define bool2bv(x) bool2bv_(imp, x)
+class SMTZ3 : public SMTBackend {
+public:
+	explicit SMTZ3(bool modelgen);
+	~SMTZ3();
 
-SMTSolver::SMTSolver(bool modelgen) {
-	ctx_ = new SMTContextImpl;
-	Z3_config cfg = Z3_mk_config();
-	// Enable model construction.
-	if (modelgen)
-		Z3_set_param_value(cfg, "MODEL", "true");
-	ctx = Z3_mk_context(cfg);
-	Z3_del_config(cfg);
-	// Set up constants.
-	Z3_sort sort = Z3_mk_bv_sort(ctx, 1);
-	imp->bvfalse = Z3_mk_int(ctx, 0, sort);
-	imp->bvtrue = Z3_mk_int(ctx, 1, sort);
-}
+	using SMTBackend::solve;
+	void assume(SMTExpr);
+	SMTStatus solve(SMTExpr, SMTModel *);
+	void core(SMTExpr, unsigned n, const SMTExpr *, bool *);
+	void interrupt();
+	void eval(SMTModel, SMTExpr, APInt &);
+	void release(SMTModel);
 
-SMTSolver::~SMTSolver() {
-	Z3_del_context(ctx);
-	delete imp;
-}
+private:
+	Z3_context ctx;
+	Z3_solver solver;
+	Z3_ast bvfalse;
+	Z3_ast bvtrue;
+	// Z3 terms of translated expressions, each holding a reference.
+	DenseMap<const SMTNode *, Z3_ast> terms;
+	// Intermediate terms, referenced until the current node or
+	// query is done.
+	SmallVector<Z3_ast, 8> temps;
+	// Z3_interrupt() is lost if no check is running, so interrupt()
+	// repeats it until a check in progress returns; see check().
+	std::atomic<bool> interrupted, checking;
+
+	// A term without a reference lives only until the next call.
+	Z3_ast keep(Z3_ast e) {
+		Z3_inc_ref(ctx, e);
+		temps.push_back(e);
+		return e;
+	}
 
-void SMTSolver::assume(SMTExpr e_) {
-	Z3_assert_cnstr(ctx, bv2bool(e));
-}
+	void drop() {
+		for (unsigned i = 0, n = temps.size(); i != n; ++i)
+			Z3_dec_ref(ctx, temps[i]);
+		temps.clear();
+	}
 
-SMTStatus SMTSolver::query(SMTExpr e_, SMTModel *m_) {
-	Z3_push(ctx);
-	Z3_assert_cnstr(ctx, bv2bool(e));
-	Z3_lbool res = Z3_check_and_get_model(ctx, (Z3_model *)m_);
-	Z3_pop(ctx, 1);
-	switch (res) {
-	default:         return SMT_UNDEF;
-	case Z3_L_FALSE: return SMT_UNSAT;
-	case Z3_L_TRUE:  return SMT_SAT;
+	Z3_ast bv2bool(Z3_ast e0) {
+		return keep(Z3_mk_eq(ctx, e0, bvtrue));
 	}
-}
 
-void SMTSolver::eval(SMTModel m_, SMTExpr e_, APInt &r) {
-	Z3_ast v = 0;
-	Z3_bool ret = Z3_model_eval(ctx, m, e, Z3_TRUE, &v);
-	assert(ret);
-	assert(v);
-	if (Z3_is_numeral_ast(ctx, v)) {
-		r = APInt(bvwidth(v), Z3_get_numeral_string(ctx, v), 10);
-		return;
+	Z3_ast bool2bv(Z3_ast e0) {
+		return keep(Z3_mk_ite(ctx, e0, bvtrue, bvfalse));
 	}
-	if (bvwidth(v) == 1 && Z3_is_app(ctx, v)) {
-		Z3_push(ctx);
-		Z3_assert_cnstr(ctx, Z3_mk_eq(ctx, v, imp->bvtrue));
-		switch (Z3_check(ctx)) {
-		default: assert(0);
-		case Z3_L_FALSE: r = APInt(1, 0); break;
-		case Z3_L_TRUE:  r = APInt(1, 1); break;
+
+	// 1 if any of the no-overflow checks, which must be kept,
+	// fails.
+	Z3_ast fails(Z3_ast no_ovfl, Z3_ast no_udfl = NULL) {
+		Z3_ast ok = no_ovfl;
+		if (no_udfl) {
+			Z3_ast args[] = {no_ovfl, no_udfl};
+			ok = keep(Z3_mk_and(ctx, 2, args));
 		}
-		Z3_pop(ctx, 1);
-		return;
+		return bool2bv(keep(Z3_mk_not(ctx, ok)));
 	}
-	assert(0);
-}
-
-void SMTSolver::release(SMTModel m_) {
-	Z3_del_model(ctx, m);
-}
 
-void SMTSolver::dump(SMTExpr e_) {
-	print(e, dbgs());
-	dbgs() << "\n";
-}
-
-void SMTSolver::print(SMTExpr e_, raw_ostream &OS) {
-	OS << Z3_ast_to_string(ctx, Z3_simplify(ctx, e));
-}
-
-// Managed by Z3, no reference counting.
-void SMTSolver::incref(SMTExpr) { }
-void SMTSolver::decref(SMTExpr) { }
-
-unsigned SMTSolver::bvwidth(SMTExpr e_) {
-	return Z3_get_bv_sort_size(ctx, Z3_get_sort(ctx, e));
-}
+	Z3_ast act();
+	Z3_ast bvconst(const APInt &);
+	Z3_ast build(const SMTNode *N, Z3_ast *ops);
+	Z3_lbool check(unsigned n, Z3_ast *acts, bool cores = false);
+	void retire(unsigned n, Z3_ast *acts);
+
+	Z3_ast term(SMTExpr e_) {
+		return translateSMT(terms, e_, [this](const SMTNode *N, Z3_ast *ops) {
+			Z3_ast e = build(N, ops);
+			Z3_inc_ref(ctx, e);
+			drop();
+			return e;
+		});
+	}
+};
 
-SMTExpr SMTSolver::bvfalse() {
-	return imp->bvfalse;
-}
+} // anonymous namespace
 
-SMTExpr SMTSolver::bvtrue() {
-	return imp->bvtrue;
-}
+#define m ((Z3_model)m_)
 
-SMTExpr SMTSolver::bvconst(const APInt &Val) {
+Z3_ast SMTZ3::bvconst(const APInt &Val) {
 	unsigned width = Val.getBitWidth();
 	Z3_sort t = Z3_mk_bv_sort(ctx, width);
 	if (width <= 64)
@@ -129,171 +113,231 @@ SMTExpr SMTSolver::bvconst(const APInt &Val) {
 	return Z3_mk_numeral(ctx, s.c_str(), t);
 }
 
-SMTExpr SMTSolver::bvvar(unsigned width, const char *name) {
-	return Z3_mk_const(ctx, Z3_mk_string_symbol(ctx, name), Z3_mk_bv_sort(ctx, width));
-}
-
-SMTExpr SMTSolver::ite(SMTExpr e_, SMTExpr lhs_, SMTExpr rhs_) {
-	return Z3_mk_ite(ctx, bv2bool(e), lhs, rhs);
-}
-
-SMTExpr SMTSolver::eq(SMTExpr lhs_, SMTExpr rhs_) {
-	return bool2bv(Z3_mk_eq(ctx, lhs, rhs));
-}
-
-SMTExpr SMTSolver::ne(SMTExpr lhs_, SMTExpr rhs_) {
-	return bvnot(eq(lhs_, rhs_));
-}
-
-SMTExpr SMTSolver::bvslt(SMTExpr lhs_, SMTExpr rhs_) {
-	return bool2bv(Z3_mk_bvslt(ctx, lhs, rhs));
-}
-
-SMTExpr SMTSolver::bvsle(SMTExpr lhs_, SMTExpr rhs_) {
-	return bool2bv(Z3_mk_bvsle(ctx, lhs, rhs));
-}
-
-SMTExpr SMTSolver::bvsgt(SMTExpr lhs_, SMTExpr rhs_) {
-	return bool2bv(Z3_mk_bvsgt(ctx, lhs, rhs));
-}
-
-SMTExpr SMTSolver::bvsge(SMTExpr lhs_, SMTExpr rhs_) {
-	return bool2bv(Z3_mk_bvsge(ctx, lhs, rhs));
-}
-
-SMTExpr SMTSolver::bvult(SMTExpr lhs_, SMTExpr rhs_) {
-	return bool2bv(Z3_mk_bvult(ctx, lhs, rhs));
-}
-
-SMTExpr SMTSolver::bvule(SMTExpr lhs_, SMTExpr rhs_) {
-	return bool2bv(Z3_mk_bvule(ctx, lhs, rhs));
-}
-
-SMTExpr SMTSolver::bvugt(SMTExpr lhs_, SMTExpr rhs_) {
-	return bool2bv(Z3_mk_bvugt(ctx, lhs, rhs));
-}
-
-SMTExpr SMTSolver::bvuge(SMTExpr lhs_, SMTExpr rhs_) {
-	return bool2bv(Z3_mk_bvuge(ctx, lhs, rhs));
-}
-
-SMTExpr SMTSolver::extract(unsigned high, unsigned low, SMTExpr e_) {
-	return Z3_mk_extract(ctx, high, low, e);
-}
-
-SMTExpr SMTSolver::zero_extend(unsigned i, SMTExpr e_) {
-	return Z3_mk_zero_ext(ctx, i, e);
-}
-
-SMTExpr SMTSolver::sign_extend(unsigned i, SMTExpr e_) {
-	return Z3_mk_sign_ext(ctx, i, e);
-}
-
-SMTExpr SMTSolver::bvredand(SMTExpr e_) {
-	return Z3_mk_bvredand(ctx, e);
-}
-
-SMTExpr SMTSolver::bvredor(SMTExpr e_) {
-	return Z3_mk_bvredor(ctx, e);
-}
-
-SMTExpr SMTSolver::bvnot(SMTExpr e_) {
-	return Z3_mk_bvnot(ctx, e);
-}
-
-SMTExpr SMTSolver::bvneg(SMTExpr e_) {
-	return Z3_mk_bvneg(ctx, e);
-}
-
-SMTExpr SMTSolver::bvadd(SMTExpr lhs_, SMTExpr rhs_) {
-	return Z3_mk_bvadd(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvsub(SMTExpr lhs_, SMTExpr rhs_) {
-	return Z3_mk_bvsub(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvmul(SMTExpr lhs_, SMTExpr rhs_) {
-	return Z3_mk_bvmul(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvsdiv(SMTExpr lhs_, SMTExpr rhs_) {
-	return Z3_mk_bvsdiv(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvudiv(SMTExpr lhs_, SMTExpr rhs_) {
-	return Z3_mk_bvudiv(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvsrem(SMTExpr lhs_, SMTExpr rhs_) {
-	return Z3_mk_bvsrem(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvurem(SMTExpr lhs_, SMTExpr rhs_) {
-	return Z3_mk_bvurem(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvshl(SMTExpr lhs_, SMTExpr rhs_) {
-	return Z3_mk_bvshl(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvlshr(SMTExpr lhs_, SMTExpr rhs_) {
-	return Z3_mk_bvlshr(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvashr(SMTExpr lhs_, SMTExpr rhs_) {
-	return Z3_mk_bvashr(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvand(SMTExpr lhs_, SMTExpr rhs_) {
-	return Z3_mk_bvand(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvor(SMTExpr lhs_, SMTExpr rhs_) {
-	return Z3_mk_bvor(ctx, lhs, rhs);
-}
-
-SMTExpr SMTSolver::bvxor(SMTExpr lhs_, SMTExpr rhs_) {
-	return Z3_mk_bvxor(ctx, lhs, rhs);
+Z3_ast SMTZ3::build(const SMTNode *N, Z3_ast *ops) {
+	Z3_ast lhs = ops[0], rhs = ops[1];
+	switch (N->getOpcode()) {
+	default: llvm_unreachable("Unknown opcode!");
+	case SMT_CONST:   return bvconst(N->getValue());
+	case SMT_VAR:
+		// Names may repeat; keep the variables distinct.
+		return Z3_mk_fresh_const(ctx, N->getName(), Z3_mk_bv_sort(ctx, N->getWidth()));
+	case SMT_ITE:     return Z3_mk_ite(ctx, bv2bool(ops[0]), ops[1], ops[2]);
+	case SMT_EQ:      return bool2bv(keep(Z3_mk_eq(ctx, lhs, rhs)));
+	case SMT_SLT:     return bool2bv(keep(Z3_mk_bvslt(ctx, lhs, rhs)));
+	case SMT_SLE:     return bool2bv(keep(Z3_mk_bvsle(ctx, lhs, rhs)));
+	case SMT_ULT:     return bool2bv(keep(Z3_mk_bvult(ctx, lhs, rhs)));
+	case SMT_ULE:     return bool2bv(keep(Z3_mk_bvule(ctx, lhs, rhs)));
+	case SMT_EXTRACT: return Z3_mk_extract(ctx, N->getParam(0), N->getParam(1), lhs);
+	case SMT_ZEXT:    return Z3_mk_zero_ext(ctx, N->getParam(0), lhs);
+	case SMT_SEXT:    return Z3_mk_sign_ext(ctx, N->getParam(0), lhs);
+	case SMT_REDAND:  return Z3_mk_bvredand(ctx, lhs);
+	case SMT_REDOR:   return Z3_mk_bvredor(ctx, lhs);
+	case SMT_NOT:     return Z3_mk_bvnot(ctx, lhs);
+	case SMT_NEG:     return Z3_mk_bvneg(ctx, lhs);
+	case SMT_ADD:     return Z3_mk_bvadd(ctx, lhs, rhs);
+	case SMT_SUB:     return Z3_mk_bvsub(ctx, lhs, rhs);
+	case SMT_MUL:     return Z3_mk_bvmul(ctx, lhs, rhs);
+	case SMT_SDIV:    return Z3_mk_bvsdiv(ctx, lhs, rhs);
+	case SMT_UDIV:    return Z3_mk_bvudiv(ctx, lhs, rhs);
+	case SMT_SREM:    return Z3_mk_bvsrem(ctx, lhs, rhs);
+	case SMT_UREM:    return Z3_mk_bvurem(ctx, lhs, rhs);
+	case SMT_SHL:     return Z3_mk_bvshl(ctx, lhs, rhs);
+	case SMT_LSHR:    return Z3_mk_bvlshr(ctx, lhs, rhs);
+	case SMT_ASHR:    return Z3_mk_bvashr(ctx, lhs, rhs);
+	case SMT_AND:     return Z3_mk_bvand(ctx, lhs, rhs);
+	case SMT_OR:      return Z3_mk_bvor(ctx, lhs, rhs);
+	case SMT_XOR:     return Z3_mk_bvxor(ctx, lhs, rhs);
+	case SMT_SADDO: {
+		Z3_ast no_ovfl = keep(Z3_mk_bvadd_no_overflow(ctx, lhs, rhs, true));
+		return fails(no_ovfl, keep(Z3_mk_bvadd_no_underflow(ctx, lhs, rhs)));
+	}
+	case SMT_UADDO:
+		return fails(keep(Z3_mk_bvadd_no_overflow(ctx, lhs, rhs, false)));
+	case SMT_SSUBO: {
+		Z3_ast no_ovfl = keep(Z3_mk_bvsub_no_overflow(ctx, lhs, rhs));
+		return fails(no_ovfl, keep(Z3_mk_bvsub_no_underflow(ctx, lhs, rhs, true)));
+	}
+	case SMT_USUBO:
+		return fails(keep(Z3_mk_bvsub_no_underflow(ctx, lhs, rhs, false)));
+	case SMT_SMULO: {
+		Z3_ast no_ovfl = keep(Z3_mk_bvmul_no_overflow(ctx, lhs, rhs, true));
+		return fails(no_ovfl, keep(Z3_mk_bvmul_no_underflow(ctx, lhs, rhs)));
+	}
+	case SMT_UMULO:
+		return fails(keep(Z3_mk_bvmul_no_overflow(ctx, lhs, rhs, false)));
+	case SMT_SDIVO:
+		return fails(keep(Z3_mk_bvsdiv_no_overflow(ctx, lhs, rhs)));
+	}
 }
 
-SMTExpr SMTSolver::bvneg_overflow(SMTExpr e_) {
-	return bvnot(bool2bv(Z3_mk_bvneg_no_overflow(ctx, e)));
+SMTZ3::SMTZ3(bool modelgen) : interrupted(false), checking(false) {
+	Z3_config cfg = Z3_mk_config();
+	Z3_set_param_value(cfg, "model", modelgen || SMTSolver::abstracts() ? "true" : "false");
+	ctx = Z3_mk_context_rc(cfg);
+	Z3_del_config(cfg);
+	Z3_tactic simplify = Z3_mk_tactic(ctx, "simplify");
+	Z3_tactic_inc_ref(ctx, simplify);
+	Z3_tactic qfbv = Z3_mk_tactic(ctx, "qfbv");
+	Z3_tactic_inc_ref(ctx, qfbv);
+	Z3_tactic tactic = Z3_tactic_and_then(ctx, simplify, qfbv);
+	Z3_tactic_inc_ref(ctx, tactic);
+	solver = Z3_mk_solver_from_tactic(ctx, tactic);
+	Z3_solver_inc_ref(ctx, solver);
+	Z3_tactic_dec_ref(ctx, tactic);
+	Z3_tactic_dec_ref(ctx, qfbv);
+	Z3_tactic_dec_ref(ctx, simplify);
+	// Set up constants.
+	Z3_sort sort = Z3_mk_bv_sort(ctx, 1);
+	bvfalse = Z3_mk_int(ctx, 0, sort);
+	Z3_inc_ref(ctx, bvfalse);
+	bvtrue = Z3_mk_int(ctx, 1, sort);
+	Z3_inc_ref(ctx, bvtrue);
+}
+
+SMTZ3::~SMTZ3() {
+	drop();
+	for (auto &i : terms)
+		Z3_dec_ref(ctx, i.second);
+	Z3_dec_ref(ctx, bvtrue);
+	Z3_dec_ref(ctx, bvfalse);
+	Z3_solver_dec_ref(ctx, solver);
+	Z3_del_context(ctx);
 }
 
-SMTExpr SMTSolver::bvsadd_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	return bvor(
-		bvnot(bool2bv(Z3_mk_bvadd_no_overflow(ctx, lhs, rhs, Z3_TRUE))),
-		bvnot(bool2bv(Z3_mk_bvadd_no_underflow(ctx, lhs, rhs)))
-	);
+void SMTZ3::assume(SMTExpr e_) {
+	Z3_solver_assert(ctx, solver, bv2bool(term(e_)));
+	drop();
+}
+
+// A fresh Boolean to guard a query.
+Z3_ast SMTZ3::act() {
+	return keep(Z3_mk_fresh_const(ctx, "act", Z3_mk_bool_sort(ctx)));
+}
+
+// Check under the activation literals, within what is left of the
+// current timer.  The watchdog may still interrupt the check, which
+// accounts for CPU rather than wall time.  The rlimit of a check,
+// the budget, counts from the start of the check.
+Z3_lbool SMTZ3::check(unsigned n, Z3_ast *acts, bool cores) {
+	Z3_params p = Z3_mk_params(ctx);
+	Z3_params_inc_ref(ctx, p);
+	unsigned ms = SMTTimer::remaining();
+	Z3_params_set_uint(ctx, p, Z3_mk_string_symbol(ctx, "timeout"), ms ? ms : UINT_MAX);
+	unsigned long long budget = SMTTimer::budget();
+	Z3_params_set_uint(ctx, p, Z3_mk_string_symbol(ctx, "rlimit"), std::min(budget, (unsigned long long)UINT_MAX));
+	Z3_params_set_bool(ctx, p, Z3_mk_string_symbol(ctx, "unsat_core"), cores);
+	Z3_solver_set_params(ctx, solver, p);
+	Z3_params_dec_ref(ctx, p);
+	// Either interrupt() sees the check running, or this sees
+	// interrupted set.
+	checking = true;
+	Z3_lbool res = Z3_L_UNDEF;
+	if (!interrupted)
+		res = Z3_solver_check_assumptions(ctx, solver, n, acts);
+	checking = false;
+	return res;
+}
+
+// Activation literals are never assumed again.
+void SMTZ3::retire(unsigned n, Z3_ast *acts) {
+	for (unsigned i = 0; i != n; ++i)
+		Z3_solver_assert(ctx, solver, keep(Z3_mk_not(ctx, acts[i])));
+}
+
+SMTStatus SMTZ3::solve(SMTExpr e_, SMTModel *m_) {
+	Z3_ast e = bv2bool(term(e_));
+	Z3_ast a = act();
+	Z3_solver_assert(ctx, solver, keep(Z3_mk_implies(ctx, a, e)));
+	if (!SMTTimer::begin(this)) {
+		drop();
+		return SMT_TIMEOUT;
+	}
+	Z3_lbool res = check(1, &a);
+	// Once interrupted, Z3 may fail to give a model even if the
+	// check has answered.
+	bool expired = SMTTimer::end() || interrupted;
+	if (res == Z3_L_TRUE && m_ && !expired) {
+		Z3_model model = Z3_solver_get_model(ctx, solver);
+		Z3_model_inc_ref(ctx, model);
+		*m_ = model;
+	}
+	// Z3 gives up on its own at the timeout or the rlimit, which
+	// the tactics report as canceled.
+	const char *reason = res == Z3_L_UNDEF ? Z3_solver_get_reason_unknown(ctx, solver) : "";
+	bool timeout = !strcmp(reason, "timeout") || !strcmp(reason, "max. resource limit exceeded") || !strcmp(reason, "canceled");
+	retire(1, &a);
+	drop();
+	if (expired || timeout)
+		return SMT_TIMEOUT;
+	switch (res) {
+	default:         return SMT_UNDEF;
+	case Z3_L_FALSE: return SMT_UNSAT;
+	case Z3_L_TRUE:  return SMT_SAT;
+	}
 }
 
-SMTExpr SMTSolver::bvuadd_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	return bvnot(bool2bv(Z3_mk_bvadd_no_overflow(ctx, lhs, rhs, Z3_FALSE)));
+// Guard E and each of the literals, and map the failed ones back.
+void SMTZ3::core(SMTExpr e_, unsigned n, const SMTExpr *lits, bool *core) {
+	std::fill(core, core + n, true);
+	std::vector<Z3_ast> acts(n + 1);
+	for (unsigned i = 0; i <= n; ++i) {
+		Z3_ast e = bv2bool(term(i ? lits[i - 1] : e_));
+		acts[i] = act();
+		Z3_solver_assert(ctx, solver, keep(Z3_mk_implies(ctx, acts[i], e)));
+	}
+	if (!SMTTimer::begin(this)) {
+		drop();
+		return;
+	}
+	Z3_lbool res = check(n + 1, acts.data(), true);
+	if (!SMTTimer::end() && !interrupted && res == Z3_L_FALSE) {
+		Z3_ast_vector failed = Z3_solver_get_unsat_core(ctx, solver);
+		Z3_ast_vector_inc_ref(ctx, failed);
+		unsigned size = Z3_ast_vector_size(ctx, failed);
+		SmallVector<bool, 16> found(n);
+		bool any = false;
+		for (unsigned k = 0; k != size; ++k) {
+			Z3_ast a = Z3_ast_vector_get(ctx, failed, k);
+			for (unsigned i = 1; i <= n; ++i) {
+				if (Z3_is_eq_ast(ctx, a, acts[i])) {
+					found[i - 1] = true;
+					any = true;
+				}
+			}
+		}
+		Z3_ast_vector_dec_ref(ctx, failed);
+		if (any)
+			std::copy(found.begin(), found.end(), core);
+	}
+	retire(n + 1, acts.data());
+	drop();
 }
 
-SMTExpr SMTSolver::bvssub_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	return bvor(
-		bvnot(bool2bv(Z3_mk_bvsub_no_overflow(ctx, lhs, rhs))),
-		bvnot(bool2bv(Z3_mk_bvsub_no_underflow(ctx, lhs, rhs, Z3_TRUE)))
-	);
+// The solver is unusable afterwards and should be discarded.
+void SMTZ3::interrupt() {
+	interrupted = true;
+	while (checking) {
+		Z3_interrupt(ctx);
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
 }
 
-SMTExpr SMTSolver::bvusub_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	return bvnot(bool2bv(Z3_mk_bvsub_no_underflow(ctx, lhs, rhs, Z3_FALSE)));
+void SMTZ3::eval(SMTModel m_, SMTExpr e_, APInt &r) {
+	unsigned width = e_->getWidth();
+	Z3_ast v = NULL;
+	// Complete the model, so that the value is a numeral.
+	if (Z3_model_eval(ctx, m, term(e_), true, &v) && Z3_is_numeral_ast(ctx, v))
+		r = APInt(width, Z3_get_numeral_string(ctx, v), 10);
+	else
+		r = APInt(width, 0);
 }
 
-SMTExpr SMTSolver::bvsmul_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	return bvor(
-		bvnot(bool2bv(Z3_mk_bvmul_no_overflow(ctx, lhs, rhs, Z3_TRUE))),
-		bvnot(bool2bv(Z3_mk_bvmul_no_underflow(ctx, lhs, rhs)))
-	);
+void SMTZ3::release(SMTModel m_) {
+	Z3_model_dec_ref(ctx, m);
 }
 
-SMTExpr SMTSolver::bvumul_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	return bvnot(bool2bv(Z3_mk_bvmul_no_overflow(ctx, lhs, rhs, Z3_FALSE)));
+static SMTBackend *create(bool modelgen) {
+	return new SMTZ3(modelgen);
 }
 
-SMTExpr SMTSolver::bvsdiv_overflow(SMTExpr lhs_, SMTExpr rhs_) {
-	return bvnot(bool2bv(Z3_mk_bvsdiv_no_overflow(ctx, lhs, rhs)));
-}
+static SMTBackendRegistration R("z3", create, 1, true);
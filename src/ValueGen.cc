@@ -1,9 +1,11 @@
 #include "ValueGen.h"
+#include "BugOn.h"
 #include <llvm/InstVisitor.h>
 #include <llvm/ADT/APInt.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/IntrinsicInst.h>
 #include <llvm/IR/Operator.h>
+#include <llvm/Support/ErrorHandling.h>
 #include <llvm/Support/GetElementPtrTypeIterator.h>
 #include <llvm/Support/raw_ostream.h>
 #include <assert.h>
@@ -11,6 +13,7 @@
 using namespace llvm;
 
 static void addRangeConstraints(SMTSolver &, SMTExpr, MDNode *);
+static SMTExpr getLazyCondition(ValueGen &, BugOnInst *);
 
 namespace {
 
@@ -165,8 +168,6 @@ struct ValueVisitor : InstVisitor<ValueVisitor, SMTExpr> {
 		unsigned PtrSize = TD.getPointerSizeInBits(/*GEP.getPointerAddressSpace()*/);
 		// Start from base.
 		SMTExpr Offset = get(GEP.getPointerOperand());
-		// Increase refcnt.
-		SMT.incref(Offset);
 		APInt ConstOffset = APInt::getNullValue(PtrSize);
 
 		gep_type_iterator GTI = gep_type_begin(GEP);
@@ -194,24 +195,13 @@ struct ValueVisitor : InstVisitor<ValueVisitor, SMTExpr> {
 			SMTExpr SIdx = get(V);
 			unsigned IdxSize = SMT.bvwidth(SIdx);
 			// Sometimes a 64-bit GEP's index is 32-bit.
-			if (IdxSize != PtrSize) {
-				SMTExpr Tmp;
-				if (IdxSize < PtrSize)
-					Tmp = SMT.sign_extend(PtrSize - IdxSize, SIdx);
-				else
-					Tmp = SMT.extract(PtrSize - 1, 0, SIdx);
-				SIdx = Tmp;
-			} else {
-				SMT.incref(SIdx);
-			}
+			if (IdxSize < PtrSize)
+				SIdx = SMT.sign_extend(PtrSize - IdxSize, SIdx);
+			else if (IdxSize > PtrSize)
+				SIdx = SMT.extract(PtrSize - 1, 0, SIdx);
 			SMTExpr SElemSize = SMT.bvconst(ElemSize);
 			SMTExpr LocalOffset = SMT.bvmul(SIdx, SElemSize);
-			SMTExpr Tmp = SMT.bvadd(Offset, LocalOffset);
-			SMT.decref(SIdx);
-			SMT.decref(SElemSize);
-			SMT.decref(Offset);
-			SMT.decref(LocalOffset);
-			Offset = Tmp;
+			Offset = SMT.bvadd(Offset, LocalOffset);
 		}
 
 		if (!ConstOffset)
@@ -219,10 +209,7 @@ struct ValueVisitor : InstVisitor<ValueVisitor, SMTExpr> {
 
 		// Merge constant offset.
 		SMTExpr SConstOffset = SMT.bvconst(ConstOffset);
-		SMTExpr Tmp = SMT.bvadd(Offset, SConstOffset);
-		SMT.decref(Offset);
-		SMT.decref(SConstOffset);
-		return Tmp;
+		return SMT.bvadd(Offset, SConstOffset);
 	}
 
 	SMTExpr visitBitCastInst(BitCastInst &I) {
@@ -230,9 +217,7 @@ struct ValueVisitor : InstVisitor<ValueVisitor, SMTExpr> {
 		// V can be floating point.
 		if (!VG.isAnalyzable(V))
 			return mk_fresh(&I);
-		SMTExpr E = get(V);
-		SMT.incref(E);
-		return E;
+		return get(V);
 	}
 
 	SMTExpr visitPtrToIntInst(PtrToIntInst &I) {
@@ -245,7 +230,6 @@ struct ValueVisitor : InstVisitor<ValueVisitor, SMTExpr> {
 		if (IntSize < PtrSize)
 			return SMT.extract(IntSize - 1, 0, E);
 		// IntSize == PtrSize.
-		SMT.incref(E);
 		return E;
 	}
 
@@ -286,11 +270,6 @@ private:
 ValueGen::ValueGen(DataLayout &TD, SMTSolver &SMT)
 	: TD(TD), SMT(SMT) {}
 
-ValueGen::~ValueGen() {
-	for (iterator i = Cache.begin(), e = Cache.end(); i != e; ++i)
-		SMT.decref(i->second);
-}
-
 bool ValueGen::isAnalyzable(Value *V) {
 	return isAnalyzable(V->getType());
 }
@@ -314,6 +293,22 @@ SMTExpr ValueGen::get(Value *V) {
 	return E;
 }
 
+SMTExpr ValueGen::getCondition(BugOnInst *I) {
+	if (!I->isLazy())
+		return get(I->getCondition());
+	// Kept with the bugon call itself.
+	SMTExpr E = Cache.lookup(I);
+	if (!E) {
+		E = getLazyCondition(*this, I);
+		Cache[I] = E;
+	}
+	return E;
+}
+
+void ValueGen::erase(Value *V) {
+	Cache.erase(V);
+}
+
 void addRangeConstraints(SMTSolver &SMT, SMTExpr E, MDNode *MD) {
 	// !range comes in pairs.
 	unsigned n = MD->getNumOperands();
@@ -326,18 +321,12 @@ void addRangeConstraints(SMTSolver &SMT, SMTExpr E, MDNode *MD) {
 			continue;
 		SMTExpr Cmp0 = NULL, Cmp1 = NULL, Cond;
 		// Ignore >= 0.
-		if (!!Lo) {
-			SMTExpr Tmp = SMT.bvconst(Lo);
-			Cmp0 = SMT.bvuge(E, Tmp);
-			SMT.decref(Tmp);
-		}
+		if (!!Lo)
+			Cmp0 = SMT.bvuge(E, SMT.bvconst(Lo));
 		// Note that (< Hi) is not always correct.  Need to
 		// ignore Hi == 0 (i.e., <= UMAX) or use (<= Hi - 1).
-		if (!!Hi) {
-			SMTExpr Tmp = SMT.bvconst(Hi);
-			Cmp1 = SMT.bvult(E, Tmp);
-			SMT.decref(Tmp);
-		}
+		if (!!Hi)
+			Cmp1 = SMT.bvult(E, SMT.bvconst(Hi));
 		if (!Cmp0) {
 			Cond = Cmp1;
 		} else if (!Cmp1) {
@@ -347,10 +336,52 @@ void addRangeConstraints(SMTSolver &SMT, SMTExpr E, MDNode *MD) {
 				Cond = SMT.bvand(Cmp0, Cmp1);
 			else		// Wrap: [Lo, UMAX] union [0, Hi).
 				Cond = SMT.bvor(Cmp0, Cmp1);
-			SMT.decref(Cmp0);
-			SMT.decref(Cmp1);
 		}
 		SMT.assume(Cond);
-		SMT.decref(Cond);
 	}
 }
+
+// Encode the condition of a lazy bugon as the IR built by the
+// bugon passes otherwise would be.
+SMTExpr getLazyCondition(ValueGen &VG, BugOnInst *I) {
+	SMTSolver &SMT = VG.SMT;
+	StringRef Kind = I->getKind();
+	SMTExpr L = VG.get(I->getLazyOperand(0));
+	SMTExpr R = VG.get(I->getLazyOperand(1));
+	unsigned n = SMT.bvwidth(L);
+	if (Kind == "sadd")
+		return SMT.bvsadd_overflow(L, R);
+	if (Kind == "uadd")
+		return SMT.bvuadd_overflow(L, R);
+	if (Kind == "ssub")
+		return SMT.bvssub_overflow(L, R);
+	if (Kind == "usub")
+		return SMT.bvusub_overflow(L, R);
+	if (Kind == "smul")
+		return SMT.bvsmul_overflow(L, R);
+	if (Kind == "umul")
+		return SMT.bvumul_overflow(L, R);
+	if (Kind == "sdiv")
+		return SMT.bvsdiv_overflow(L, R);
+	if (Kind == "sshl" || Kind == "ushl") {
+		SMTExpr Power = SMT.bvshl(SMT.bvconst(APInt(n, 1)), R);
+		if (Kind == "sshl")
+			return SMT.bvsmul_overflow(L, Power);
+		return SMT.bvumul_overflow(L, Power);
+	}
+	if (Kind == "gep.max" || Kind == "gep.min") {
+		// The offset of R from L, extended to n + 1 bits to avoid
+		// overflowing ptr + offset.
+		SMTExpr Offset = SMT.sign_extend(1, SMT.bvsub(R, L));
+		SMTExpr End = SMT.bvadd(SMT.zero_extend(1, L), Offset);
+		if (Kind == "gep.max")
+			return SMT.bvsgt(End, SMT.bvconst(APInt::getMaxValue(n).zext(n + 1)));
+		return SMT.bvslt(End, SMT.bvconst(APInt::getNullValue(n + 1)));
+	}
+	if (Kind == "noalias") {
+		SMTExpr NotNull = SMT.ne(L, SMT.bvconst(APInt::getNullValue(n)));
+		return SMT.bvand(NotNull, SMT.eq(L, R));
+	}
+	I->dump();
+	llvm_unreachable("Unknown lazy bugon!");
+}
@@ -4,6 +4,8 @@
 #include <llvm/IR/DataLayout.h>
 #include "SMTSolver.h"
 
+class BugOnInst;
+
 class ValueGen {
 public:
 	llvm::DataLayout &TD;
@@ -14,11 +16,14 @@ public:
 	ValueExprMap Cache;
 
 	ValueGen(llvm::DataLayout &, SMTSolver &);
-	~ValueGen();
 
 	static bool isAnalyzable(llvm::Value *);
 	static bool isAnalyzable(llvm::Type *);
 	SMTExpr get(llvm::Value *);
+	// The bug condition of a bugon, lazy or not.
+	SMTExpr getCondition(BugOnInst *);
+	// Drop the encoding of a value to be deleted.
+	void erase(llvm::Value *);
 
 	iterator begin() { return Cache.begin(); }
 	iterator end() { return Cache.end(); }
@@ -0,0 +1,35 @@
+// RUN: %cc %s | optck | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -smt-abstract-width=0 | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -smt-abstract-width=32 | diagdiff --prefix=exp %s
+//
+// Queries over 64-bit multiplication and division of two variables.
+// In mul and udiv, proving the call dead needs no exact operator.
+// In refine, the axioms allow a product of two operands over 2^32
+// not to overflow; only the multiplication given back to the solver
+// shows that it does, which makes the call dead.
+
+void bar(void);
+
+long mul(long a, long b)
+{
+	long p = a * b;
+	if (!(p + 100 > p))
+		bar();		// exp: {{anti-dce}}
+	return p;
+}
+
+long udiv(unsigned long x, unsigned long y)
+{
+	long q = (long)(x / y);
+	if (!(q + 100 > q))
+		bar();		// exp: {{anti-dce}}
+	return q;
+}
+
+long refine(long a, long b)
+{
+	long p = a * b;
+	if (a > 0x100000000L && b > 0x100000000L)
+		bar();		// exp: {{anti-dce}}
+	return p;
+}
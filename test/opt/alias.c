@@ -1,4 +1,10 @@
 // RUN: %cc %s | optck | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -smt-portfolio=boolector,boolector | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -separate | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -bugon-lazy | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -anti-threads=4 | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -anti-simplify-prefilter=0 | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -anti-simplify-threads=4 | diagdiff --prefix=exp %s
 
 #include <stdlib.h>
 
@@ -0,0 +1,27 @@
+// RUN: rm -rf %t && mkdir %t
+// RUN: %cc %s | optck -smt-budget=1000 -smt-cache=%t/cache > %t/cold
+// RUN: diagdiff --prefix=exp %s < %t/cold
+// RUN: %cc %s | optck -smt-timeout=5000 -smt-budget=1000 | diagdiff --prefix=exp %s
+//
+// A budget counts per query, so a warm cache, which settles some of
+// them, or several threads leave the others the same answers.
+// RUN: %cc %s | optck -smt-budget=1000 -smt-cache=%t/cache > %t/warm
+// RUN: diff %t/cold %t/warm
+// RUN: %cc %s | optck -smt-budget=1000 -anti-threads=4 > %t/threads
+// RUN: diff %t/cold %t/threads
+
+void bar(void);
+
+int foo(int a)
+{
+	if (!(a + 100 > a))
+		bar();		// exp: {{anti-dce}}
+	return a;
+}
+
+int inv(int x)
+{
+	if (!x)
+		x = 1 / x;	// exp: {{anti-dce}}
+	return x;
+}
@@ -0,0 +1,24 @@
+// RUN: rm -rf %t
+// RUN: %cc %s | optck -smt-cache=%t | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -smt-cache=%t | diagdiff --prefix=exp %s
+//
+// A second run answers from the directory: turn every cached unsat
+// into sat and no code is dead any more.
+// RUN: find %t -type f | xargs sed -i s/unsat/sat/
+// RUN: %cc %s | optck -smt-cache=%t | diagdiff %s
+
+void bar(void);
+
+int foo(int a)
+{
+	if (!(a + 100 > a))
+		bar();		// exp: {{anti-dce}}
+	return a;
+}
+
+int inv(int x)
+{
+	if (!x)
+		x = 1 / x;	// exp: {{anti-dce}}
+	return x;
+}
@@ -0,0 +1,26 @@
+// RUN: %cc %s | optck | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -anti-dce-batch | diagdiff --prefix=exp %s
+//
+// Blocks behind a dead block are removed with it, not reported.
+
+void bar(int);
+
+void nested(int a)
+{
+	if (!(a + 100 > a)) {
+		bar(0);		// exp: {{anti-dce}}
+		if (a > 0)
+			bar(1);
+	}
+}
+
+void joined(int a, int b)
+{
+	if (!(a + 100 > a))
+		bar(0);		// exp: {{anti-dce}}
+	else if (!(b + 100 > b))
+		bar(1);		// exp: {{anti-dce}}
+	else
+		return;
+	bar(2);
+}
@@ -1,4 +1,5 @@
 // RUN: %cc %s | optck | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -separate | diagdiff --prefix=exp %s
 
 struct C {
   void f();
@@ -1,4 +1,10 @@
 // RUN: %cc %s | optck | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -smt-abstract-width=0 | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -anti-dce-batch | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -separate | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -smt-simulate=0 | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -anti-threads=4 | diagdiff --prefix=exp %s
+// RUN: rm -rf %t && %cc %s | optck -smt-cache=%t | diagdiff --prefix=exp %s
 
 int bar(int);
 
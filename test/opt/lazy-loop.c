@@ -0,0 +1,18 @@
+// RUN: %cc %s | optck -front=%t.bc -bugon-loop && optck -back %t.bc | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -front=%t.bc -bugon-lazy -bugon-loop && optck -back %t.bc | diagdiff --prefix=exp %s
+//
+// -bugon-loop computes the condition of a bugon in a loop at its exit,
+// lazy or not.
+
+void bar(void);
+int g, sink;
+
+void foo(int n)
+{
+	int a = g;
+	int i;
+	for (i = 0; i < n; ++i)
+		sink = a + 100;
+	if (a > 0x7ffffff0)
+		bar();		// exp: {{anti-dce}}
+}
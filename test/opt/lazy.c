@@ -0,0 +1,48 @@
+// RUN: %cc %s | optck | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -bugon-lazy | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -front=%t.bc -bugon-lazy
+// RUN: llvm-dis < %t.bc | FileCheck %s
+//
+// A lazy bugon with a constant condition is handled as any other: it
+// is shown if always true, and left out if always false.
+
+void bar(void);
+int g, sink;
+
+// CHECK-LABEL: define void @overflow(
+// CHECK: @opt.bugon(i1 true)
+void overflow(void)
+{
+	g = 0x7fffffff;
+	sink = g + 1;		// exp: {{bugon-int}}
+}
+
+// CHECK-LABEL: define void @no_overflow(
+// CHECK-NOT: @opt.bugon
+// CHECK: ret void
+void no_overflow(void)
+{
+	g = 1;
+	sink = g + 1;
+}
+
+// Division overflows only for INT_MIN / -1.
+// CHECK-LABEL: define void @half(
+// CHECK-NOT: @opt.bugon
+// CHECK: ret void
+void half(int x)
+{
+	sink = x / 2;
+}
+
+// The bugons of a GEP take its offset from the GEP itself.
+// CHECK-LABEL: define void @gep(
+// CHECK: [[P:%[a-z.0-9]+]] = getelementptr inbounds i8* %buf
+// CHECK-NEXT: @opt.bugon(i1 undef, i8* %buf, i8* [[P]])
+// CHECK-NEXT: @opt.bugon(i1 undef, i8* %buf, i8* [[P]])
+void gep(char *buf)
+{
+	unsigned int len = 1<<30;
+	if (buf + len < buf)
+		bar();		// exp: {{anti-dce}}
+}
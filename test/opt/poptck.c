@@ -0,0 +1,47 @@
+// RUN: rm -rf %t && mkdir -p %t
+// RUN: %cc %s > %t/poptck.ll
+// RUN: sh -c 'cd %t && poptck' | FileCheck --check-prefix=RUN1 %s
+// RUN: diagdiff --prefix=exp %s < %t/pstack.txt
+// RUN: FileCheck --check-prefix=ORDER %s < %t/pstack.txt
+// RUN: FileCheck --check-prefix=HIST %s < %t/.pstack-cache/history
+//
+// A second run schedules by the history and gives the same output.
+// RUN: cp %t/pstack.txt %t/pstack.1
+// RUN: sh -c 'cd %t && poptck' | FileCheck --check-prefix=RUN1 %s
+// RUN: diff %t/pstack.1 %t/pstack.txt
+// RUN: FileCheck --check-prefix=HIST %s < %t/.pstack-cache/history
+
+void bar(void);
+
+int f1(int a)
+{
+	if (!(a + 100 > a))
+		bar();		// exp: {{anti-dce}}
+	return a;
+}
+
+int f2(int x)
+{
+	if (!x)
+		x = 1 / x;	// exp: {{anti-dce}}
+	return x;
+}
+
+void f3(char *buf)
+{
+	unsigned int len = 1<<30;
+	if (buf + len < buf)
+		bar();		// exp: {{anti-dce}}
+}
+
+// RUN1: Generated 3 warnings
+
+// Reports come in function order, whichever job finished first.
+// ORDER: poptck.c:19:
+// ORDER: poptck.c:26:
+// ORDER: poptck.c:34:
+
+// Each function with bugons has the time it took.
+// HIST-DAG: ./poptck.ll{{.}}f1{{.}}{{[0-9.e-]+$}}
+// HIST-DAG: ./poptck.ll{{.}}f2{{.}}{{[0-9.e-]+$}}
+// HIST-DAG: ./poptck.ll{{.}}f3{{.}}{{[0-9.e-]+$}}
@@ -0,0 +1,30 @@
+// RUN: rm -f %t.log
+// RUN: %cc %s | optck -smt-portfolio=boolector,boolector -smt-portfolio-log=%t.log | diagdiff --prefix=exp %s
+// RUN: FileCheck %s < %t.log
+//
+// Once each class has been raced enough, a later run routes all its
+// queries and adds nothing to the log.
+// RUN: sort -u %t.log > %t.once
+// RUN: cat %t.once %t.once %t.once > %t.log
+// RUN: cp %t.log %t.seeded
+// RUN: %cc %s | optck -smt-portfolio=boolector,boolector -smt-portfolio-log=%t.log | diagdiff --prefix=exp %s
+// RUN: diff %t.seeded %t.log
+
+void bar(void);
+
+int foo(int a)
+{
+	if (!(a + 100 > a))
+		bar();		// exp: {{anti-dce}}
+	return a;
+}
+
+long mul(long a, long b)
+{
+	long p = a * b;
+	if (!(p + 100 > p))
+		bar();		// exp: {{anti-dce}}
+	return p;
+}
+
+// CHECK: {{^[0-9A-F]+/[0-9]+ boolector$}}
@@ -1,4 +1,7 @@
 // RUN: %cc -DNORETURN= %s | optck | diagdiff --prefix=exp %s
+// RUN: %cc -DNORETURN= %s | optck -smt-abstract-width=0 | diagdiff --prefix=exp %s
+// RUN: %cc -DNORETURN= %s | optck -anti-dce-batch | diagdiff --prefix=exp %s
+// RUN: %cc -DNORETURN= %s | optck -separate | diagdiff --prefix=exp %s
 // RUN: %cc %s | optck | diagdiff %s
 //
 // http://bugs.debian.org/cgi-bin/bugreport.cgi?bug=616180
@@ -0,0 +1,25 @@
+// RUN: %cc %s | optck | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -anti-simplify-prefilter=0 | diagdiff --prefix=exp %s
+// RUN: %cc %s | env BENCHMARK=1 optck | FileCheck %s
+//
+// Comparisons constant without bugons are decided before the solver;
+// arithmetic wraps, so one constant only with bugons is not.
+
+int range(unsigned char c)
+{
+	return c + 1 > 0;
+}
+
+int bits(int x)
+{
+	return (x << 1) == 1;
+}
+
+int wrap(int a)
+{
+	return a + 1 > a;	// exp: {{anti-simplify}}
+}
+
+// CHECK: query: range
+// CHECK: query: bits
+// CHECK: query: succ
@@ -1,4 +1,6 @@
 // RUN: %cc %s | optck | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -separate | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -smt-simulate=0 | diagdiff --prefix=exp %s
 //
 // https://groups.google.com/d/msg/comp.os.plan9/NYdK1L7rf8Q/yfAiZoOlwNUJ 
 
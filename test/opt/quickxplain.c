@@ -0,0 +1,25 @@
+// RUN: %cc %s | optck | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck | FileCheck %s
+//
+// Both additions must not overflow for the block to be dead; the
+// division bugon on the same path is left out of the core.
+
+void bar(void);
+
+int foo(int a)
+{
+	int c = 10 / a;
+	int b = a + 1;
+	if (b + 1 < a)
+		bar();		// exp: {{anti-dce}}
+	return b + c;
+}
+
+// CHECK:      bug: anti-dce
+// CHECK:      ncore: 2
+// CHECK-NEXT: core:
+// CHECK-NEXT:   - {{.*}}quickxplain.c:12:
+// CHECK-NEXT:     - signed addition overflow
+// CHECK-NEXT:   - {{.*}}quickxplain.c:13:
+// CHECK-NEXT:     - signed addition overflow
+// CHECK-NOT:  division by zero
@@ -0,0 +1,13 @@
+// RUN: %cc %s | optck | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -anti-simplify-threads=4 | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck > %t.1
+// RUN: %cc %s | optck -anti-simplify-threads=4 > %t.4
+// RUN: diff %t.1 %t.4
+//
+// A query solved ahead reads a value folded since, and must be redone.
+
+int foo(int a)
+{
+	int c = a + 1 > a;	// exp: {{anti-simplify}}
+	return c == 0;
+}
@@ -0,0 +1,27 @@
+// RUN: %cc %s | optck | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -smt-simulate=0 | diagdiff --prefix=exp %s
+//
+// Queries folded by the word-level simplifier.
+
+void bar(void);
+
+int mul1(int a)
+{
+	if (!(a * 1 + 100 > a))
+		bar();		// exp: {{anti-dce}}
+	return a;
+}
+
+int mul4(int a)
+{
+	if (!(a * 4 + 100 > a * 4))
+		bar();		// exp: {{anti-dce}}
+	return a;
+}
+
+int shl0(int a)
+{
+	if (!((a << 0) + 100 > a))
+		bar();		// exp: {{anti-dce}}
+	return a;
+}
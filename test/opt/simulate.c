@@ -0,0 +1,35 @@
+// RUN: %cc %s | optck | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -smt-simulate=0 | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -smt-simulate=16 | diagdiff --prefix=exp %s
+//
+// Random simulation must only ever answer sat with a real witness.
+
+void bar(void);
+
+// Simulation finds a witness at once.
+void easy(int x)
+{
+	if (x + 1 > 10)
+		bar();
+}
+
+// Too rare for simulation; the solver must show it reachable.
+void rare(int x)
+{
+	if (x * 3 == 0x12345678)
+		bar();
+}
+
+// Lanes dividing by zero are poison and are no witness.
+void poison(unsigned x, unsigned y)
+{
+	if (x / y > 100)
+		bar();
+}
+
+// Wider than 64 bits: skip simulation.
+void wide(__int128 a)
+{
+	if (!(a + 100 > a))
+		bar();		// exp: {{anti-dce}}
+}
@@ -0,0 +1,121 @@
+// RUN: %cc %s | optck | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -separate | diagdiff --prefix=exp %s
+//
+// optck does not inline: the bugons of callees reach callers through
+// their summaries only.
+
+void bar(void);
+int sink;
+
+static int quot(int x, int y)
+{
+  return x / y;
+}
+
+int foo(int x, int y)
+{
+  int r = quot(x, y);
+  if (y == 0) // exp: {{anti-simplify}}
+    return 0;
+  return r;
+}
+
+// A bugon on the value returned holds after the call.
+static int inc(int x)
+{
+  int t = x + 1;
+  sink = t * 2;
+  return t;
+}
+
+int use_ret(int x)
+{
+  int r = inc(x);
+  if (r > 0x40000000)
+    bar(); // exp: {{anti-dce}}
+  return r;
+}
+
+// A call within a cycle of recursion sees no summary; calls from
+// outside see the summary of the cycle's functions.
+static int rec(int n)
+{
+  int q = 100 / n;
+  if (n > 1)
+    q += rec(n - 1);
+  return q;
+}
+
+int use_rec(int n)
+{
+  int r = rec(n);
+  if (n == 0) // exp: {{anti-simplify}}
+    return 0;
+  return r;
+}
+
+// A weak definition may not be the one called.
+__attribute__((weak)) int wquot(int x, int y)
+{
+  return x / y;
+}
+
+int use_weak(int x, int y)
+{
+  int r = wquot(x, y);
+  if (y == 0)
+    return 0;
+  return r;
+}
+
+// A summary keeps the first 16 bugons only.
+static void fifteen(int x, int z)
+{
+  sink = x + 1; sink = x + 2; sink = x + 3; sink = x + 4; sink = x + 5;
+  sink = x + 6; sink = x + 7; sink = x + 8; sink = x + 9; sink = x + 10;
+  sink = x + 11; sink = x + 12; sink = x + 13; sink = x + 14; sink = x + 15;
+  sink = 100 / z;
+}
+
+static void sixteen(int x, int z)
+{
+  sink = x + 1; sink = x + 2; sink = x + 3; sink = x + 4; sink = x + 5;
+  sink = x + 6; sink = x + 7; sink = x + 8; sink = x + 9; sink = x + 10;
+  sink = x + 11; sink = x + 12; sink = x + 13; sink = x + 14; sink = x + 15;
+  sink = x + 16;
+  sink = 100 / z;
+}
+
+int use_fifteen(int x, int z)
+{
+  fifteen(x, z);
+  if (z == 0) // exp: {{anti-simplify}}
+    return 0;
+  return 1;
+}
+
+int use_sixteen(int x, int z)
+{
+  sixteen(x, z);
+  if (z == 0)
+    return 0;
+  return 1;
+}
+
+// Lost without inlining: with f = 1 the division always runs, which
+// inlining would show the caller, but its block does not post-dominate
+// the entry of quot_if, so the summary leaves it out.
+static int quot_if(int f, int x, int y)
+{
+  if (f)
+    return x / y;
+  return 0;
+}
+
+int use_if(int x, int y)
+{
+  int r = quot_if(1, x, y);
+  if (y == 0)
+    return 0;
+  return r;
+}
@@ -0,0 +1,39 @@
+// RUN: %cc %s | optck | diagdiff --prefix=exp %s
+// RUN: %cc %s | optck -anti-threads=4 | diagdiff --prefix=exp %s
+//
+// Reports come out in function order whatever the number of threads.
+// RUN: %cc %s | optck > %t.1
+// RUN: %cc %s | optck -anti-threads=4 > %t.4
+// RUN: %cc %s | optck -anti-threads=0 > %t.0
+// RUN: diff %t.1 %t.4
+// RUN: diff %t.1 %t.0
+
+void bar(void);
+
+int f1(int a)
+{
+	if (!(a + 100 > a))
+		bar();		// exp: {{anti-dce}}
+	return a;
+}
+
+int f2(int x)
+{
+	if (!x)
+		x = 1 / x;	// exp: {{anti-dce}}
+	return x;
+}
+
+void f3(char *buf)
+{
+	unsigned int len = 1<<30;
+	if (buf + len < buf)
+		bar();		// exp: {{anti-dce}}
+}
+
+int f4(int a)
+{
+	if (a + 1 > 10)
+		bar();
+	return a;
+}